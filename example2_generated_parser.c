@@ -0,0 +1,96 @@
+/* Compares a parser generated by tools/jesy_gen.py with jesy_parse followed by
+ * key lookups.
+ *
+ *   python3 tools/jesy_gen.py tools/sensor_msg.json -o .
+ *   cc -O2 -DNDEBUG example2_generated_parser.c sensor_msg.c jesy.c -o example2
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jesy.h"
+#include "sensor_msg.h"
+
+#define ITERATIONS 1000000
+static uint8_t mem_pool[0x1000];
+
+char json_data[] = "{\"id\": 4711, \"timestamp\": 1700000000123, \"name\": \"greenhouse-3\","
+                   " \"site\": \"north\", \"temperature\": 21.75, \"humidity\": 48.5,"
+                   " \"online\": true, \"firmware\": {\"major\": 2, \"minor\": 14}}";
+
+static uint32_t generic_parse(struct sensor_msg *msg)
+{
+  struct jesy_context *ctx = jesy_init_context(mem_pool, sizeof(mem_pool));
+  struct jesy_element *root;
+  struct jesy_element *value;
+  uint32_t err;
+
+  if (!ctx) {
+    return JESY_OUT_OF_MEMORY;
+  }
+  if (0 != (err = jesy_parse(ctx, json_data, sizeof(json_data)))) {
+    return err;
+  }
+  root = jesy_get_root(ctx);
+  memset(msg, 0, sizeof(*msg));
+
+  if ((value = jesy_get_key_value(ctx, root, "id"))) {
+    msg->id = (uint32_t)strtoul(value->value, NULL, 10);
+  }
+  if ((value = jesy_get_key_value(ctx, root, "timestamp"))) {
+    msg->timestamp = strtoll(value->value, NULL, 10);
+  }
+  if ((value = jesy_get_key_value(ctx, root, "temperature"))) {
+    msg->temperature = strtod(value->value, NULL);
+  }
+  if ((value = jesy_get_key_value(ctx, root, "humidity"))) {
+    msg->humidity = strtod(value->value, NULL);
+  }
+  if ((value = jesy_get_key_value(ctx, root, "online"))) {
+    msg->online = (value->type == JESY_TRUE);
+  }
+  if ((value = jesy_get_key_value(ctx, root, "name")) && (value->length < sizeof(msg->name))) {
+    memcpy(msg->name, value->value, value->length);
+  }
+  if ((value = jesy_get_key_value(ctx, root, "site")) && (value->length < sizeof(msg->site))) {
+    memcpy(msg->site, value->value, value->length);
+  }
+  return JESY_NO_ERR;
+}
+
+static uint32_t generated_parse(struct sensor_msg *msg)
+{
+  struct jesy_context *ctx = jesy_init_context(mem_pool, sizeof(mem_pool));
+  if (!ctx) {
+    return JESY_OUT_OF_MEMORY;
+  }
+  return sensor_msg_parse(ctx, json_data, sizeof(json_data), msg);
+}
+
+static double measure(uint32_t (*parse)(struct sensor_msg*), struct sensor_msg *msg)
+{
+  clock_t start = clock();
+  uint32_t idx;
+
+  for (idx = 0; idx < ITERATIONS; idx++) {
+    if (parse(msg) != JESY_NO_ERR) {
+      printf("\n Parsing failed!");
+      exit(-1);
+    }
+  }
+  return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / ITERATIONS;
+}
+
+int main(void)
+{
+  struct sensor_msg msg;
+  double generic_ns = measure(generic_parse, &msg);
+  double generated_ns = measure(generated_parse, &msg);
+
+  printf("\n id: %u, name: %s, site: %s, temperature: %g, humidity: %g, online: %d",
+         msg.id, msg.name, msg.site, msg.temperature, msg.humidity, msg.online);
+  printf("\n jesy_parse + lookups: %8.1f ns/message", generic_ns);
+  printf("\n sensor_msg_parse:     %8.1f ns/message (%.2fx)\n", generated_ns, generic_ns / generated_ns);
+  return 0;
+}
@@ -3,13 +3,20 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <errno.h>
+#include <math.h>
+#if defined(__SSE2__) && defined(__GNUC__)
+  #include <emmintrin.h>
+  #define JESY_USE_SSE2
+#endif
 #include "jesy.h"
+#ifdef JESY_ENABLE_THREADS
+  #include <pthread.h>
+#endif
 
 #ifdef JESY_USE_32BIT_NODE_DESCRIPTOR
-  #define JESY_INVALID_INDEX 0xFFFFFFFF
   #define JESY_MAX_VALUE_LEN 0xFFFFFFFF
 #else
-  #define JESY_INVALID_INDEX 0xFFFF
   #define JESY_MAX_VALUE_LEN 0xFFFF
 #endif
 
@@ -23,7 +30,29 @@
 #define IS_DIGIT(c) ((c >= '0') && (c <= '9'))
 #define IS_ESCAPE(c) ((c=='\\') || (c=='\"') || (c=='\/') || (c=='\b') || \
                       (c=='\f') || (c=='\n') || (c=='\r') || (c=='\t') || (c == '\u'))
-#define LOOK_AHEAD(ctx_) (((ctx_->offset + 1) < ctx_->json_size) ? ctx_->json_data[ctx_->offset + 1] : '\0')
+#define LOOK_AHEAD(data_, size_, offset_) ((((offset_) + 1) < (size_)) ? (data_)[(offset_) + 1] : '\0')
+
+#ifdef JESY_ENABLE_STATS
+  #ifndef JESY_CYCLE_COUNTER
+    #if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+      #define JESY_CYCLE_COUNTER() __builtin_ia32_rdtsc()
+    #else
+      #define JESY_CYCLE_COUNTER() 0
+    #endif
+  #endif
+  #define JESY_STAT_INC(ctx_, member_) ((ctx_)->stats.member_++)
+  #define JESY_STAT_ADD(ctx_, member_, value_) ((ctx_)->stats.member_ += (value_))
+  #define JESY_STAT_MAX(ctx_, member_, value_) \
+    do { if ((value_) > (ctx_)->stats.member_) { (ctx_)->stats.member_ = (value_); } } while (0)
+  #define JESY_STAT_TIMER(start_) uint64_t start_ = JESY_CYCLE_COUNTER()
+  #define JESY_STAT_ELAPSED(ctx_, member_, start_) ((ctx_)->stats.member_ += JESY_CYCLE_COUNTER() - (start_))
+#else
+  #define JESY_STAT_INC(ctx_, member_)
+  #define JESY_STAT_ADD(ctx_, member_, value_)
+  #define JESY_STAT_MAX(ctx_, member_, value_)
+  #define JESY_STAT_TIMER(start_)
+  #define JESY_STAT_ELAPSED(ctx_, member_, start_)
+#endif
 
 #define HAS_PARENT(node_ptr) (node_ptr->parent < JESY_INVALID_INDEX)
 #define HAS_SIBLING(node_ptr) (node_ptr->sibling < JESY_INVALID_INDEX)
@@ -39,24 +68,48 @@ static struct jesy_element *jesy_find_duplicate_key(struct jesy_context *ctx,
                                                     struct jesy_element *object_node,
                                                     struct jesy_token *key_token);
 
+#ifdef JESY_ENABLE_HASH_CACHE
+/* Drops the cached hashes of an element and its ancestors. A node without a
+ * cached hash has none above it either, so the walk stops there. */
+static void jesy_hash_invalidate(struct jesy_context *ctx, struct jesy_element *element)
+{
+  while (element && element->hash) {
+    element->hash = 0;
+    element = GET_PARENT(ctx, element);
+  }
+}
+  #define JESY_HASH_INVALIDATE(ctx_, element_) jesy_hash_invalidate(ctx_, element_)
+#else
+  #define JESY_HASH_INVALIDATE(ctx_, element_)
+#endif
+
 static struct jesy_element* jesy_allocate(struct jesy_context *ctx)
 {
   struct jesy_element *new_element = NULL;
 
   if (ctx->node_count < ctx->capacity) {
-    if (ctx->free) {
+    if (ctx->free && !ctx->reserved) {
       /* Pop the first node from free list */
       new_element = (struct jesy_element*)ctx->free;
       ctx->free = ctx->free->next;
+      JESY_STAT_INC(ctx, free_list_hits);
     }
     else {
       assert(ctx->index < ctx->capacity);
       new_element = &ctx->pool[ctx->index];
       ctx->index++;
+      if (ctx->reserved) {
+        ctx->reserved--;
+      }
     }
     /* Setting node descriptors to their default values. */
     memset(&new_element->parent, 0xFF, sizeof(jesy_node_descriptor) * 4);
+#ifdef JESY_ENABLE_HASH_CACHE
+    new_element->hash = 0;
+#endif
     ctx->node_count++;
+    JESY_STAT_INC(ctx, nodes_allocated);
+    JESY_STAT_MAX(ctx, pool_high_water, ctx->node_count);
   }
   else {
     ctx->status = JESY_OUT_OF_MEMORY;
@@ -73,17 +126,124 @@ static void jesy_free(struct jesy_context *ctx, struct jesy_element *element)
   assert(element < (ctx->pool + ctx->capacity));
   assert(ctx->node_count > 0);
 
+  ctx->pristine = false;
   if (ctx->node_count > 0) {
-    free_node->next = NULL;
     ctx->node_count--;
+    JESY_STAT_INC(ctx, nodes_freed);
     /* prepend the node to the free LIFO */
-    if (ctx->free) {
-      free_node->next = ctx->free->next;
-    }
+    free_node->next = ctx->free;
     ctx->free = free_node;
   }
 }
 
+/* Allocates a string from the end of the pool. The node capacity shrinks
+ * accordingly, but never below the nodes already in use or reserved.
+ * return the string buffer or NULL if the pool is exhausted */
+static char* jesy_string_alloc(struct jesy_context *ctx, uint32_t length)
+{
+  char *lowest = (char*)(ctx->pool + ctx->index + ctx->reserved);
+  uint32_t capacity;
+
+  if ((uint32_t)(ctx->strings - lowest) < length) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return NULL;
+  }
+  ctx->strings -= length;
+  capacity = (uint32_t)((ctx->strings - (char*)ctx->pool) / sizeof(struct jesy_element));
+  if (capacity < ctx->capacity) {
+    ctx->capacity = capacity;
+  }
+  return ctx->strings;
+}
+
+static uint32_t jesy_key_hash(jesy_node_descriptor parent, const char *name, uint16_t length)
+{
+  uint32_t hash = 2166136261u ^ (uint32_t)parent;
+  uint16_t index;
+
+  for (index = 0; index < length; index++) {
+    hash = (hash ^ (uint8_t)name[index]) * 16777619u;
+  }
+  return hash ^ (hash >> 15);
+}
+
+#ifdef JESY_USE_STRING_ARENA
+struct jesy_interned_key {
+  struct jesy_interned_key *next;
+  uint16_t length;
+  char name[];
+};
+
+/* Copies a string into the string area.
+ * return the copy or NULL if the pool is exhausted */
+static char* jesy_arena_copy(struct jesy_context *ctx, const char *value, uint16_t length)
+{
+  char *copy = jesy_string_alloc(ctx, length);
+  if (copy) {
+    memcpy(copy, value, length);
+  }
+  return copy;
+}
+
+/* Returns the interned copy of a key name. A new copy is made only for names
+ * that haven't been seen before. */
+static char* jesy_arena_intern(struct jesy_context *ctx, const char *name, uint16_t length)
+{
+  struct jesy_interned_key **bucket = &ctx->keys[jesy_key_hash(0, name, length) % JESY_KEY_BUCKETS];
+  struct jesy_interned_key *iter;
+  size_t size = sizeof(struct jesy_interned_key) + length;
+  size_t padding;
+
+  for (iter = *bucket; iter; iter = iter->next) {
+    if ((iter->length == length) && (0 == memcmp(iter->name, name, length))) {
+      return iter->name;
+    }
+  }
+
+  /* Keep the entry aligned for its pointer member. */
+  padding = (size_t)((uintptr_t)(ctx->strings - size) % sizeof(void*));
+  if ((size + padding) > UINT32_MAX) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return NULL;
+  }
+  iter = (struct jesy_interned_key*)jesy_string_alloc(ctx, (uint32_t)(size + padding));
+  if (!iter) {
+    return NULL;
+  }
+  iter->next = *bucket;
+  iter->length = length;
+  memcpy(iter->name, name, length);
+  *bucket = iter;
+  return iter->name;
+}
+#endif
+
+#ifdef JESY_ENABLE_KEY_IDS
+/* Looks up the ID of a key name. If add is set, unknown names get a new ID as
+ * long as the dictionary has room. */
+static uint16_t jesy_key_id(struct jesy_context *ctx, const char *name, uint16_t length, bool add)
+{
+  uint32_t slot = jesy_key_hash(0, name, length) % (JESY_MAX_KEY_IDS * 2);
+
+  while (ctx->key_id_slots[slot]) {
+    uint16_t id = (uint16_t)(ctx->key_id_slots[slot] - 1);
+    if ((ctx->key_name_lengths[id] == length) && (0 == memcmp(ctx->key_names[id], name, length))) {
+      return id;
+    }
+    slot = (slot + 1) % (JESY_MAX_KEY_IDS * 2);
+  }
+
+  if (!add || (ctx->key_id_count >= JESY_MAX_KEY_IDS)) {
+    return JESY_INVALID_KEY_ID;
+  }
+  ctx->key_names[ctx->key_id_count] = name;
+  ctx->key_name_lengths[ctx->key_id_count] = length;
+  ctx->key_id_count++;
+  ctx->key_id_slots[slot] = ctx->key_id_count;
+  return (uint16_t)(ctx->key_id_count - 1);
+}
+#endif
+
 static bool jesy_validate_element(struct jesy_context *ctx, struct jesy_element *element)
 {
   assert(ctx);
@@ -91,7 +251,7 @@ static bool jesy_validate_element(struct jesy_context *ctx, struct jesy_element
 
   if ((element >= ctx->pool) &&
       ((((void*)element - (void*)ctx->pool) % sizeof(*element)) == 0) &&
-      ((element >= ctx->pool) < ctx->capacity)) {
+      (element < (ctx->pool + ctx->capacity))) {
     return true;
   }
 
@@ -128,37 +288,27 @@ struct jesy_element* jesy_get_child(struct jesy_context *ctx, struct jesy_elemen
   return NULL;
 }
 
-static struct jesy_element* jesy_get_parent_bytype(struct jesy_context *ctx,
-                                                   struct jesy_element *element,
-                                                   enum jesy_type type)
+jesy_node_descriptor jesy_get_handle(struct jesy_context *ctx, struct jesy_element *element)
 {
-  struct jesy_element *parent = NULL;
-  if (ctx && element && jesy_validate_element(ctx, element)) {
-    while (element && HAS_PARENT(element)) {
-      element = &ctx->pool[element->parent];
-      if (element->type == type) {
-        parent = element;
-        break;
-      }
-    }
+  if (ctx && element && jesy_validate_element(ctx, element) && (element < (ctx->pool + ctx->index))) {
+    return (jesy_node_descriptor)(element - ctx->pool);
   }
-  return parent;
+  return JESY_INVALID_INDEX;
 }
 
-static struct jesy_element* jesy_get_structure_parent_node(struct jesy_context *ctx,
-                                                           struct jesy_element *element)
+bool jesy_cursor_begin(struct jesy_context *ctx, struct jesy_cursor *cursor, jesy_node_descriptor parent)
 {
-  struct jesy_element *parent = NULL;
-  if (ctx && element && jesy_validate_element(ctx, element)) {
-    while (element && HAS_PARENT(element)) {
-      element = &ctx->pool[element->parent];
-      if ((element->type == JESY_OBJECT) || (element->type == JESY_ARRAY)) {
-        parent = element;
-        break;
-      }
-    }
+  if (!cursor) {
+    return false;
+  }
+  cursor->pool = NULL;
+  cursor->node = JESY_INVALID_INDEX;
+  if (!ctx || (parent >= ctx->index)) {
+    return false;
   }
-  return parent;
+  cursor->pool = ctx->pool;
+  cursor->node = ctx->pool[parent].first_child;
+  return true;
 }
 
 static struct jesy_element* jesy_append_element(struct jesy_context *ctx,
@@ -169,12 +319,17 @@ static struct jesy_element* jesy_append_element(struct jesy_context *ctx,
 {
   struct jesy_element *new_element = jesy_allocate(ctx);
 
+  ctx->pristine = false;
   if (new_element) {
     new_element->type = type;
     new_element->length = length;
     new_element->value = value;
+#ifdef JESY_ENABLE_KEY_IDS
+    new_element->key_id = (type == JESY_KEY) ? jesy_key_id(ctx, value, length, true) : JESY_INVALID_KEY_ID;
+#endif
 
     if (parent) {
+      JESY_HASH_INVALIDATE(ctx, parent);
       new_element->parent = (jesy_node_descriptor)(parent - ctx->pool); /* parent's index */
 
       if (HAS_CHILD(parent)) {
@@ -195,30 +350,98 @@ static struct jesy_element* jesy_append_element(struct jesy_context *ctx,
   return new_element;
 }
 
+/* Detaches an element from its parent and siblings. The subtree of the element
+ * stays intact.
+ * return the previous sibling of the element or NULL if it was the first child. */
+static struct jesy_element* jesy_unlink(struct jesy_context *ctx, struct jesy_element *element)
+{
+  jesy_node_descriptor index = (jesy_node_descriptor)(element - ctx->pool);
+  struct jesy_element *parent;
+  struct jesy_element *prev = NULL;
+
+  ctx->pristine = false;
+  if (!HAS_PARENT(element)) {
+    if (ctx->root == element) {
+      ctx->root = NULL;
+    }
+    return NULL;
+  }
+
+  parent = &ctx->pool[element->parent];
+  JESY_HASH_INVALIDATE(ctx, parent);
+  if (parent->first_child == index) {
+    parent->first_child = element->sibling;
+  }
+  else {
+    prev = &ctx->pool[parent->first_child];
+    while (prev->sibling != index) {
+      prev = &ctx->pool[prev->sibling];
+    }
+    prev->sibling = element->sibling;
+  }
+  if (parent->last_child == index) {
+    parent->last_child = prev ? (jesy_node_descriptor)(prev - ctx->pool) : JESY_INVALID_INDEX;
+  }
+
+  element->parent = JESY_INVALID_INDEX;
+  element->sibling = JESY_INVALID_INDEX;
+  return prev;
+}
+
+/* Inserts a detached element into the children of parent, right after prev.
+ * A NULL prev makes the element the first child. */
+static void jesy_link(struct jesy_context *ctx, struct jesy_element *parent,
+                      struct jesy_element *prev, struct jesy_element *element)
+{
+  jesy_node_descriptor index = (jesy_node_descriptor)(element - ctx->pool);
+
+  ctx->pristine = false;
+  JESY_HASH_INVALIDATE(ctx, parent);
+  element->parent = (jesy_node_descriptor)(parent - ctx->pool);
+  if (prev) {
+    element->sibling = prev->sibling;
+    prev->sibling = index;
+    if (parent->last_child == (jesy_node_descriptor)(prev - ctx->pool)) {
+      parent->last_child = index;
+    }
+  }
+  else {
+    element->sibling = parent->first_child;
+    parent->first_child = index;
+    if (!HAS_SIBLING(element)) {
+      parent->last_child = index;
+    }
+  }
+}
+
 void jesy_delete_element(struct jesy_context *ctx, struct jesy_element *element)
 {
   struct jesy_element *iter = element;
 
-  if (!jesy_validate_element(ctx, element)) {
+  if (!ctx || !element || !jesy_validate_element(ctx, element)) {
     return;
   }
 
+  jesy_unlink(ctx, element);
+
+  /* Free the detached subtree bottom-up. The descriptors of a node must be
+     read before the node is handed over to the free list. */
   while (true) {
+    struct jesy_element *parent;
 
     while (HAS_CHILD(iter)) {
       iter = &ctx->pool[iter->first_child];
     }
 
-    if (HAS_PARENT(iter)) {
-      ctx->pool[iter->parent].first_child = iter->sibling;
-    }
-
-    jesy_free(ctx, iter);
     if (iter == element) {
+      jesy_free(ctx, iter);
       break;
     }
 
-    iter = &ctx->pool[iter->parent];
+    parent = &ctx->pool[iter->parent];
+    parent->first_child = iter->sibling;
+    jesy_free(ctx, iter);
+    iter = parent;
   }
 }
 
@@ -235,21 +458,20 @@ const struct {
   {',',  JESY_TOKEN_COMMA           },
   };
 
-static inline bool jesy_get_symbolic_token(struct jesy_context *ctx,
+static inline bool jesy_get_symbolic_token(uint32_t offset,
                                            char ch, struct jesy_token *token)
 {
   uint32_t idx;
   for (idx = 0; idx < JESY_ARRAY_LEN(jesy_symbolic_token_mapping); idx++) {
     if (ch == jesy_symbolic_token_mapping[idx].symbol) {
-      UPDATE_TOKEN((*token), jesy_symbolic_token_mapping[idx].token_type, ctx->offset, 1);
+      UPDATE_TOKEN((*token), jesy_symbolic_token_mapping[idx].token_type, offset, 1);
       return true;
     }
   }
   return false;
 }
 
-static inline bool jesy_is_symbolic_token(struct jesy_context *ctx,
-                                          char ch)
+static inline bool jesy_is_symbolic_token(char ch)
 {
   uint32_t idx;
   for (idx = 0; idx < JESY_ARRAY_LEN(jesy_symbolic_token_mapping); idx++) {
@@ -260,20 +482,67 @@ static inline bool jesy_is_symbolic_token(struct jesy_context *ctx,
   return false;
 }
 
-static inline bool jesy_get_number_token(struct jesy_context *ctx,
+/* Returns the offset of the first non-space symbol at or after the given offset. */
+static inline uint32_t jesy_skip_space(const char *data, uint32_t offset, uint32_t size)
+{
+#ifdef JESY_USE_SSE2
+  /* Long runs of spaces (indentation of pretty JSONs) are skipped 16 bytes at once. */
+  while ((offset + 16) <= size) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)&data[offset]);
+    __m128i space = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')),
+                                              _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t'))),
+                                 _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r')),
+                                              _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'))));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(space) ^ 0xFFFF;
+    if (mask) {
+      return offset + (uint32_t)__builtin_ctz(mask);
+    }
+    offset += 16;
+  }
+#endif
+  while ((offset < size) && IS_SPACE(data[offset])) {
+    offset++;
+  }
+  return offset;
+}
+
+/* Returns the offset of the first '\"', '\\' or NUL symbol at or after the given
+ * offset, i.e. the end of the plain part of a STRING. */
+static inline uint32_t jesy_skip_string(const char *data, uint32_t offset, uint32_t size)
+{
+#ifdef JESY_USE_SSE2
+  while ((offset + 16) <= size) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)&data[offset]);
+    __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')),
+                                                _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))),
+                                   _mm_cmpeq_epi8(chunk, _mm_setzero_si128()));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8(special);
+    if (mask) {
+      return offset + (uint32_t)__builtin_ctz(mask);
+    }
+    offset += 16;
+  }
+#endif
+  while ((offset < size) && (data[offset] != '"') && (data[offset] != '\\') && (data[offset] != '\0')) {
+    offset++;
+  }
+  return offset;
+}
+
+static inline bool jesy_get_number_token(const char *json_data, uint32_t json_size, uint32_t offset,
                                          char ch, struct jesy_token *token)
 {
   bool tokenizing_completed = false;
   if (IS_DIGIT(ch)) {
     token->length++;
-    ch = LOOK_AHEAD(ctx);
+    ch = LOOK_AHEAD(json_data, json_size, offset);
     if (!IS_DIGIT(ch) && (ch != '.')) { /* TODO: more symbols are acceptable in the middle of a number */
       tokenizing_completed = true;
     }
   }
   else if (ch == '.') {
     token->length++;
-    if (!IS_DIGIT(LOOK_AHEAD(ctx))) {
+    if (!IS_DIGIT(LOOK_AHEAD(json_data, json_size, offset))) {
       token->type = JESY_TOKEN_INVALID;
       tokenizing_completed = true;
     }
@@ -288,13 +557,13 @@ static inline bool jesy_get_number_token(struct jesy_context *ctx,
   return tokenizing_completed;
 }
 
-static inline bool jesy_get_specific_token(struct jesy_context *ctx,
+static inline bool jesy_get_specific_token(const char *json_data,
                           struct jesy_token *token, char *cmp_str, uint16_t len)
 {
   bool tokenizing_completed = false;
   token->length++;
   if (token->length == len) {
-    if (0 != (strncmp(&ctx->json_data[token->offset], cmp_str, len))) {
+    if (0 != (strncmp(&json_data[token->offset], cmp_str, len))) {
       token->type = JESY_TOKEN_INVALID;
     }
     tokenizing_completed = true;
@@ -302,13 +571,16 @@ static inline bool jesy_get_specific_token(struct jesy_context *ctx,
   return tokenizing_completed;
 }
 
-static struct jesy_token jesy_get_token(struct jesy_context *ctx)
+/* Delivers the token following the symbol at *offset and moves *offset to its
+ * last symbol. The tokenizer needs no other state, so jesy_scan runs it
+ * without a context. */
+static struct jesy_token jesy_tokenize(const char *json_data, uint32_t json_size, uint32_t *offset)
 {
   struct jesy_token token = { 0 };
 
   while (true) {
 
-    if ((++ctx->offset >= ctx->json_size) || (ctx->json_data[ctx->offset] == '\0')) {
+    if ((++(*offset) >= json_size) || (json_data[*offset] == '\0')) {
       /* End of data. If token is incomplete, mark it as invalid. */
       if (token.type) {
         token.type = JESY_TOKEN_INVALID;
@@ -316,87 +588,105 @@ static struct jesy_token jesy_get_token(struct jesy_context *ctx)
       break;
     }
 
-    char ch = ctx->json_data[ctx->offset];
+    char ch = json_data[*offset];
 
     if (!token.type) {
 
-      if (jesy_get_symbolic_token(ctx, ch, &token)) {
+      if (jesy_get_symbolic_token(*offset, ch, &token)) {
         break;
       }
 
       if (ch == '\"') {
         /* '\"' won't be a part of token. Use offset of next symbol */
-        UPDATE_TOKEN(token, JESY_TOKEN_STRING, ctx->offset + 1, 0);
+        UPDATE_TOKEN(token, JESY_TOKEN_STRING, *offset + 1, 0);
         continue;
       }
 
       if (IS_DIGIT(ch)) {
-        UPDATE_TOKEN(token, JESY_TOKEN_NUMBER, ctx->offset, 1);
+        UPDATE_TOKEN(token, JESY_TOKEN_NUMBER, *offset, 1);
         /* Unlike STRINGs, NUMBERs do not have dedicated symbols to indicate the
            end of data. To avoid consuming non-NUMBER characters, take a look ahead
            and stop the process in case of non-numeric symbols. */
-        if (jesy_is_symbolic_token(ctx, LOOK_AHEAD(ctx))) {
+        if (jesy_is_symbolic_token(LOOK_AHEAD(json_data, json_size, *offset))) {
           break;
         }
         continue;
       }
 
-      if ((ch == '-') && IS_DIGIT(LOOK_AHEAD(ctx))) {
-        UPDATE_TOKEN(token, JESY_TOKEN_NUMBER, ctx->offset, 1);
+      if ((ch == '-') && IS_DIGIT(LOOK_AHEAD(json_data, json_size, *offset))) {
+        UPDATE_TOKEN(token, JESY_TOKEN_NUMBER, *offset, 1);
         continue;
       }
 
       if (ch == 't') {
-        UPDATE_TOKEN(token, JESY_TOKEN_TRUE, ctx->offset, 1);
+        UPDATE_TOKEN(token, JESY_TOKEN_TRUE, *offset, 1);
         continue;
       }
 
       if (ch == 'f') {
-        UPDATE_TOKEN(token, JESY_TOKEN_FALSE, ctx->offset, 1);
+        UPDATE_TOKEN(token, JESY_TOKEN_FALSE, *offset, 1);
         continue;
       }
 
       if (ch == 'n') {
-        UPDATE_TOKEN(token, JESY_TOKEN_NULL, ctx->offset, 1);
+        UPDATE_TOKEN(token, JESY_TOKEN_NULL, *offset, 1);
         continue;
       }
 
       /* Skipping space symbols including: space, tab, carriage return */
       if (IS_SPACE(ch)) {
+        if (IS_SPACE(LOOK_AHEAD(json_data, json_size, *offset))) {
+          *offset = jesy_skip_space(json_data, *offset + 1, json_size) - 1;
+        }
         continue;
       }
 
-      UPDATE_TOKEN(token, JESY_TOKEN_INVALID, ctx->offset, 1);
+      UPDATE_TOKEN(token, JESY_TOKEN_INVALID, *offset, 1);
       break;
     }
     else if (token.type == JESY_TOKEN_STRING) {
       if (ch == '\"') { /* End of STRING. '\"' symbol isn't a part of token. */
         break;
       }
-      /* TODO: add checking for scape symbols */
-      token.length++;
+      if (ch == '\\') {
+        /* The escaped symbol is consumed as well, so an escaped '\"' doesn't
+           terminate the STRING. */
+        if ((*offset + 1) >= json_size) {
+          token.type = JESY_TOKEN_INVALID;
+          break;
+        }
+        (*offset)++;
+        token.length += 2;
+        continue;
+      }
+      /* Consume the plain symbols up to the next quote or escape at once. */
+      {
+        uint32_t end = jesy_skip_string(json_data, *offset + 1, json_size);
+        token.length += end - *offset;
+        *offset = end - 1;
+      }
       continue;
     }
     else if (token.type == JESY_TOKEN_NUMBER) {
-      if (jesy_get_number_token(ctx, ch, &token)) {
+      if (jesy_get_number_token(json_data, json_size, *offset, ch, &token)) {
         break;
       }
       continue;
     }
     else if (token.type == JESY_TOKEN_TRUE) {
-      if (jesy_get_specific_token(ctx, &token, "true", sizeof("true") - 1)) {
+      if (jesy_get_specific_token(json_data, &token, "true", sizeof("true") - 1)) {
         break;
       }
       continue;
     }
     else if (token.type == JESY_TOKEN_FALSE) {
-      if (jesy_get_specific_token(ctx, &token, "false", sizeof("false") - 1)) {
+      if (jesy_get_specific_token(json_data, &token, "false", sizeof("false") - 1)) {
         break;
       }
       continue;
     }
     else if (token.type == JESY_TOKEN_NULL) {
-      if (jesy_get_specific_token(ctx, &token, "null", sizeof("null") - 1)) {
+      if (jesy_get_specific_token(json_data, &token, "null", sizeof("null") - 1)) {
         break;
       }
       continue;
@@ -406,11 +696,17 @@ static struct jesy_token jesy_get_token(struct jesy_context *ctx)
     break;
   }
 
-  JESY_LOG_TOKEN(token.type, token.offset, token.length, &ctx->json_data[token.offset]);
+  JESY_LOG_TOKEN(token.type, token.offset, token.length, &json_data[token.offset]);
 
   return token;
 }
 
+static struct jesy_token jesy_get_token(struct jesy_context *ctx)
+{
+  JESY_STAT_INC(ctx, tokens);
+  return jesy_tokenize(ctx->json_data, ctx->json_size, &ctx->offset);
+}
+
 static struct jesy_element *jesy_find_duplicate_key(struct jesy_context *ctx,
                                                     struct jesy_element *object,
                                                     struct jesy_token *key_token)
@@ -431,7 +727,7 @@ static struct jesy_element *jesy_find_duplicate_key(struct jesy_context *ctx,
       duplicate = iter;
       break;
     }
-    iter = HAS_SIBLING(object) ? &ctx->pool[object->sibling] : NULL;
+    iter = HAS_SIBLING(iter) ? &ctx->pool[iter->sibling] : NULL;
   }
   return duplicate;
 }
@@ -460,7 +756,15 @@ static bool jesy_accept(struct jesy_context *ctx,
     }
     else if ((element_type == JESY_OBJECT) ||
              (element_type == JESY_ARRAY)) {
+      if (ctx->depth >= JESY_MAX_DEPTH) {
+        ctx->status = JESY_MAX_DEPTH_EXCEEDED;
+        return true;
+      }
       new_node = jesy_append_element(ctx, ctx->iter, element_type, ctx->token.length, &ctx->json_data[ctx->token.offset]);
+      if (new_node) {
+        ctx->containers[ctx->depth++] = (jesy_node_descriptor)(new_node - ctx->pool);
+        JESY_STAT_MAX(ctx, max_depth, ctx->depth);
+      }
     }
     else if (element_type == JESY_STRING) {
       new_node = jesy_append_element(ctx, ctx->iter, element_type, ctx->token.length, &ctx->json_data[ctx->token.offset]);
@@ -472,29 +776,24 @@ static bool jesy_accept(struct jesy_context *ctx,
       new_node = jesy_append_element(ctx, ctx->iter, element_type, ctx->token.length, &ctx->json_data[ctx->token.offset]);
     }
     else { /* JESY_NONE */
-       /* None-Key/Value tokens trigger upward iteration to the parent node.
+       /* None-Key/Value tokens trigger upward iteration to the innermost open
+          structure which is always on top of the container stack.
        A ']' indicates the end of an Array and consequently the end of a key:value
-             pair. Go back to the parent node.
-       A '}' indicates the end of an object. Go back to the parent node
-       A ',' indicates the end of a value.
-             if the value is a part of an array, go back parent array node.
-             otherwise, go back to the parent object.
+             pair. Close the array and go back to its enclosing structure.
+       A '}' indicates the end of an object. Close the object and go back to
+             its enclosing structure.
+       A ',' indicates the end of a value. Go back to the structure holding
+             the value.
       */
-      if (token_type == JESY_TOKEN_CLOSING_BRACE) {
-        /* [] (empty array) is a special case that needs no iteration in the
-           direction the parent node. */
-        if (ctx->iter->type != JESY_ARRAY) {
-          ctx->iter = jesy_get_parent_bytype(ctx, ctx->iter, JESY_ARRAY);
-        }
-        ctx->iter = jesy_get_structure_parent_node(ctx, ctx->iter);
-      }
-      else if (token_type == JESY_TOKEN_CLOSING_BRACKET) {
-        /* {} (empty object)is a special case that needs no iteration in the
-           direction the parent node. */
-        if (ctx->iter->type != JESY_OBJECT) {
-          ctx->iter = jesy_get_parent_bytype(ctx, ctx->iter, JESY_OBJECT);
+      if ((token_type == JESY_TOKEN_CLOSING_BRACE) ||
+          (token_type == JESY_TOKEN_CLOSING_BRACKET)) {
+        uint16_t expected_type = (token_type == JESY_TOKEN_CLOSING_BRACE) ? JESY_ARRAY : JESY_OBJECT;
+        if (!ctx->depth || (ctx->pool[ctx->containers[ctx->depth - 1]].type != expected_type)) {
+          ctx->status = JESY_UNEXPECTED_TOKEN;
+          return true;
         }
-        ctx->iter = jesy_get_structure_parent_node(ctx, ctx->iter);
+        ctx->depth--;
+        ctx->iter = ctx->depth ? &ctx->pool[ctx->containers[ctx->depth - 1]] : NULL;
       }
       else if (token_type == JESY_TOKEN_COMMA) {
         if ((ctx->iter->type == JESY_OBJECT) ||
@@ -504,7 +803,7 @@ static bool jesy_accept(struct jesy_context *ctx,
           }
         }
         else {
-          ctx->iter = jesy_get_structure_parent_node(ctx, ctx->iter);
+          ctx->iter = &ctx->pool[ctx->containers[ctx->depth - 1]];
         }
       }
     }
@@ -565,6 +864,8 @@ struct jesy_context* jesy_init_context(void *mem_pool, uint32_t pool_size)
   ctx->iter = NULL;
   ctx->root = NULL;
   ctx->free = NULL;
+  ctx->strings = (char*)ctx->pool + ctx->pool_size;
+  ctx->pristine = false;
 
 #ifndef NDEBUG
   printf("\nallocator capacity is %d nodes", ctx->capacity);
@@ -573,18 +874,11 @@ struct jesy_context* jesy_init_context(void *mem_pool, uint32_t pool_size)
   return ctx;
 }
 
-uint32_t jesy_parse(struct jesy_context *ctx, char *json_data, uint32_t json_length)
+/* Runs the parser state machine until the containers opened above base_depth
+ * are closed, the tokens are exhausted, an error occurs or max_steps steps are
+ * done. Each step consumes one to four tokens. */
+static void jesy_parse_run(struct jesy_context *ctx, uint16_t base_depth, uint32_t max_steps)
 {
-  ctx->json_data = json_data;
-  ctx->json_size = json_length;
-
-  /* Fetch the first token before entering the state machine. */
-  ctx->token = jesy_get_token(ctx);
-  /* First node is expected to be an OPENING_BRACKET. */
-  if (!jesy_expect(ctx, JESY_TOKEN_OPENING_BRACKET, JESY_OBJECT)) {
-    return ctx->status;
-  }
-
   do {
     if (ctx->token.type == JESY_TOKEN_EOF) { break; }
     switch (ctx->iter->type) {
@@ -665,11 +959,13 @@ uint32_t jesy_parse(struct jesy_context *ctx, char *json_data, uint32_t json_len
           }
         }
 
-        jesy_expect(ctx, JESY_TOKEN_COMMA, JESY_NONE);
-
-        if (ctx->iter->type == JESY_KEY) {
+        if (!jesy_expect(ctx, JESY_TOKEN_COMMA, JESY_NONE)) {
+          break;
         }
-        else if (ctx->iter->type == JESY_ARRAY) {
+
+        /* The comma moved the iterator to the enclosing container. In an
+           object, the next loop expects the key of the following member. */
+        if (ctx->iter->type == JESY_ARRAY) {
           if (jesy_accept(ctx, JESY_TOKEN_STRING, JESY_STRING)  ||
               jesy_accept(ctx, JESY_TOKEN_NUMBER, JESY_NUMBER)  ||
               jesy_accept(ctx, JESY_TOKEN_TRUE, JESY_TRUE)      ||
@@ -681,8 +977,7 @@ uint32_t jesy_parse(struct jesy_context *ctx, char *json_data, uint32_t json_len
           }
         }
         else {
-          //printf("\n 2.node type: %s, parent type: %s", jesy_node_type_str[ctx->iter->type], jesy_node_type_str[ctx->pool[ctx->iter->parent].type]);
-          assert(0);
+          assert(ctx->iter->type == JESY_OBJECT);
         }
 
         break;
@@ -691,9 +986,90 @@ uint32_t jesy_parse(struct jesy_context *ctx, char *json_data, uint32_t json_len
         assert(0);
         break;
     }
-  } while ((ctx->iter) && (ctx->status == 0));
+  } while ((ctx->iter) && (ctx->status == 0) && (ctx->depth > base_depth) && (--max_steps));
+}
+
+void jesy_tokenizer_init(struct jesy_context *ctx, char *json_data, uint32_t json_length)
+{
+  ctx->json_data = json_data;
+  ctx->json_size = json_length;
+  ctx->offset = (uint32_t)-1;
+  ctx->depth = 0;
+  ctx->status = JESY_NO_ERR;
+  ctx->token = jesy_get_token(ctx);
+}
+
+enum jesy_token_type jesy_next_token(struct jesy_context *ctx)
+{
+  ctx->token = jesy_get_token(ctx);
+  return ctx->token.type;
+}
+
+uint32_t jesy_parse_value(struct jesy_context *ctx, struct jesy_element *parent)
+{
+  uint16_t base_depth;
+
+  if (!ctx || !parent || !jesy_validate_element(ctx, parent) ||
+      ((parent->type != JESY_KEY) && (parent->type != JESY_ARRAY)) ||
+      ((parent->type == JESY_KEY) && HAS_CHILD(parent))) {
+    return JESY_INVALID_PARAMETER;
+  }
+
+  ctx->iter = parent;
+  base_depth = ctx->depth;
+
+  if (jesy_accept(ctx, JESY_TOKEN_STRING, JESY_STRING)   ||
+      jesy_accept(ctx, JESY_TOKEN_NUMBER, JESY_NUMBER)   ||
+      jesy_accept(ctx, JESY_TOKEN_TRUE, JESY_TRUE)       ||
+      jesy_accept(ctx, JESY_TOKEN_FALSE, JESY_FALSE)     ||
+      jesy_accept(ctx, JESY_TOKEN_NULL, JESY_NULL)) {
+    return ctx->status;
+  }
+
+  if (jesy_accept(ctx, JESY_TOKEN_OPENING_BRACKET, JESY_OBJECT) ||
+      jesy_expect(ctx, JESY_TOKEN_OPENING_BRACE, JESY_ARRAY)) {
+    if (ctx->status == 0) {
+      jesy_parse_run(ctx, base_depth, UINT32_MAX);
+    }
+    if ((ctx->status == 0) && (ctx->depth > base_depth)) {
+      ctx->status = (ctx->token.type == JESY_TOKEN_EOF) ? JESY_UNEXPECTED_EOF : JESY_UNEXPECTED_TOKEN;
+    }
+  }
+  return ctx->status;
+}
+
+uint32_t jesy_parse_begin(struct jesy_context *ctx, char *json_data, uint32_t json_length)
+{
+  if (!ctx) {
+    return JESY_INVALID_PARAMETER;
+  }
+  /* Fetch the first token before entering the state machine. */
+  jesy_tokenizer_init(ctx, json_data, json_length);
+  /* First node is expected to be an OPENING_BRACKET. */
+  if (jesy_expect(ctx, JESY_TOKEN_OPENING_BRACKET, JESY_OBJECT)) {
+    ctx->status = JESY_IN_PROGRESS;
+  }
+  return ctx->status;
+}
+
+uint32_t jesy_parse_step(struct jesy_context *ctx, uint32_t max_tokens)
+{
+  if (!ctx) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (ctx->status != JESY_IN_PROGRESS) {
+    return ctx->status;
+  }
+  ctx->status = JESY_NO_ERR;
+
+  jesy_parse_run(ctx, 0, max_tokens ? max_tokens : 1);
 
   if (ctx->status == 0) {
+    if ((ctx->token.type != JESY_TOKEN_EOF) && ctx->iter && ctx->depth) {
+      /* Stopped by the budget */
+      ctx->status = JESY_IN_PROGRESS;
+      return ctx->status;
+    }
     if (ctx->token.type != JESY_TOKEN_EOF) {
       ctx->status = JESY_UNEXPECTED_TOKEN;
     }
@@ -703,469 +1079,6264 @@ uint32_t jesy_parse(struct jesy_context *ctx, char *json_data, uint32_t json_len
   }
 
   ctx->iter = ctx->root;
+  ctx->pristine = (ctx->status == JESY_NO_ERR);
   return ctx->status;
 }
-enum jesy_state {
-  JESY_STATE_NONE,
-  JESY_STATE_WANT_OBJECT,
-  JESY_STATE_WANT_KEY,
-  JESY_STATE_WANT_VALUE,
-  JESY_STATE_WANT_ARRAY_VALUE,
-  JESY_STATE_GOT_ARRAY_VALUE,
-  JESY_STATE_GOT_VALUE,
-  JESY_STATE_GOT_KEY,
-};
 
-size_t jesy_evaluate(struct jesy_context *ctx)
+uint32_t jesy_parse(struct jesy_context *ctx, char *json_data, uint32_t json_length)
 {
-  size_t json_len = 0;
-  enum jesy_state state = JESY_STATE_WANT_OBJECT;
-  ctx->status = JESY_NO_ERR;
+  JESY_STAT_TIMER(start);
 
-  if (!ctx->root) {
-    return 0;
+  if (!ctx) {
+    return JESY_INVALID_PARAMETER;
   }
+  if (jesy_parse_begin(ctx, json_data, json_length) == JESY_IN_PROGRESS) {
+    jesy_parse_step(ctx, UINT32_MAX);
+  }
+  JESY_STAT_ELAPSED(ctx, parse_cycles, start);
+  return ctx->status;
+}
 
-  ctx->iter = ctx->root;
+enum jesy_path_match {
+  JESY_PATH_MISMATCH,
+  JESY_PATH_PREFIX,
+  JESY_PATH_MATCH,
+};
 
-  do {
-    JESY_LOG_NODE("\n   ", ctx->iter - ctx->pool, ctx->iter->type,ctx->iter->length, ctx->iter->value,
-                  ctx->iter->parent, ctx->iter->sibling, ctx->iter->first_child, "");
-    switch (state) {
-      case JESY_STATE_WANT_OBJECT:
-        if (ctx->iter->type == JESY_OBJECT) {
-          json_len++; /* '{' */
-          state = JESY_STATE_WANT_KEY;
+/* Returns the offset of the bracket closing the object or array opened at the
+ * given offset, or size if it isn't closed. Strings are skipped; nothing else
+ * is validated. */
+static uint32_t jesy_skip_container(const char *data, uint32_t offset, uint32_t size)
+{
+  uint32_t depth = 1;
+
+  for (offset++; offset < size; offset++) {
+    switch (data[offset]) {
+      case '"':
+        offset = jesy_skip_string(data, offset + 1, size);
+        while ((offset < size) && (data[offset] == '\\')) {
+          offset = jesy_skip_string(data, offset + 2, size);
         }
-        else {
-          ctx->status = JESY_UNEXPECTED_NODE;
-          JESY_LOG_MSG("\n jesy_evaluate err.1");
-          return 0;
+        if ((offset >= size) || (data[offset] != '"')) {
+          return size;
         }
         break;
-
-      case JESY_STATE_WANT_KEY:
-        if (ctx->iter->type == JESY_KEY) {
-          json_len += (ctx->iter->length + sizeof(char) * 3);/* +1 for ':' +2 for "" */
-          state = JESY_STATE_WANT_VALUE;
-        }
-        else {
-          ctx->status = JESY_UNEXPECTED_NODE;
-          JESY_LOG_MSG("\n jesy_evaluate err.2");
-          return 0;
-        }
+      case '{':
+      case '[':
+        depth++;
         break;
-
-      case JESY_STATE_WANT_VALUE:
-        if (ctx->iter->type == JESY_STRING) {
-            json_len += (ctx->iter->length + sizeof(char) * 2);/* +2 for "" */
-            state = JESY_STATE_GOT_VALUE;
-        }
-        else if ((ctx->iter->type == JESY_NUMBER)  ||
-                 (ctx->iter->type == JESY_TRUE)    ||
-                 (ctx->iter->type == JESY_FALSE)   ||
-                 (ctx->iter->type == JESY_NULL)) {
-          json_len += ctx->iter->length;
-          state = JESY_STATE_GOT_VALUE;
-        }
-        else if (ctx->iter->type == JESY_ARRAY) {
-          json_len++; /* '[' */
-          state = JESY_STATE_WANT_ARRAY_VALUE;
-        }
-        else if (ctx->iter->type == JESY_OBJECT) {
-          json_len++; /* '{' */
-          state = JESY_STATE_WANT_KEY;
-        }
-        else {
-          ctx->status = JESY_UNEXPECTED_NODE;
-          JESY_LOG_MSG("\n jesy_evaluate err.3");
-          return 0;
+      case '}':
+      case ']':
+        if (--depth == 0) {
+          return offset;
         }
         break;
-
-      case JESY_STATE_WANT_ARRAY_VALUE:
-        if (ctx->iter->type == JESY_STRING) {
-            json_len += (size_t)ctx->iter->length + (sizeof("\"\"") - 1);
-        }
-        else if ((ctx->iter->type == JESY_NUMBER)  ||
-                 (ctx->iter->type == JESY_TRUE)    ||
-                 (ctx->iter->type == JESY_FALSE)   ||
-                 (ctx->iter->type == JESY_NULL)) {
-          json_len += ctx->iter->length;
-        }
-        else if (ctx->iter->type == JESY_ARRAY) {
-          json_len++; /* '[' */
-          state = JESY_STATE_WANT_ARRAY_VALUE;
-        }
-        else if (ctx->iter->type == JESY_OBJECT) {
-          json_len++; /* '{' */
-          state = JESY_STATE_WANT_KEY;
-        }
-        else {
-          ctx->status = JESY_UNEXPECTED_NODE;
-          JESY_LOG_MSG("\n jesy_evaluate err.4");
-          return 0;
-        }
-        break;
-
+      case '\0':
+        return size;
       default:
-        assert(0);
         break;
     }
+  }
+  return size;
+}
 
-    if (HAS_CHILD(ctx->iter)) {
-      ctx->iter = jesy_get_child(ctx, ctx->iter);
-      continue;
+/* Compares a key name with the segment of a dotted path at the given level.
+ * return JESY_PATH_MATCH if it is the last segment, JESY_PATH_PREFIX if more
+ * segments follow, otherwise JESY_PATH_MISMATCH */
+static enum jesy_path_match jesy_match_segment(const char *path, uint32_t level,
+                                               const char *name, uint16_t length)
+{
+  const char *dot;
+  size_t len;
+
+  for (; level > 0; level--) {
+    if (!(path = strchr(path, '.'))) {
+      return JESY_PATH_MISMATCH;
     }
+    path++;
+  }
+  dot = strchr(path, '.');
+  len = dot ? (size_t)(dot - path) : strlen(path);
+  if ((len != length) || (0 != memcmp(path, name, len))) {
+    return JESY_PATH_MISMATCH;
+  }
+  return dot ? JESY_PATH_PREFIX : JESY_PATH_MATCH;
+}
 
-    /* This covers empty objects */
-    if (ctx->iter->type == JESY_OBJECT) {
-      json_len++; /* '}' */
+static inline bool jesy_is_scalar_token(enum jesy_token_type type)
+{
+  return (type == JESY_TOKEN_STRING) || (type == JESY_TOKEN_NUMBER) || (type == JESY_TOKEN_TRUE) ||
+         (type == JESY_TOKEN_FALSE)  || (type == JESY_TOKEN_NULL);
+}
+
+/* Consumes the value starting at the current token without building nodes. */
+static void jesy_skip_value(struct jesy_context *ctx)
+{
+  if ((ctx->token.type == JESY_TOKEN_OPENING_BRACKET) || (ctx->token.type == JESY_TOKEN_OPENING_BRACE)) {
+    ctx->offset = jesy_skip_container(ctx->json_data, ctx->offset, ctx->json_size);
+    if (ctx->offset >= ctx->json_size) {
+      ctx->status = JESY_UNEXPECTED_EOF;
+      return;
     }
-    /* This covers empty arrays */
-    else if (ctx->iter->type == JESY_ARRAY) {
-      json_len++; /* ']' */
+  }
+  else if (!jesy_is_scalar_token(ctx->token.type)) {
+    ctx->status = (ctx->token.type == JESY_TOKEN_EOF) ? JESY_UNEXPECTED_EOF : JESY_UNEXPECTED_TOKEN;
+    return;
+  }
+  ctx->token = jesy_get_token(ctx);
+}
+
+enum jesy_projection_state {
+  JESY_PROJECTION_WANT_MEMBER_OR_CLOSE,
+  JESY_PROJECTION_WANT_MEMBER,
+  JESY_PROJECTION_WANT_SEPARATOR_OR_CLOSE,
+};
+
+uint32_t jesy_parse_projection(struct jesy_context *ctx, char *json_data, uint32_t json_length,
+                               const char *const *paths, uint32_t path_count)
+{
+  /* Paths still possible in each open container and the number of their
+     segments matched so far. Arrays don't consume a segment. */
+  uint32_t candidates[JESY_MAX_DEPTH];
+  uint8_t levels[JESY_MAX_DEPTH];
+  enum jesy_projection_state state = JESY_PROJECTION_WANT_MEMBER_OR_CLOSE;
+  uint32_t index;
+
+  if (!ctx) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (!paths || !path_count || (path_count > JESY_MAX_PROJECTION_PATHS)) {
+    return ctx->status = JESY_INVALID_PARAMETER;
+  }
+  for (index = 0; index < path_count; index++) {
+    if (!paths[index]) {
+      return ctx->status = JESY_INVALID_PARAMETER;
     }
+  }
 
-    /* We've got an array */
-    if (HAS_SIBLING(ctx->iter)) {
-      if (ctx->iter->type != JESY_KEY) {
-        ctx->iter = &ctx->pool[ctx->iter->sibling];
-        json_len++; /* ',' */
-        continue;
+  jesy_tokenizer_init(ctx, json_data, json_length);
+  if (!jesy_expect(ctx, JESY_TOKEN_OPENING_BRACKET, JESY_OBJECT)) {
+    return ctx->status;
+  }
+  candidates[0] = (path_count < 32) ? ((uint32_t)1 << path_count) - 1 : 0xFFFFFFFF;
+  levels[0] = 0;
+
+  while ((ctx->status == 0) && ctx->depth) {
+    struct jesy_element *container = &ctx->pool[ctx->containers[ctx->depth - 1]];
+    uint32_t level = levels[ctx->depth - 1];
+    enum jesy_token_type closing = (container->type == JESY_OBJECT)
+                                 ? JESY_TOKEN_CLOSING_BRACKET : JESY_TOKEN_CLOSING_BRACE;
+
+    if ((state != JESY_PROJECTION_WANT_MEMBER) && (ctx->token.type == closing)) {
+      /* Drop containers that didn't lead to any selected value. */
+      ctx->depth--;
+      if (!HAS_CHILD(container) && ctx->depth) {
+        jesy_delete_element(ctx, (PARENT_TYPE(ctx, container) == JESY_KEY)
+                                 ? &ctx->pool[container->parent] : container);
       }
-      else {
-        ctx->status = JESY_UNEXPECTED_NODE;
-        JESY_LOG_MSG("\n jesy_evaluate err.5");
-        return 0;
+      state = JESY_PROJECTION_WANT_SEPARATOR_OR_CLOSE;
+      ctx->token = jesy_get_token(ctx);
+      continue;
+    }
+
+    if (state == JESY_PROJECTION_WANT_SEPARATOR_OR_CLOSE) {
+      if (ctx->token.type != JESY_TOKEN_COMMA) {
+        ctx->status = (ctx->token.type == JESY_TOKEN_EOF) ? JESY_UNEXPECTED_EOF : JESY_UNEXPECTED_TOKEN;
+        break;
       }
+      state = JESY_PROJECTION_WANT_MEMBER;
+      ctx->token = jesy_get_token(ctx);
+      continue;
     }
 
-    while (HAS_PARENT(ctx->iter)) {
-      /* A key without value is invalid. */
-      if (PARENT_TYPE(ctx, ctx->iter) == JESY_KEY) {
-        state = JESY_STATE_GOT_VALUE;
+    state = JESY_PROJECTION_WANT_SEPARATOR_OR_CLOSE;
+    if (container->type == JESY_OBJECT) {
+      uint32_t prefix = 0;
+      bool match = false;
+      struct jesy_token key = ctx->token;
+
+      if (key.type != JESY_TOKEN_STRING) {
+        ctx->status = (key.type == JESY_TOKEN_EOF) ? JESY_UNEXPECTED_EOF : JESY_UNEXPECTED_TOKEN;
+        break;
+      }
+      for (index = 0; index < path_count; index++) {
+        if (candidates[ctx->depth - 1] & ((uint32_t)1 << index)) {
+          enum jesy_path_match result = jesy_match_segment(paths[index], level,
+                                                           &json_data[key.offset], (uint16_t)key.length);
+          if (result == JESY_PATH_MATCH) {
+            match = true;
+          }
+          else if (result == JESY_PATH_PREFIX) {
+            prefix |= (uint32_t)1 << index;
+          }
+        }
       }
 
-      ctx->iter = GET_PARENT(ctx, ctx->iter);
-      if (ctx->iter->type == JESY_KEY) {
-        if (state != JESY_STATE_GOT_VALUE) {
-          ctx->status = JESY_UNEXPECTED_NODE;
-          JESY_LOG_MSG("\n jesy_evaluate err.6");
-          return 0;
+      if (match) {
+        /* A selected value is kept as a whole. */
+        ctx->iter = container;
+        if (jesy_accept(ctx, JESY_TOKEN_STRING, JESY_KEY) &&
+            jesy_expect(ctx, JESY_TOKEN_COLON, JESY_NONE)) {
+          jesy_parse_value(ctx, ctx->iter);
         }
-        state = JESY_STATE_GOT_KEY;
+        continue;
       }
-      else if (ctx->iter->type == JESY_OBJECT) {
-        if (state != JESY_STATE_GOT_KEY) {
-          ctx->status = JESY_UNEXPECTED_NODE;
-          JESY_LOG_MSG("\n jesy_evaluate err.7");
-          return 0;
+
+      ctx->token = jesy_get_token(ctx);
+      if (ctx->token.type != JESY_TOKEN_COLON) {
+        ctx->status = JESY_UNEXPECTED_TOKEN;
+        break;
+      }
+      ctx->token = jesy_get_token(ctx);
+      if (prefix && ((ctx->token.type == JESY_TOKEN_OPENING_BRACKET) ||
+                     (ctx->token.type == JESY_TOKEN_OPENING_BRACE))) {
+        /* Step into a container leading to a selected value. */
+        ctx->iter = jesy_append_element(ctx, container, JESY_KEY, key.length, &json_data[key.offset]);
+        if (ctx->iter && jesy_accept(ctx, ctx->token.type,
+                                     (ctx->token.type == JESY_TOKEN_OPENING_BRACKET) ? JESY_OBJECT : JESY_ARRAY) &&
+            (ctx->status == 0)) {
+          candidates[ctx->depth - 1] = prefix;
+          levels[ctx->depth - 1] = (uint8_t)(level + 1);
+          state = JESY_PROJECTION_WANT_MEMBER_OR_CLOSE;
         }
-        json_len++; /* '}' */
+        continue;
       }
-      else if (ctx->iter->type == JESY_ARRAY) {
-        json_len++; /* ']' */
+      jesy_skip_value(ctx);
+    }
+    else {
+      if ((ctx->token.type == JESY_TOKEN_OPENING_BRACKET) || (ctx->token.type == JESY_TOKEN_OPENING_BRACE)) {
+        /* Arrays are transparent to the paths. Their objects and arrays are
+           matched against the same segment. */
+        ctx->iter = container;
+        if (jesy_accept(ctx, ctx->token.type,
+                        (ctx->token.type == JESY_TOKEN_OPENING_BRACKET) ? JESY_OBJECT : JESY_ARRAY) &&
+            (ctx->status == 0)) {
+          candidates[ctx->depth - 1] = candidates[ctx->depth - 2];
+          levels[ctx->depth - 1] = (uint8_t)level;
+          state = JESY_PROJECTION_WANT_MEMBER_OR_CLOSE;
+        }
+        continue;
       }
+      jesy_skip_value(ctx);
+    }
+  }
 
-      if (HAS_SIBLING(ctx->iter)) {
-        json_len++; /* ',' */
-        if (PARENT_TYPE(ctx, ctx->iter) == JESY_OBJECT) {
-          state = JESY_STATE_WANT_KEY;
+  if ((ctx->status == 0) && (ctx->token.type != JESY_TOKEN_EOF)) {
+    ctx->status = JESY_UNEXPECTED_TOKEN;
+  }
+  ctx->iter = ctx->root;
+  /* The tree doesn't mirror the source anymore. */
+  ctx->pristine = false;
+  return ctx->status;
+}
+
+#ifdef JESY_ENABLE_THREADS
+/* Runs the routine for each worker of an array on its own thread while the
+ * calling thread takes the first one. A worker whose thread can't be started
+ * is run by the caller. */
+static void jesy_run_workers(void* (*routine)(void*), void *workers, size_t worker_size, uint32_t threads)
+{
+  pthread_t handles[JESY_MAX_THREADS];
+  bool started[JESY_MAX_THREADS];
+  uint32_t index;
+
+  for (index = 1; index < threads; index++) {
+    started[index] = (pthread_create(&handles[index], NULL, routine, (char*)workers + (index * worker_size)) == 0);
+  }
+  routine(workers);
+  for (index = 1; index < threads; index++) {
+    if (started[index]) {
+      pthread_join(handles[index], NULL);
+    }
+    else {
+      routine((char*)workers + (index * worker_size));
+    }
+  }
+}
+
+/* The largest array being the value of a root key and the offsets of the ','
+ * symbols cutting its values into segments. */
+struct jesy_parse_split {
+  uint32_t open;
+  uint32_t close;
+  uint32_t cuts[JESY_MAX_THREADS - 1];
+  uint32_t cut_count;
+};
+
+/* Scans the structure of a JSON without tokenizing it. Strings are skipped, so
+ * symbols inside them are ignored. A cut is placed at the first separating ','
+ * of an array after each segment_size bytes.
+ * return true if an array with at least one cut was found */
+static bool jesy_find_split(const char *data, uint32_t length, uint32_t segment_size,
+                            uint32_t max_cuts, struct jesy_parse_split *split)
+{
+  struct jesy_parse_split candidate = { 0 };
+  bool in_candidate = false;
+  uint32_t last_cut = 0;
+  uint32_t depth = 0;
+  uint32_t offset;
+
+  split->cut_count = 0;
+  for (offset = 0; offset < length; offset++) {
+    char ch = data[offset];
+
+    switch (ch) {
+      case '"':
+        offset = jesy_skip_string(data, offset + 1, length);
+        while ((offset < length) && (data[offset] == '\\')) {
+          offset = jesy_skip_string(data, offset + 2, length);
         }
-        else if (PARENT_TYPE(ctx, ctx->iter) == JESY_ARRAY) {
-          state = JESY_STATE_WANT_ARRAY_VALUE;
+        if ((offset >= length) || (data[offset] != '"')) {
+          return false;
         }
-        else {
-          ctx->status = JESY_UNEXPECTED_NODE;
-          JESY_LOG_MSG("\n jesy_evaluate err.8");
-          return 0;
+        break;
+
+      case '{':
+      case '[':
+        if ((depth == 1) && (ch == '[')) {
+          in_candidate = true;
+          candidate.open = offset;
+          candidate.cut_count = 0;
+          last_cut = offset;
         }
-        ctx->iter = GET_SIBLING(ctx, ctx->iter);
+        depth++;
+        break;
+
+      case '}':
+      case ']':
+        if (depth == 0) {
+          return false;
+        }
+        depth--;
+        if ((depth == 1) && in_candidate) {
+          in_candidate = false;
+          if ((ch == ']') && candidate.cut_count &&
+              ((offset - candidate.open) > (split->close - split->open))) {
+            *split = candidate;
+            split->close = offset;
+          }
+        }
+        break;
+
+      case ',':
+        if (in_candidate && (depth == 2) && ((offset - last_cut) >= segment_size) &&
+            (candidate.cut_count < max_cuts)) {
+          candidate.cuts[candidate.cut_count++] = offset;
+          last_cut = offset;
+        }
+        break;
+
+      case '\0':
+        /* The tokenizer stops here as well */
+        return false;
+
+      default:
         break;
-      }
     }
-  } while (ctx->iter != ctx->root);
+  }
+  return split->cut_count > 0;
+}
 
-  ctx->iter = ctx->root;
-  return json_len;
+/* A segment of the values of the split array, parsed on its own thread into
+ * the nodes [base, base + count) of the shared pool. The values are appended
+ * to a private holder node and moved to the split array afterwards. */
+struct jesy_parse_worker {
+  struct jesy_context ctx;
+  uint32_t start;
+  uint32_t end;
+  uint32_t base;
+  uint32_t count;
+  enum jesy_token_type terminator;
+  jesy_node_descriptor holder;
+  jesy_node_descriptor array;
+};
+
+static void* jesy_estimate_segment(void *arg)
+{
+  struct jesy_parse_worker *worker = (struct jesy_parse_worker*)arg;
+
+  worker->count = jesy_estimate_nodes(&worker->ctx.json_data[worker->start], worker->end - worker->start);
+  return NULL;
 }
 
-uint32_t jesy_render(struct jesy_context *ctx, char *buffer, uint32_t length)
+static void* jesy_parse_segment(void *arg)
 {
-  char *dst = buffer;
-  struct jesy_element *iter = ctx->root;
-  uint32_t required_buffer = 0;
+  struct jesy_parse_worker *worker = (struct jesy_parse_worker*)arg;
+  struct jesy_context *ctx = &worker->ctx;
+  struct jesy_element *holder = &ctx->pool[worker->holder];
+  struct jesy_element *value;
+  uint16_t base_depth = ctx->depth;
 
-  required_buffer = jesy_evaluate(ctx);
-  if (length < required_buffer) {
-    ctx->status = JESY_OUT_OF_MEMORY;
-    return 0;
+  ctx->token = jesy_get_token(ctx);
+  while (true) {
+    ctx->iter = holder;
+    if (!jesy_accept(ctx, JESY_TOKEN_STRING, JESY_STRING)  &&
+        !jesy_accept(ctx, JESY_TOKEN_NUMBER, JESY_NUMBER)  &&
+        !jesy_accept(ctx, JESY_TOKEN_TRUE, JESY_TRUE)      &&
+        !jesy_accept(ctx, JESY_TOKEN_FALSE, JESY_FALSE)    &&
+        !jesy_accept(ctx, JESY_TOKEN_NULL, JESY_NULL)) {
+      if ((jesy_accept(ctx, JESY_TOKEN_OPENING_BRACKET, JESY_OBJECT) ||
+           jesy_expect(ctx, JESY_TOKEN_OPENING_BRACE, JESY_ARRAY)) && (ctx->status == 0)) {
+        jesy_parse_run(ctx, base_depth, UINT32_MAX);
+      }
+    }
+    if (ctx->status || (ctx->depth != base_depth) || (ctx->token.offset == worker->end)) {
+      break;
+    }
+    if (!jesy_expect(ctx, JESY_TOKEN_COMMA, JESY_NONE)) {
+      break;
+    }
   }
-  if (required_buffer == 0) {
-    return 0;
+
+  /* The segment must end exactly at the symbol found by the structural scan. */
+  if ((ctx->status == 0) &&
+      ((ctx->depth != base_depth) || (ctx->token.offset != worker->end) ||
+       (ctx->token.type != worker->terminator) || !HAS_CHILD(holder))) {
+    ctx->status = JESY_UNEXPECTED_TOKEN;
   }
-  buffer[0] = '\0';
+  if (ctx->status == 0) {
+    for (value = &ctx->pool[holder->first_child]; value; value = GET_SIBLING(ctx, value)) {
+      value->parent = worker->array;
+    }
+  }
+  return NULL;
+}
 
-  while (iter) {
+uint32_t jesy_parse_parallel(struct jesy_context *ctx, char *json_data, uint32_t json_length, uint32_t threads)
+{
+  struct jesy_parse_worker workers[JESY_MAX_THREADS];
+  struct jesy_parse_split split = { 0 };
+  struct jesy_context initial;
+  struct jesy_element *array;
+  uint32_t segments;
+  uint32_t index;
+  uint32_t base;
+  bool serial = false;
+  JESY_STAT_TIMER(start);
+
+  if (threads > JESY_MAX_THREADS) {
+    threads = JESY_MAX_THREADS;
+  }
+#ifdef JESY_ENABLE_KEY_IDS
+  /* Key IDs are assigned in the order of appearance of the names. */
+  serial = true;
+#endif
+  if (serial || (threads <= 1) ||
+      !jesy_find_split(json_data, json_length, json_length / threads, threads - 1, &split)) {
+    return jesy_parse(ctx, json_data, json_length);
+  }
+  initial = *ctx;
+  segments = split.cut_count + 1;
 
-    if (iter->type == JESY_OBJECT) {
-      *dst++ = '{';
+  /* Parse everything up to the opening '[' of the split array. */
+  jesy_tokenizer_init(ctx, json_data, split.open + 1);
+  if (jesy_expect(ctx, JESY_TOKEN_OPENING_BRACKET, JESY_OBJECT)) {
+    jesy_parse_run(ctx, 0, UINT32_MAX);
+  }
+  array = ctx->iter;
+  if (ctx->status || (ctx->depth != 2) || ctx->free || !array ||
+      (array->type != JESY_ARRAY) || (array != &ctx->pool[ctx->index - 1])) {
+    serial = true;
+  }
+
+  /* Measure the segments. The exact node counts place them in the pool as the
+     serial parser would. */
+  for (index = 0; !serial && (index < segments); index++) {
+    struct jesy_parse_worker *worker = &workers[index];
+    worker->ctx = *ctx;
+    worker->start = index ? split.cuts[index - 1] + 1 : split.open + 1;
+    worker->end = (index < split.cut_count) ? split.cuts[index] : split.close;
+    worker->terminator = (index < split.cut_count) ? JESY_TOKEN_COMMA : JESY_TOKEN_CLOSING_BRACE;
+    worker->array = (jesy_node_descriptor)(array - ctx->pool);
+  }
+  if (!serial) {
+    jesy_run_workers(jesy_estimate_segment, workers, sizeof(workers[0]), segments);
+    base = ctx->index;
+    for (index = 0; index < segments; index++) {
+      workers[index].base = base;
+      base += workers[index].count;
     }
-    else if (iter->type == JESY_KEY) {
-      *dst++ = '"';
-      dst = (char*)memcpy(dst, iter->value, iter->length) + iter->length;
-      *dst++ = '"';
-      *dst++ = ':';
+    /* The holders take the top of the pool, above the nodes of the whole JSON. */
+    if (((uint64_t)base + jesy_estimate_nodes(&json_data[split.close], json_length - split.close) + segments) >
+        ctx->capacity) {
+      serial = true;
     }
-    else if (iter->type == JESY_STRING) {
-      *dst++ = '"';
-      dst = (char*)memcpy(dst, iter->value, iter->length) + iter->length;
-      *dst++ = '"';
+  }
+
+  if (!serial) {
+    for (index = 0; index < segments; index++) {
+      struct jesy_parse_worker *worker = &workers[index];
+      struct jesy_element *holder;
+      worker->holder = (jesy_node_descriptor)(ctx->capacity - 1 - index);
+      holder = &ctx->pool[worker->holder];
+      memset(&holder->parent, 0xFF, sizeof(jesy_node_descriptor) * 4);
+      holder->type = JESY_ARRAY;
+      worker->ctx.json_size = worker->end + 1;
+      worker->ctx.offset = worker->start - 1;
+      worker->ctx.index = (jesy_node_descriptor)worker->base;
+      worker->ctx.node_count = worker->base;
+      worker->ctx.capacity = worker->base + worker->count;
+      worker->ctx.containers[1] = worker->holder;
+#ifdef JESY_ENABLE_STATS
+      memset(&worker->ctx.stats, 0, sizeof(worker->ctx.stats));
+#endif
     }
-    else if ((iter->type == JESY_NUMBER)  ||
-             (iter->type == JESY_TRUE)    ||
-             (iter->type == JESY_FALSE)   ||
-             (iter->type == JESY_NULL)) {
-      dst = (char*)memcpy(dst, iter->value, iter->length) + iter->length;
+    jesy_run_workers(jesy_parse_segment, workers, sizeof(workers[0]), segments);
+
+    for (index = 0; !serial && (index < segments); index++) {
+      if (workers[index].ctx.status || workers[index].ctx.free ||
+          (workers[index].ctx.index != (workers[index].base + workers[index].count))) {
+        serial = true;
+      }
     }
-    else if (iter->type == JESY_ARRAY) {
-      *dst++ = '[';
+  }
+
+  if (!serial) {
+    /* Stitch the segments together */
+    array->first_child = ctx->pool[workers[0].holder].first_child;
+    for (index = 0; index < segments; index++) {
+      struct jesy_element *holder = &ctx->pool[workers[index].holder];
+      if (index + 1 < segments) {
+        ctx->pool[holder->last_child].sibling = ctx->pool[workers[index + 1].holder].first_child;
+      }
+      array->last_child = holder->last_child;
+#ifdef JESY_ENABLE_STATS
+      ctx->stats.tokens += workers[index].ctx.stats.tokens;
+      ctx->stats.nodes_allocated += workers[index].ctx.stats.nodes_allocated;
+      JESY_STAT_MAX(ctx, max_depth, workers[index].ctx.stats.max_depth);
+#endif
     }
-    else {
-      assert(0);
-      ctx->status = JESY_UNEXPECTED_NODE;
-      break;
+    ctx->index = (jesy_node_descriptor)base;
+    ctx->node_count = base;
+    JESY_STAT_MAX(ctx, pool_high_water, ctx->node_count);
+
+    /* Parse the rest, starting at the closing ']' of the split array. */
+    ctx->json_size = json_length;
+    ctx->offset = split.close - 1;
+    ctx->iter = array;
+    ctx->token = jesy_get_token(ctx);
+    jesy_parse_run(ctx, 0, UINT32_MAX);
+    if ((ctx->status != 0) || (ctx->token.type != JESY_TOKEN_EOF) || ctx->iter) {
+      serial = true;
     }
+  }
 
-    if (HAS_CHILD(iter)) {
-      iter = jesy_get_child(ctx, iter);
-      continue;
-    }
+  if (serial) {
+    /* Errors are reported by the serial parser, so the status and the offset
+       are the same as without threads. */
+    *ctx = initial;
+    return jesy_parse(ctx, json_data, json_length);
+  }
 
-    if (iter->type == JESY_OBJECT) {
-      *dst++ = '}';
+  ctx->iter = ctx->root;
+  ctx->pristine = true;
+  JESY_STAT_ELAPSED(ctx, parse_cycles, start);
+  return ctx->status;
+}
+#endif
+
+enum jesy_scan_state {
+  JESY_SCAN_WANT_OBJECT,
+  JESY_SCAN_WANT_FIRST_KEY,
+  JESY_SCAN_WANT_KEY,
+  JESY_SCAN_WANT_COLON,
+  JESY_SCAN_WANT_FIRST_VALUE,
+  JESY_SCAN_WANT_VALUE,
+  JESY_SCAN_WANT_SEPARATOR,
+  JESY_SCAN_WANT_EOF,
+};
+
+/* Validates a JSON using the tokenizer and a fixed stack of open containers
+ * instead of a tree. If minify is set, the tokens are compacted in place.
+ * Since the write offset never passes the offset of the current token, the
+ * source symbols are never overwritten before they are consumed. */
+static uint32_t jesy_scan(char *json_data, uint32_t json_length, bool minify, uint32_t *out_length)
+{
+  uint32_t offset = (uint32_t)-1;
+  uint8_t stack[JESY_MAX_DEPTH];
+  uint32_t depth = 0;
+  uint32_t dst = 0;
+  enum jesy_scan_state state = JESY_SCAN_WANT_OBJECT;
+
+  while (true) {
+    struct jesy_token token = jesy_tokenize(json_data, json_length, &offset);
+
+    if (token.type == JESY_TOKEN_EOF) {
+      if (state != JESY_SCAN_WANT_EOF) {
+        return JESY_UNEXPECTED_EOF;
+      }
+      break;
     }
 
-    else if (iter->type == JESY_ARRAY) {
-      *dst++ = ']';
-    }
+    switch (state) {
+      case JESY_SCAN_WANT_OBJECT:
+        if (token.type != JESY_TOKEN_OPENING_BRACKET) {
+          return JESY_UNEXPECTED_TOKEN;
+        }
+        stack[depth++] = JESY_OBJECT;
+        state = JESY_SCAN_WANT_FIRST_KEY;
+        break;
+
+      case JESY_SCAN_WANT_FIRST_KEY:
+      case JESY_SCAN_WANT_KEY:
+        if (token.type == JESY_TOKEN_STRING) {
+          state = JESY_SCAN_WANT_COLON;
+        }
+        else if ((token.type == JESY_TOKEN_CLOSING_BRACKET) && (state == JESY_SCAN_WANT_FIRST_KEY)) {
+          depth--;
+          state = depth ? JESY_SCAN_WANT_SEPARATOR : JESY_SCAN_WANT_EOF;
+        }
+        else {
+          return JESY_UNEXPECTED_TOKEN;
+        }
+        break;
+
+      case JESY_SCAN_WANT_COLON:
+        if (token.type != JESY_TOKEN_COLON) {
+          return JESY_UNEXPECTED_TOKEN;
+        }
+        state = JESY_SCAN_WANT_VALUE;
+        break;
+
+      case JESY_SCAN_WANT_FIRST_VALUE:
+        if (token.type == JESY_TOKEN_CLOSING_BRACE) {
+          depth--;
+          state = JESY_SCAN_WANT_SEPARATOR;
+          break;
+        }
+        /* fall through */
+      case JESY_SCAN_WANT_VALUE:
+        if ((token.type == JESY_TOKEN_OPENING_BRACKET) ||
+            (token.type == JESY_TOKEN_OPENING_BRACE)) {
+          if (depth >= JESY_MAX_DEPTH) {
+            return JESY_MAX_DEPTH_EXCEEDED;
+          }
+          if (token.type == JESY_TOKEN_OPENING_BRACKET) {
+            stack[depth++] = JESY_OBJECT;
+            state = JESY_SCAN_WANT_FIRST_KEY;
+          }
+          else {
+            stack[depth++] = JESY_ARRAY;
+            state = JESY_SCAN_WANT_FIRST_VALUE;
+          }
+        }
+        else if ((token.type == JESY_TOKEN_STRING) ||
+                 (token.type == JESY_TOKEN_NUMBER) ||
+                 (token.type == JESY_TOKEN_TRUE)   ||
+                 (token.type == JESY_TOKEN_FALSE)  ||
+                 (token.type == JESY_TOKEN_NULL)) {
+          state = JESY_SCAN_WANT_SEPARATOR;
+        }
+        else {
+          return JESY_UNEXPECTED_TOKEN;
+        }
+        break;
+
+      case JESY_SCAN_WANT_SEPARATOR:
+        if (token.type == JESY_TOKEN_COMMA) {
+          state = (stack[depth - 1] == JESY_OBJECT) ? JESY_SCAN_WANT_KEY : JESY_SCAN_WANT_VALUE;
+        }
+        else if (((token.type == JESY_TOKEN_CLOSING_BRACKET) && (stack[depth - 1] == JESY_OBJECT)) ||
+                 ((token.type == JESY_TOKEN_CLOSING_BRACE) && (stack[depth - 1] == JESY_ARRAY))) {
+          depth--;
+          state = depth ? JESY_SCAN_WANT_SEPARATOR : JESY_SCAN_WANT_EOF;
+        }
+        else {
+          return JESY_UNEXPECTED_TOKEN;
+        }
+        break;
+
+      default: /* JESY_SCAN_WANT_EOF */
+        return JESY_UNEXPECTED_TOKEN;
+    }
+
+    if (minify) {
+      if (token.type == JESY_TOKEN_STRING) {
+        json_data[dst++] = '"';
+        memmove(&json_data[dst], &json_data[token.offset], token.length);
+        dst += token.length;
+        json_data[dst++] = '"';
+      }
+      else {
+        memmove(&json_data[dst], &json_data[token.offset], token.length);
+        dst += token.length;
+      }
+    }
+  }
+
+  if (out_length) {
+    *out_length = dst;
+  }
+  return JESY_NO_ERR;
+}
+
+uint32_t jesy_check(char *json_data, uint32_t json_length)
+{
+  if (!json_data) {
+    return JESY_INVALID_PARAMETER;
+  }
+  return jesy_scan(json_data, json_length, false, NULL);
+}
+
+uint32_t jesy_minify(char *json_data, uint32_t json_length)
+{
+  uint32_t length = 0;
+
+  if (!json_data) {
+    return 0;
+  }
+  if (jesy_scan(json_data, json_length, true, &length) != JESY_NO_ERR) {
+    return 0;
+  }
+  return length;
+}
+
+/* Bit masks of special symbols in a block of 64 bytes. Bit n stands for byte n. */
+struct jesy_block_masks {
+  uint64_t quote;
+  uint64_t backslash;
+  /* '{' and '[' */
+  uint64_t open;
+  /* Symbols of numbers and literals: digits, letters, '.', '+' and '-' */
+  uint64_t word;
+};
+
+static void jesy_classify_block(const uint8_t *block, struct jesy_block_masks *masks)
+{
+#ifdef JESY_USE_SSE2
+  uint32_t index;
+
+  memset(masks, 0, sizeof(*masks));
+  for (index = 0; index < 64; index += 16) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)&block[index]);
+    /* Lower case letters are folded to upper case ones. Symbols above 0x7F
+       are negative and fail the signed range checks. */
+    __m128i upper = _mm_and_si128(chunk, _mm_set1_epi8((char)0xDF));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(upper, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmplt_epi8(upper, _mm_set1_epi8('Z' + 1)));
+    __m128i sign = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('.')),
+                                             _mm_cmpeq_epi8(chunk, _mm_set1_epi8('+'))),
+                                _mm_cmpeq_epi8(chunk, _mm_set1_epi8('-')));
+    __m128i open = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('{')),
+                                _mm_cmpeq_epi8(chunk, _mm_set1_epi8('[')));
+    masks->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"'))) << index;
+    masks->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\'))) << index;
+    masks->open |= (uint64_t)(uint16_t)_mm_movemask_epi8(open) << index;
+    masks->word |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(digit, alpha), sign)) << index;
+  }
+#else
+  uint32_t index;
+
+  memset(masks, 0, sizeof(*masks));
+  for (index = 0; index < 64; index++) {
+    uint8_t c = block[index];
+    uint64_t bit = (uint64_t)1 << index;
+    if (c == '"') {
+      masks->quote |= bit;
+    }
+    else if (c == '\\') {
+      masks->backslash |= bit;
+    }
+    else if ((c == '{') || (c == '[')) {
+      masks->open |= bit;
+    }
+    else if (IS_DIGIT(c) || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') ||
+             (c == '.') || (c == '+') || (c == '-')) {
+      masks->word |= bit;
+    }
+  }
+#endif
+}
+
+static inline uint32_t jesy_popcount64(uint64_t value)
+{
+#ifdef __GNUC__
+  return (uint32_t)__builtin_popcountll(value);
+#else
+  uint32_t count = 0;
+  for (; value; value &= value - 1) {
+    count++;
+  }
+  return count;
+#endif
+}
+
+uint32_t jesy_estimate_nodes(const char *json_data, uint32_t json_length)
+{
+  uint8_t tail[64];
+  uint64_t nodes = 0;
+  /* States carried over from one block to the next one */
+  uint64_t in_string = 0;    /* All ones if a string continues */
+  uint64_t escape_carry = 0; /* The first byte is escaped */
+  uint64_t word_carry = 0;   /* The last byte was part of a number or literal */
+  uint32_t offset;
+
+  if (!json_data) {
+    return 0;
+  }
+
+  for (offset = 0; offset < json_length; offset += 64) {
+    const uint8_t *block = (const uint8_t*)&json_data[offset];
+    struct jesy_block_masks masks;
+    uint64_t escaped = escape_carry;
+    uint64_t backslash;
+    uint64_t quotes;
+    uint64_t inside;
+    uint64_t word;
+
+    if ((json_length - offset) < 64) {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, block, json_length - offset);
+      block = tail;
+    }
+    jesy_classify_block(block, &masks);
+
+    /* A backslash escapes the next byte unless it is escaped itself.
+       Backslashes are rare, so they are visited one by one. */
+    escape_carry = 0;
+    for (backslash = masks.backslash; backslash; backslash &= backslash - 1) {
+      uint64_t bit = backslash & (~backslash + 1);
+      if (!(escaped & bit)) {
+        if (bit >> 63) {
+          escape_carry = 1;
+        }
+        escaped |= bit << 1;
+      }
+    }
+
+    /* Prefix XOR of the quotes marks the strings from the opening quote up to
+       but excluding the closing one. */
+    quotes = masks.quote & ~escaped;
+    inside = quotes;
+    inside ^= inside << 1;
+    inside ^= inside << 2;
+    inside ^= inside << 4;
+    inside ^= inside << 8;
+    inside ^= inside << 16;
+    inside ^= inside << 32;
+    inside ^= in_string;
+    in_string = (inside >> 63) ? ~(uint64_t)0 : 0;
+
+    /* Every string is a KEY or a STRING node, every opening bracket an OBJECT
+       or ARRAY node and every run of word symbols a NUMBER, TRUE, FALSE or NULL node. */
+    word = masks.word & ~inside;
+    nodes += jesy_popcount64(quotes & inside);
+    nodes += jesy_popcount64(masks.open & ~inside);
+    nodes += jesy_popcount64(word & ~((word << 1) | word_carry));
+    word_carry = word >> 63;
+  }
+
+  return (nodes < UINT32_MAX) ? (uint32_t)nodes : UINT32_MAX;
+}
+
+size_t jesy_required_pool_size(uint32_t nodes)
+{
+  uint64_t size = sizeof(struct jesy_context) + ((uint64_t)nodes * sizeof(struct jesy_element));
+
+  /* jesy_init_context never uses more nodes than the descriptors can address. */
+  if ((nodes >= JESY_INVALID_INDEX) || (size > UINT32_MAX)) {
+    return 0;
+  }
+  return (size_t)size;
+}
+
+enum jesy_state {
+  JESY_STATE_NONE,
+  JESY_STATE_WANT_OBJECT,
+  JESY_STATE_WANT_KEY,
+  JESY_STATE_WANT_VALUE,
+  JESY_STATE_WANT_ARRAY_VALUE,
+  JESY_STATE_GOT_ARRAY_VALUE,
+  JESY_STATE_GOT_VALUE,
+  JESY_STATE_GOT_KEY,
+};
+
+size_t jesy_evaluate(struct jesy_context *ctx)
+{
+  size_t json_len = 0;
+  enum jesy_state state = JESY_STATE_WANT_OBJECT;
+  ctx->status = JESY_NO_ERR;
+
+  if (!ctx->root) {
+    return 0;
+  }
+
+  ctx->iter = ctx->root;
+
+  do {
+    JESY_LOG_NODE("\n   ", ctx->iter - ctx->pool, ctx->iter->type,ctx->iter->length, ctx->iter->value,
+                  ctx->iter->parent, ctx->iter->sibling, ctx->iter->first_child, "");
+    switch (state) {
+      case JESY_STATE_WANT_OBJECT:
+        if (ctx->iter->type == JESY_OBJECT) {
+          json_len++; /* '{' */
+          state = JESY_STATE_WANT_KEY;
+        }
+        else {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          JESY_LOG_MSG("\n jesy_evaluate err.1");
+          return 0;
+        }
+        break;
+
+      case JESY_STATE_WANT_KEY:
+        if (ctx->iter->type == JESY_KEY) {
+          json_len += (ctx->iter->length + sizeof(char) * 3);/* +1 for ':' +2 for "" */
+          state = JESY_STATE_WANT_VALUE;
+        }
+        else {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          JESY_LOG_MSG("\n jesy_evaluate err.2");
+          return 0;
+        }
+        break;
+
+      case JESY_STATE_WANT_VALUE:
+        if (ctx->iter->type == JESY_STRING) {
+            json_len += (ctx->iter->length + sizeof(char) * 2);/* +2 for "" */
+            state = JESY_STATE_GOT_VALUE;
+        }
+        else if ((ctx->iter->type == JESY_NUMBER)  ||
+                 (ctx->iter->type == JESY_TRUE)    ||
+                 (ctx->iter->type == JESY_FALSE)   ||
+                 (ctx->iter->type == JESY_NULL)) {
+          json_len += ctx->iter->length;
+          state = JESY_STATE_GOT_VALUE;
+        }
+        else if (ctx->iter->type == JESY_ARRAY) {
+          json_len++; /* '[' */
+          state = JESY_STATE_WANT_ARRAY_VALUE;
+        }
+        else if (ctx->iter->type == JESY_OBJECT) {
+          json_len++; /* '{' */
+          state = JESY_STATE_WANT_KEY;
+        }
+        else {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          JESY_LOG_MSG("\n jesy_evaluate err.3");
+          return 0;
+        }
+        break;
+
+      case JESY_STATE_WANT_ARRAY_VALUE:
+        if (ctx->iter->type == JESY_STRING) {
+            json_len += (size_t)ctx->iter->length + (sizeof("\"\"") - 1);
+        }
+        else if ((ctx->iter->type == JESY_NUMBER)  ||
+                 (ctx->iter->type == JESY_TRUE)    ||
+                 (ctx->iter->type == JESY_FALSE)   ||
+                 (ctx->iter->type == JESY_NULL)) {
+          json_len += ctx->iter->length;
+        }
+        else if (ctx->iter->type == JESY_ARRAY) {
+          json_len++; /* '[' */
+          state = JESY_STATE_WANT_ARRAY_VALUE;
+        }
+        else if (ctx->iter->type == JESY_OBJECT) {
+          json_len++; /* '{' */
+          state = JESY_STATE_WANT_KEY;
+        }
+        else {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          JESY_LOG_MSG("\n jesy_evaluate err.4");
+          return 0;
+        }
+        break;
+
+      default:
+        assert(0);
+        break;
+    }
+
+    if (HAS_CHILD(ctx->iter)) {
+      ctx->iter = jesy_get_child(ctx, ctx->iter);
+      continue;
+    }
+
+    /* This covers empty objects */
+    if (ctx->iter->type == JESY_OBJECT) {
+      json_len++; /* '}' */
+    }
+    /* This covers empty arrays */
+    else if (ctx->iter->type == JESY_ARRAY) {
+      json_len++; /* ']' */
+    }
+
+    /* We've got an array */
+    if (HAS_SIBLING(ctx->iter)) {
+      if (ctx->iter->type != JESY_KEY) {
+        ctx->iter = &ctx->pool[ctx->iter->sibling];
+        json_len++; /* ',' */
+        continue;
+      }
+      else {
+        ctx->status = JESY_UNEXPECTED_NODE;
+        JESY_LOG_MSG("\n jesy_evaluate err.5");
+        return 0;
+      }
+    }
+
+    while (HAS_PARENT(ctx->iter)) {
+      /* A key without value is invalid. */
+      if (PARENT_TYPE(ctx, ctx->iter) == JESY_KEY) {
+        state = JESY_STATE_GOT_VALUE;
+      }
+
+      ctx->iter = GET_PARENT(ctx, ctx->iter);
+      if (ctx->iter->type == JESY_KEY) {
+        if (state != JESY_STATE_GOT_VALUE) {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          JESY_LOG_MSG("\n jesy_evaluate err.6");
+          return 0;
+        }
+        state = JESY_STATE_GOT_KEY;
+      }
+      else if (ctx->iter->type == JESY_OBJECT) {
+        if (state != JESY_STATE_GOT_KEY) {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          JESY_LOG_MSG("\n jesy_evaluate err.7");
+          return 0;
+        }
+        json_len++; /* '}' */
+      }
+      else if (ctx->iter->type == JESY_ARRAY) {
+        json_len++; /* ']' */
+      }
+
+      if (HAS_SIBLING(ctx->iter)) {
+        json_len++; /* ',' */
+        if (PARENT_TYPE(ctx, ctx->iter) == JESY_OBJECT) {
+          state = JESY_STATE_WANT_KEY;
+        }
+        else if (PARENT_TYPE(ctx, ctx->iter) == JESY_ARRAY) {
+          state = JESY_STATE_WANT_ARRAY_VALUE;
+        }
+        else {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          JESY_LOG_MSG("\n jesy_evaluate err.8");
+          return 0;
+        }
+        ctx->iter = GET_SIBLING(ctx, ctx->iter);
+        break;
+      }
+    }
+  } while (ctx->iter != ctx->root);
+
+  ctx->iter = ctx->root;
+  return json_len;
+}
+
+uint32_t jesy_render(struct jesy_context *ctx, char *buffer, uint32_t length)
+{
+  char *dst = buffer;
+  struct jesy_element *iter = ctx->root;
+  uint32_t required_buffer = 0;
+  JESY_STAT_TIMER(start);
+
+  required_buffer = jesy_evaluate(ctx);
+  if (length < required_buffer) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return 0;
+  }
+  if (required_buffer == 0) {
+    return 0;
+  }
+  buffer[0] = '\0';
+
+  while (iter) {
+
+    if (iter->type == JESY_OBJECT) {
+      *dst++ = '{';
+    }
+    else if (iter->type == JESY_KEY) {
+      *dst++ = '"';
+      dst = (char*)memcpy(dst, iter->value, iter->length) + iter->length;
+      *dst++ = '"';
+      *dst++ = ':';
+    }
+    else if (iter->type == JESY_STRING) {
+      *dst++ = '"';
+      dst = (char*)memcpy(dst, iter->value, iter->length) + iter->length;
+      *dst++ = '"';
+    }
+    else if ((iter->type == JESY_NUMBER)  ||
+             (iter->type == JESY_TRUE)    ||
+             (iter->type == JESY_FALSE)   ||
+             (iter->type == JESY_NULL)) {
+      dst = (char*)memcpy(dst, iter->value, iter->length) + iter->length;
+    }
+    else if (iter->type == JESY_ARRAY) {
+      *dst++ = '[';
+    }
+    else {
+      assert(0);
+      ctx->status = JESY_UNEXPECTED_NODE;
+      break;
+    }
+
+    if (HAS_CHILD(iter)) {
+      iter = jesy_get_child(ctx, iter);
+      continue;
+    }
+
+    if (iter->type == JESY_OBJECT) {
+      *dst++ = '}';
+    }
+
+    else if (iter->type == JESY_ARRAY) {
+      *dst++ = ']';
+    }
+
+    if (HAS_SIBLING(iter)) {
+      iter = jesy_get_sibling(ctx, iter);
+      *dst++ = ',';
+      continue;
+    }
+
+     while ((iter = jesy_get_parent(ctx, iter))) {
+      if (iter->type == JESY_OBJECT) {
+        *dst++ = '}';
+      }
+      else if (iter->type == JESY_ARRAY) {
+        *dst++ = ']';
+      }
+      if (HAS_SIBLING(iter)) {
+        iter = jesy_get_sibling(ctx, iter);
+        *dst++ = ',';
+        break;
+      }
+    }
+  }
+
+  ctx->iter = ctx->root;
+  JESY_STAT_ADD(ctx, bytes_rendered, (uint64_t)(dst - buffer));
+  JESY_STAT_ELAPSED(ctx, render_cycles, start);
+  return dst - buffer;
+}
+
+/* Output cursor of the formatted renderer. A NULL buffer only counts the bytes. */
+struct jesy_output {
+  char     *buffer;
+  size_t    length;
+  size_t    offset;
+  bool      overflow;
+};
+
+static inline void jesy_output_write(struct jesy_output *out, const char *src, size_t len)
+{
+  if (out->buffer) {
+    if ((out->offset + len) > out->length) {
+      out->overflow = true;
+      return;
+    }
+    memcpy(&out->buffer[out->offset], src, len);
+  }
+  out->offset += len;
+}
+
+static inline void jesy_output_char(struct jesy_output *out, char ch)
+{
+  if (out->buffer) {
+    if (out->offset >= out->length) {
+      out->overflow = true;
+      return;
+    }
+    out->buffer[out->offset] = ch;
+  }
+  out->offset++;
+}
+
+static inline void jesy_output_break(struct jesy_output *out, const struct jesy_format *format,
+                                     size_t newline_len, uint32_t depth)
+{
+  size_t indent_len = (size_t)format->indent * depth;
+  jesy_output_write(out, format->newline, newline_len);
+  if (out->buffer && !out->overflow) {
+    if ((out->offset + indent_len) > out->length) {
+      out->overflow = true;
+      return;
+    }
+    memset(&out->buffer[out->offset], format->indent_char, indent_len);
+  }
+  out->offset += indent_len;
+}
+
+/* A run of consecutive members of one container, rendered as a unit by
+ * jesy_render_parallel. A run that doesn't start at the first member begins
+ * with the separating ','. */
+struct jesy_render_chunk {
+  struct jesy_element *container;
+  struct jesy_element *first;
+  uint32_t count;
+  uint32_t status;
+  size_t   offset;
+  size_t   size;
+};
+
+/* Makes jesy_render_subtree stop at the containers whose members are at the
+ * given nesting level. While collecting, every such container is recorded as a
+ * single chunk. Otherwise the renderer leaves a gap of the precomputed size
+ * for each of the container's chunks and stores the gap offsets. */
+struct jesy_render_split {
+  uint32_t depth;
+  bool     collect;
+  bool     overflow;
+  struct jesy_render_chunk *chunks;
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t next;
+};
+
+static void jesy_render_split_members(struct jesy_context *ctx, struct jesy_render_split *split,
+                                      struct jesy_element *container, struct jesy_output *out)
+{
+  struct jesy_render_chunk *chunk;
+  struct jesy_element *member;
+
+  if (split->collect) {
+    if (split->count >= split->capacity) {
+      split->overflow = true;
+      return;
+    }
+    chunk = &split->chunks[split->count++];
+    chunk->container = container;
+    chunk->first = &ctx->pool[container->first_child];
+    chunk->count = 0;
+    for (member = chunk->first; member; member = GET_SIBLING(ctx, member)) {
+      chunk->count++;
+    }
+    return;
+  }
+
+  while ((split->next < split->count) && (split->chunks[split->next].container == container)) {
+    chunk = &split->chunks[split->next++];
+    if ((out->offset + chunk->size) > out->length) {
+      out->overflow = true;
+      return;
+    }
+    chunk->offset = out->offset;
+    out->offset += chunk->size;
+  }
+}
+
+/* Walks the subtree of the given element once, validating the node types
+ * against their parents and writing (or only counting) the formatted JSON. */
+static size_t jesy_render_subtree(struct jesy_context *ctx, struct jesy_element *root,
+                                  struct jesy_output *out, const struct jesy_format *format,
+                                  uint32_t *status, struct jesy_render_split *split)
+{
+  static const struct jesy_format compact = { NULL, 0, ' ', false, false };
+  struct jesy_element *iter = root;
+  uint32_t depth = 0;
+  size_t newline_len;
+
+  if (!format) {
+    format = &compact;
+  }
+  newline_len = format->newline ? strlen(format->newline) : 0;
+
+  while (iter && !out->overflow) {
+    uint16_t parent_type = PARENT_TYPE(ctx, iter);
+
+    /* Objects may only contain keys and keys may only hold a single value. */
+    if ((parent_type == JESY_OBJECT) != (iter->type == JESY_KEY)) {
+      *status = JESY_UNEXPECTED_NODE;
+      return 0;
+    }
+    if ((parent_type == JESY_KEY) && HAS_SIBLING(iter)) {
+      *status = JESY_UNEXPECTED_NODE;
+      return 0;
+    }
+
+    switch (iter->type) {
+      case JESY_OBJECT:
+      case JESY_ARRAY:
+        jesy_output_char(out, iter->type == JESY_OBJECT ? '{' : '[');
+        if (HAS_CHILD(iter)) {
+          if (split && ((depth + 1) == split->depth)) {
+            jesy_render_split_members(ctx, split, iter, out);
+          }
+          else {
+            depth++;
+            if (newline_len) {
+              jesy_output_break(out, format, newline_len, depth);
+            }
+            iter = &ctx->pool[iter->first_child];
+            continue;
+          }
+        }
+        jesy_output_char(out, iter->type == JESY_OBJECT ? '}' : ']');
+        break;
+
+      case JESY_KEY:
+        if (!HAS_CHILD(iter)) {
+          *status = JESY_UNEXPECTED_NODE;
+          return 0;
+        }
+        jesy_output_char(out, '"');
+        jesy_output_write(out, iter->value, iter->length);
+        jesy_output_write(out, "\": ", format->space_after_colon ? 3 : 2);
+        iter = &ctx->pool[iter->first_child];
+        continue;
+
+      case JESY_STRING:
+        jesy_output_char(out, '"');
+        jesy_output_write(out, iter->value, iter->length);
+        jesy_output_char(out, '"');
+        break;
+
+      case JESY_NUMBER:
+      case JESY_TRUE:
+      case JESY_FALSE:
+      case JESY_NULL:
+        jesy_output_write(out, iter->value, iter->length);
+        break;
+
+      default:
+        *status = JESY_UNEXPECTED_NODE;
+        return 0;
+    }
+
+    /* The element is completed. Continue with its sibling or close the parents. */
+    while (iter) {
+      if (iter == root) {
+        iter = NULL;
+        break;
+      }
+      if (HAS_SIBLING(iter)) {
+        jesy_output_char(out, ',');
+        if (newline_len) {
+          jesy_output_break(out, format, newline_len, depth);
+        }
+        else if (format->space_after_comma) {
+          jesy_output_char(out, ' ');
+        }
+        iter = &ctx->pool[iter->sibling];
+        break;
+      }
+      iter = &ctx->pool[iter->parent];
+      if ((iter->type == JESY_OBJECT) || (iter->type == JESY_ARRAY)) {
+        depth--;
+        if (newline_len) {
+          jesy_output_break(out, format, newline_len, depth);
+        }
+        jesy_output_char(out, iter->type == JESY_OBJECT ? '}' : ']');
+      }
+    }
+  }
+
+  if (out->overflow) {
+    *status = JESY_OUT_OF_MEMORY;
+    return 0;
+  }
+  return out->offset;
+}
+
+uint32_t jesy_render_format(struct jesy_context *ctx, char *dst, uint32_t length, const struct jesy_format *format)
+{
+  struct jesy_output out = { dst, length, 0, false };
+  uint32_t size;
+  JESY_STAT_TIMER(start);
+
+  if (!ctx || !dst) {
+    return 0;
+  }
+  ctx->status = JESY_NO_ERR;
+  if (!ctx->root) {
+    return 0;
+  }
+
+  size = (uint32_t)jesy_render_subtree(ctx, ctx->root, &out, format, &ctx->status, NULL);
+  JESY_STAT_ADD(ctx, bytes_rendered, size);
+  JESY_STAT_ELAPSED(ctx, render_cycles, start);
+  return size;
+}
+
+size_t jesy_evaluate_format(struct jesy_context *ctx, const struct jesy_format *format)
+{
+  struct jesy_output out = { NULL, 0, 0, false };
+
+  if (!ctx) {
+    return 0;
+  }
+  ctx->status = JESY_NO_ERR;
+  if (!ctx->root) {
+    return 0;
+  }
+
+  return jesy_render_subtree(ctx, ctx->root, &out, format, &ctx->status, NULL);
+}
+
+/* Steps of the piece generator behind jesy_render_next. */
+enum jesy_render_step {
+  JESY_RENDER_ENTER = 0,
+  JESY_RENDER_VALUE,
+  JESY_RENDER_CLOSE_QUOTE,
+  JESY_RENDER_CHILD,
+  JESY_RENDER_CLOSE,
+  JESY_RENDER_LEAVE,
+  JESY_RENDER_DONE,
+};
+
+/* Returns the size of the text around a parsed key or string that can be
+ * referenced in json_data together with its value: the quotes and the colon
+ * after a key. Zero if the value isn't framed like that in the source. */
+static size_t jesy_source_frame(struct jesy_context *ctx, struct jesy_element *element)
+{
+  const char *end = ctx->json_data + ctx->json_size;
+  size_t size = (element->type == JESY_KEY) ? 3 : 2;
+
+  if (!ctx->json_data || (element->value <= ctx->json_data) || (element->value >= end) ||
+      ((size_t)(end - element->value) < (element->length + size - 1))) {
+    return 0;
+  }
+  if ((element->value[-1] != '"') || (element->value[element->length] != '"') ||
+      ((size == 3) && (element->value[element->length + 1] != ':'))) {
+    return 0;
+  }
+  return size;
+}
+
+/* Delivers the next piece of the compact JSON: a punctuation or the value of
+ * an element, which is referenced rather than copied. Keys and strings that
+ * are framed by quotes in json_data are delivered with their quotes in one piece.
+ * return false once the tree is completed */
+static bool jesy_render_piece(struct jesy_render_cursor *cursor, const char **piece, size_t *length)
+{
+  struct jesy_context *ctx = cursor->ctx;
+  struct jesy_element *iter;
+
+  while (true) {
+    iter = cursor->iter;
+    switch (cursor->step) {
+      case JESY_RENDER_ENTER:
+        switch (iter->type) {
+          case JESY_OBJECT:
+          case JESY_ARRAY:
+            *piece = (iter->type == JESY_OBJECT) ? "{" : "[";
+            *length = 1;
+            cursor->step = HAS_CHILD(iter) ? JESY_RENDER_CHILD : JESY_RENDER_CLOSE;
+            return true;
+          case JESY_KEY:
+          case JESY_STRING: {
+            size_t frame = jesy_source_frame(ctx, iter);
+            if (frame) {
+              *piece = iter->value - 1;
+              *length = iter->length + frame;
+              cursor->step = (iter->type == JESY_KEY) ? JESY_RENDER_CHILD : JESY_RENDER_LEAVE;
+              return true;
+            }
+            *piece = "\"";
+            *length = 1;
+            cursor->step = JESY_RENDER_VALUE;
+            return true;
+          }
+          case JESY_NUMBER:
+          case JESY_TRUE:
+          case JESY_FALSE:
+          case JESY_NULL:
+            *piece = iter->value;
+            *length = iter->length;
+            cursor->step = JESY_RENDER_LEAVE;
+            return true;
+          default:
+            cursor->status = JESY_UNEXPECTED_NODE;
+            cursor->step = JESY_RENDER_DONE;
+            return false;
+        }
+
+      case JESY_RENDER_VALUE:
+        *piece = iter->value;
+        *length = iter->length;
+        cursor->step = JESY_RENDER_CLOSE_QUOTE;
+        return true;
+
+      case JESY_RENDER_CLOSE_QUOTE:
+        if (iter->type == JESY_KEY) {
+          *piece = "\":";
+          *length = 2;
+          cursor->step = JESY_RENDER_CHILD;
+        }
+        else {
+          *piece = "\"";
+          *length = 1;
+          cursor->step = JESY_RENDER_LEAVE;
+        }
+        return true;
+
+      case JESY_RENDER_CHILD:
+        cursor->iter = &ctx->pool[iter->first_child];
+        cursor->step = JESY_RENDER_ENTER;
+        break;
+
+      case JESY_RENDER_CLOSE:
+        *piece = (iter->type == JESY_OBJECT) ? "}" : "]";
+        *length = 1;
+        cursor->step = JESY_RENDER_LEAVE;
+        return true;
+
+      case JESY_RENDER_LEAVE:
+        /* The element is completed. Continue with its sibling or close the parent. */
+        if (iter == cursor->root) {
+          cursor->step = JESY_RENDER_DONE;
+          return false;
+        }
+        if (HAS_SIBLING(iter)) {
+          cursor->iter = &ctx->pool[iter->sibling];
+          cursor->step = JESY_RENDER_ENTER;
+          *piece = ",";
+          *length = 1;
+          return true;
+        }
+        cursor->iter = &ctx->pool[iter->parent];
+        if (cursor->iter->type != JESY_KEY) {
+          cursor->step = JESY_RENDER_CLOSE;
+        }
+        break;
+
+      default:
+        return false;
+    }
+  }
+}
+
+uint32_t jesy_render_begin(struct jesy_context *ctx, struct jesy_render_cursor *cursor)
+{
+  struct jesy_output out = { NULL, 0, 0, false };
+
+  if (!cursor) {
+    return JESY_INVALID_PARAMETER;
+  }
+  memset(cursor, 0, sizeof(*cursor));
+  cursor->step = JESY_RENDER_DONE;
+  if (!ctx) {
+    return cursor->status = JESY_INVALID_PARAMETER;
+  }
+  cursor->ctx = ctx;
+  if (!ctx->root) {
+    return JESY_NO_ERR;
+  }
+
+  /* Validate the whole tree up front, so the output never stops halfway. */
+  cursor->size = jesy_render_subtree(ctx, ctx->root, &out, NULL, &cursor->status, NULL);
+  if (cursor->status == JESY_NO_ERR) {
+    cursor->root = ctx->root;
+    cursor->iter = ctx->root;
+    cursor->step = JESY_RENDER_ENTER;
+  }
+  return cursor->status;
+}
+
+uint32_t jesy_render_next(struct jesy_render_cursor *cursor, char *dst, uint32_t length)
+{
+  uint32_t written = 0;
+
+  if (!cursor || !dst) {
+    return 0;
+  }
+
+  while (written < length) {
+    size_t chunk;
+
+    if (!cursor->piece_length) {
+      if (!jesy_render_piece(cursor, &cursor->piece, &cursor->piece_length)) {
+        break;
+      }
+      continue;
+    }
+    chunk = cursor->piece_length;
+    if (chunk > (length - written)) {
+      chunk = length - written;
+    }
+    memcpy(&dst[written], cursor->piece, chunk);
+    cursor->piece += chunk;
+    cursor->piece_length -= chunk;
+    written += (uint32_t)chunk;
+  }
+
+  cursor->offset += written;
+  return written;
+}
+
+#ifdef JESY_ENABLE_IOVEC
+uint32_t jesy_render_next_iov(struct jesy_render_cursor *cursor, struct iovec *iov, uint32_t max_iov)
+{
+  uint32_t count = 0;
+
+  if (!cursor || !iov) {
+    return 0;
+  }
+
+  while (true) {
+    if (!cursor->piece_length) {
+      if (!jesy_render_piece(cursor, &cursor->piece, &cursor->piece_length)) {
+        break;
+      }
+      continue;
+    }
+    /* Pieces that follow each other in memory share an entry. */
+    if (count && (((const char*)iov[count - 1].iov_base + iov[count - 1].iov_len) == cursor->piece)) {
+      iov[count - 1].iov_len += cursor->piece_length;
+    }
+    else if (count < max_iov) {
+      iov[count].iov_base = (void*)cursor->piece;
+      iov[count].iov_len = cursor->piece_length;
+      count++;
+    }
+    else {
+      break;
+    }
+    cursor->offset += cursor->piece_length;
+    cursor->piece_length = 0;
+  }
+  return count;
+}
+
+uint32_t jesy_render_iov(struct jesy_context *ctx, struct iovec *iov, uint32_t max_iov)
+{
+  struct jesy_render_cursor cursor;
+  uint32_t count;
+
+  if (!ctx || !iov) {
+    return 0;
+  }
+  if (jesy_render_begin(ctx, &cursor) != JESY_NO_ERR) {
+    ctx->status = cursor.status;
+    return 0;
+  }
+  count = jesy_render_next_iov(&cursor, iov, max_iov);
+  if (cursor.piece_length) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return 0;
+  }
+  ctx->status = JESY_NO_ERR;
+  return count;
+}
+#endif
+
+#ifdef JESY_ENABLE_THREADS
+/* The chunks of a parallel render handled by one thread: every stride-th chunk
+ * starting at first. Without a destination only the chunk sizes are computed. */
+struct jesy_render_worker {
+  struct jesy_context *ctx;
+  struct jesy_render_chunk *chunks;
+  uint32_t count;
+  uint32_t first;
+  uint32_t stride;
+  char *dst;
+};
+
+static void* jesy_render_chunks(void *arg)
+{
+  struct jesy_render_worker *worker = (struct jesy_render_worker*)arg;
+  struct jesy_context *ctx = worker->ctx;
+  uint32_t index;
+
+  for (index = worker->first; index < worker->count; index += worker->stride) {
+    struct jesy_render_chunk *chunk = &worker->chunks[index];
+    struct jesy_output out = { worker->dst ? &worker->dst[chunk->offset] : NULL, chunk->size, 0, false };
+    struct jesy_element *member = chunk->first;
+    uint32_t n;
+
+    chunk->status = JESY_NO_ERR;
+    for (n = 0; (n < chunk->count) && (chunk->status == JESY_NO_ERR); n++) {
+      if (member != &ctx->pool[chunk->container->first_child]) {
+        jesy_output_char(&out, ',');
+      }
+      jesy_render_subtree(ctx, member, &out, NULL, &chunk->status, NULL);
+      member = GET_SIBLING(ctx, member);
+    }
+    chunk->size = out.offset;
+  }
+  return NULL;
+}
+
+static uint32_t jesy_render_chunks_status(const struct jesy_render_chunk *chunks, uint32_t count)
+{
+  uint32_t index;
+
+  for (index = 0; index < count; index++) {
+    if (chunks[index].status != JESY_NO_ERR) {
+      return chunks[index].status;
+    }
+  }
+  return JESY_NO_ERR;
+}
+
+uint32_t jesy_render_parallel(struct jesy_context *ctx, char *dst, uint32_t length,
+                              uint32_t threads, uint32_t split_depth)
+{
+  struct jesy_render_chunk containers[JESY_MAX_RENDER_CHUNKS];
+  struct jesy_render_chunk chunks[JESY_MAX_RENDER_CHUNKS * 2];
+  struct jesy_render_worker workers[JESY_MAX_THREADS];
+  struct jesy_render_split split = { 0 };
+  struct jesy_output out = { NULL, 0, 0, false };
+  struct jesy_element *member;
+  uint32_t total = 0;
+  uint32_t target;
+  uint32_t per_chunk;
+  uint32_t count = 0;
+  uint32_t index;
+  uint32_t size;
+  JESY_STAT_TIMER(start);
+
+  if (!ctx || !dst) {
+    return 0;
+  }
+  ctx->status = JESY_NO_ERR;
+  if (!ctx->root) {
+    return 0;
+  }
+
+  if (threads > JESY_MAX_THREADS) {
+    threads = JESY_MAX_THREADS;
+  }
+  if (threads <= 1) {
+    return jesy_render_format(ctx, dst, length, NULL);
+  }
+
+  /* Find the containers to be split. The part above them is validated as well. */
+  split.depth = split_depth ? split_depth : 1;
+  split.collect = true;
+  split.chunks = containers;
+  split.capacity = JESY_MAX_RENDER_CHUNKS;
+  jesy_render_subtree(ctx, ctx->root, &out, NULL, &ctx->status, &split);
+  if (ctx->status != JESY_NO_ERR) {
+    return 0;
+  }
+  if (split.overflow || (split.count == 0)) {
+    return jesy_render_format(ctx, dst, length, NULL);
+  }
+
+  /* Cut the members into runs of equal length, about JESY_RENDER_CHUNKS_PER_THREAD
+   * per thread. Each container adds at most one shorter run. */
+  for (index = 0; index < split.count; index++) {
+    total += containers[index].count;
+  }
+  target = threads * JESY_RENDER_CHUNKS_PER_THREAD;
+  if (target > JESY_MAX_RENDER_CHUNKS) {
+    target = JESY_MAX_RENDER_CHUNKS;
+  }
+  per_chunk = (total + target - 1) / target;
+
+  for (index = 0; index < split.count; index++) {
+    uint32_t remaining = containers[index].count;
+    member = containers[index].first;
+    while (remaining) {
+      struct jesy_render_chunk *chunk = &chunks[count++];
+      uint32_t n;
+      chunk->container = containers[index].container;
+      chunk->first = member;
+      chunk->count = remaining < per_chunk ? remaining : per_chunk;
+      chunk->offset = 0;
+      chunk->size = 0;
+      remaining -= chunk->count;
+      for (n = 0; remaining && (n < chunk->count); n++) {
+        member = &ctx->pool[member->sibling];
+      }
+    }
+  }
+
+  for (index = 0; index < threads; index++) {
+    workers[index].ctx = ctx;
+    workers[index].chunks = chunks;
+    workers[index].count = count;
+    workers[index].first = index;
+    workers[index].stride = threads;
+    workers[index].dst = NULL;
+  }
+
+  /* Measure the chunks in parallel */
+  jesy_run_workers(jesy_render_chunks, workers, sizeof(workers[0]), threads);
+  if ((ctx->status = jesy_render_chunks_status(chunks, count)) != JESY_NO_ERR) {
+    return 0;
+  }
+
+  /* Render the part above the split level and leave a gap for each chunk */
+  split.collect = false;
+  split.chunks = chunks;
+  split.count = count;
+  split.next = 0;
+  out.buffer = dst;
+  out.length = length;
+  out.offset = 0;
+  out.overflow = false;
+  size = (uint32_t)jesy_render_subtree(ctx, ctx->root, &out, NULL, &ctx->status, &split);
+  if (ctx->status != JESY_NO_ERR) {
+    return 0;
+  }
+
+  /* Fill the gaps in parallel */
+  for (index = 0; index < threads; index++) {
+    workers[index].dst = dst;
+  }
+  jesy_run_workers(jesy_render_chunks, workers, sizeof(workers[0]), threads);
+  if ((ctx->status = jesy_render_chunks_status(chunks, count)) != JESY_NO_ERR) {
+    return 0;
+  }
+
+  JESY_STAT_ADD(ctx, bytes_rendered, size);
+  JESY_STAT_ELAPSED(ctx, render_cycles, start);
+  return size;
+}
+#endif
+
+struct jesy_element* jesy_get_root(struct jesy_context *ctx)
+{
+  if (ctx) {
+    return ctx->root;
+  }
+  return NULL;
+}
+
+
+/* Looks up a key of an object by its name. */
+static struct jesy_element* jesy_find_key(struct jesy_context *ctx, struct jesy_element *object,
+                                          const char *name, uint16_t length)
+{
+  struct jesy_element *iter = GET_CHILD(ctx, object);
+#ifdef JESY_ENABLE_KEY_IDS
+  uint16_t key_id = jesy_key_id(ctx, name, length, false);
+
+  if (key_id != JESY_INVALID_KEY_ID) {
+    while (iter && (iter->key_id != key_id)) {
+      iter = GET_SIBLING(ctx, iter);
+    }
+    return iter;
+  }
+  if (ctx->key_id_count < JESY_MAX_KEY_IDS) {
+    /* All the names have IDs, so the name doesn't exist at all. */
+    return NULL;
+  }
+#endif
+
+  while (iter) {
+    if ((iter->length == length) && (0 == memcmp(iter->value, name, length))) {
+      return iter;
+    }
+    iter = GET_SIBLING(ctx, iter);
+  }
+  return NULL;
+}
+
+/* Resolves a series of dot separated key names. The reason of a failure is
+ * reported through status, so the context isn't written. */
+static struct jesy_element* jesy_lookup_key(struct jesy_context *ctx, struct jesy_element *object,
+                                            const char *keys, uint32_t *status)
+{
+  struct jesy_element *iter = NULL;
+  uint32_t key_len;
+  const char *dot;
+
+  if (!ctx || !object || !keys || !jesy_validate_element(ctx, object)) {
+    *status = JESY_INVALID_PARAMETER;
+    return NULL;
+  }
+  if (object->type != JESY_OBJECT) {
+    *status = JESY_UNEXPECTED_NODE;
+    return NULL;
+  }
+  while ((dot = strchr(keys, '.'))) {
+    key_len = dot - keys;
+    iter = jesy_find_key(ctx, object, keys, key_len);
+    if (!iter) {
+      *status = JESY_ELEMENT_NOT_FOUND;
+      return NULL;
+    }
+    object = GET_CHILD(ctx, iter);
+    if (!object || (object->type != JESY_OBJECT)) {
+      *status = JESY_UNEXPECTED_NODE;
+      return NULL;
+    }
+    keys = keys + key_len + sizeof(*dot);
+  }
+  key_len = strlen(keys);
+  iter = jesy_find_key(ctx, object, keys, key_len);
+  if (!iter || (iter->type != JESY_KEY)) {
+    *status = JESY_ELEMENT_NOT_FOUND;
+    return NULL;
+  }
+  *status = JESY_NO_ERR;
+  return iter;
+}
+
+static struct jesy_element* jesy_lookup_array_value(struct jesy_context *ctx, struct jesy_element *array,
+                                                    int16_t index, uint32_t *status)
+{
+  struct jesy_element *iter = NULL;
+
+  if (!ctx || !array || !jesy_validate_element(ctx, array)) {
+    *status = JESY_INVALID_PARAMETER;
+    return NULL;
+  }
+  if (array->type != JESY_ARRAY) {
+    *status = JESY_UNEXPECTED_NODE;
+    return NULL;
+  }
+  if (index >= 0) {
+    iter = HAS_CHILD(array) ? &ctx->pool[array->first_child] : NULL;
+    for (; iter && index > 0; index--) {
+      iter = HAS_SIBLING(iter) ? &ctx->pool[iter->sibling] : NULL;
+    }
+  }
+  *status = iter ? JESY_NO_ERR : JESY_ELEMENT_NOT_FOUND;
+  return iter;
+}
+
+struct jesy_element* jesy_get_key(struct jesy_context *ctx, struct jesy_element *object, char *keys)
+{
+  uint32_t status;
+  return jesy_lookup_key(ctx, object, keys, &status);
+}
+
+struct jesy_element* jesy_get_key_value(struct jesy_context *ctx, struct jesy_element *object, char *keys)
+{
+  struct jesy_element *value_element = NULL;
+  struct jesy_element *key = jesy_get_key(ctx, object, keys);
+  if (key) {
+    value_element = GET_CHILD(ctx, key);
+  }
+  return value_element;
+}
+
+struct jesy_element* jesy_get_array_value(struct jesy_context *ctx, struct jesy_element *array, int16_t index)
+{
+  uint32_t status;
+  return jesy_lookup_array_value(ctx, array, index, &status);
+}
+
+/* Stores the result of a reentrant read in the caller's state. */
+static struct jesy_element* jesy_read_result(struct jesy_read_state *state, struct jesy_element *element,
+                                             uint32_t status)
+{
+  state->status = status;
+  state->iter = element;
+  return element;
+}
+
+struct jesy_element* jesy_get_parent_r(struct jesy_context *ctx, struct jesy_element *element,
+                                       struct jesy_read_state *state)
+{
+  if (!ctx || !element || !jesy_validate_element(ctx, element)) {
+    return jesy_read_result(state, NULL, JESY_INVALID_PARAMETER);
+  }
+  return jesy_read_result(state, GET_PARENT(ctx, element),
+                          HAS_PARENT(element) ? JESY_NO_ERR : JESY_ELEMENT_NOT_FOUND);
+}
+
+struct jesy_element* jesy_get_sibling_r(struct jesy_context *ctx, struct jesy_element *element,
+                                        struct jesy_read_state *state)
+{
+  if (!ctx || !element || !jesy_validate_element(ctx, element)) {
+    return jesy_read_result(state, NULL, JESY_INVALID_PARAMETER);
+  }
+  return jesy_read_result(state, GET_SIBLING(ctx, element),
+                          HAS_SIBLING(element) ? JESY_NO_ERR : JESY_ELEMENT_NOT_FOUND);
+}
+
+struct jesy_element* jesy_get_child_r(struct jesy_context *ctx, struct jesy_element *element,
+                                      struct jesy_read_state *state)
+{
+  if (!ctx || !element || !jesy_validate_element(ctx, element)) {
+    return jesy_read_result(state, NULL, JESY_INVALID_PARAMETER);
+  }
+  return jesy_read_result(state, GET_CHILD(ctx, element),
+                          HAS_CHILD(element) ? JESY_NO_ERR : JESY_ELEMENT_NOT_FOUND);
+}
+
+struct jesy_element* jesy_get_key_r(struct jesy_context *ctx, struct jesy_element *object,
+                                    const char *keys, struct jesy_read_state *state)
+{
+  uint32_t status;
+  struct jesy_element *key = jesy_lookup_key(ctx, object, keys, &status);
+  return jesy_read_result(state, key, status);
+}
+
+struct jesy_element* jesy_get_key_value_r(struct jesy_context *ctx, struct jesy_element *object,
+                                          const char *keys, struct jesy_read_state *state)
+{
+  uint32_t status;
+  struct jesy_element *key = jesy_lookup_key(ctx, object, keys, &status);
+
+  if (key && !HAS_CHILD(key)) {
+    status = JESY_ELEMENT_NOT_FOUND;
+  }
+  return jesy_read_result(state, key ? GET_CHILD(ctx, key) : NULL, status);
+}
+
+struct jesy_element* jesy_get_array_value_r(struct jesy_context *ctx, struct jesy_element *array,
+                                            int16_t index, struct jesy_read_state *state)
+{
+  uint32_t status;
+  struct jesy_element *value = jesy_lookup_array_value(ctx, array, index, &status);
+  return jesy_read_result(state, value, status);
+}
+
+struct jesy_element* jesy_read_begin(struct jesy_context *ctx, struct jesy_element *element,
+                                     struct jesy_read_state *state)
+{
+  state->root = NULL;
+  if (!ctx || !element || !jesy_validate_element(ctx, element)) {
+    return jesy_read_result(state, NULL, JESY_INVALID_PARAMETER);
+  }
+  state->root = element;
+  return jesy_read_result(state, element, JESY_NO_ERR);
+}
+
+struct jesy_element* jesy_read_next(struct jesy_context *ctx, struct jesy_read_state *state)
+{
+  struct jesy_element *iter = state->iter;
+
+  if (!ctx || !iter || !state->root) {
+    return jesy_read_result(state, NULL, JESY_INVALID_PARAMETER);
+  }
+  if (HAS_CHILD(iter)) {
+    return jesy_read_result(state, &ctx->pool[iter->first_child], JESY_NO_ERR);
+  }
+  /* Continue with the next sibling of the element or of its closest parent
+     below the starting element. */
+  while (iter != state->root) {
+    if (HAS_SIBLING(iter)) {
+      return jesy_read_result(state, &ctx->pool[iter->sibling], JESY_NO_ERR);
+    }
+    iter = GET_PARENT(ctx, iter);
+    if (!iter) {
+      break;
+    }
+  }
+  return jesy_read_result(state, NULL, JESY_NO_ERR);
+}
+
+size_t jesy_evaluate_r(struct jesy_context *ctx, const struct jesy_format *format, struct jesy_read_state *state)
+{
+  struct jesy_output out = { NULL, 0, 0, false };
+
+  state->iter = NULL;
+  if (!ctx) {
+    state->status = JESY_INVALID_PARAMETER;
+    return 0;
+  }
+  state->status = JESY_NO_ERR;
+  if (!ctx->root) {
+    return 0;
+  }
+  return jesy_render_subtree(ctx, ctx->root, &out, format, &state->status, NULL);
+}
+
+uint32_t jesy_render_r(struct jesy_context *ctx, char *dst, uint32_t length,
+                       const struct jesy_format *format, struct jesy_read_state *state)
+{
+  struct jesy_output out = { dst, length, 0, false };
+
+  state->iter = NULL;
+  if (!ctx || !dst) {
+    state->status = JESY_INVALID_PARAMETER;
+    return 0;
+  }
+  state->status = JESY_NO_ERR;
+  if (!ctx->root) {
+    return 0;
+  }
+  return (uint32_t)jesy_render_subtree(ctx, ctx->root, &out, format, &state->status, NULL);
+}
+
+struct jesy_element* jesy_add_element(struct jesy_context *ctx, struct jesy_element *parent, enum jesy_type type, uint16_t length, char *value)
+{
+  if (!ctx) {
+    return NULL;
+  }
+
+  if (!parent && ctx->root) { /* JSON is not empty. Invalid request. */
+    ctx->status = JESY_INVALID_PARAMETER;
+    return NULL;
+  }
+
+  if (parent && !jesy_validate_element(ctx, parent)) {
+    ctx->status = JESY_INVALID_PARAMETER;
+    return NULL;
+  }
+  return jesy_append_element(ctx, parent, type, length, value);
+}
+
+struct jesy_element* jesy_add_object(struct jesy_context *ctx, struct jesy_element *parent)
+{
+  return jesy_add_element(ctx, parent, JESY_OBJECT, 0, NULL);
+}
+
+struct jesy_element* jesy_add_array(struct jesy_context *ctx, struct jesy_element *parent)
+{
+  return jesy_add_element(ctx, parent, JESY_ARRAY, 0, NULL);
+}
+
+struct jesy_element* jesy_add_key(struct jesy_context *ctx, struct jesy_element *parent, char *key)
+{
+  uint16_t length = (uint16_t)strnlen(key, 0xFFFF);
+#ifdef JESY_USE_STRING_ARENA
+  if (ctx && !(key = jesy_arena_intern(ctx, key, length))) {
+    return NULL;
+  }
+#endif
+  return jesy_add_element(ctx, parent, JESY_KEY, length, key);
+}
+
+struct jesy_element* jesy_add_value(struct jesy_context *ctx, struct jesy_element *parent, enum jesy_type type, char *value)
+{
+  uint16_t length = (uint16_t)strnlen(value, 0xFFFF);
+#ifdef JESY_USE_STRING_ARENA
+  /* The literals of true, false and null are static anyway. */
+  if (ctx && ((type == JESY_STRING) || (type == JESY_NUMBER)) &&
+      !(value = jesy_arena_copy(ctx, value, length))) {
+    return NULL;
+  }
+#endif
+  return jesy_add_element(ctx, parent, type, length, value);
+}
+
+struct jesy_element* jesy_add_value_string(struct jesy_context *ctx, struct jesy_element *parent, char *value)
+{
+  return jesy_add_value(ctx, parent, JESY_STRING, value);
+}
+
+struct jesy_element* jesy_add_value_number(struct jesy_context *ctx, struct jesy_element *parent, char *value)
+{
+  return jesy_add_value(ctx, parent, JESY_NUMBER, value);
+}
+
+struct jesy_element* jesy_add_value_true(struct jesy_context *ctx, struct jesy_element *parent)
+{
+  return jesy_add_value(ctx, parent, JESY_TRUE, "true");
+}
+
+struct jesy_element* jesy_add_value_false(struct jesy_context *ctx, struct jesy_element *parent)
+{
+  return jesy_add_value(ctx, parent, JESY_FALSE, "false");
+}
+
+struct jesy_element* jesy_add_value_null(struct jesy_context *ctx, struct jesy_element *parent)
+{
+  return jesy_add_value(ctx, parent, JESY_NULL, "null");
+}
+
+uint32_t jesy_reserve(struct jesy_context *ctx, uint32_t count)
+{
+  if (!ctx) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (count > (ctx->capacity - ctx->index)) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return ctx->status;
+  }
+  ctx->reserved = count;
+  return JESY_NO_ERR;
+}
+
+uint32_t jesy_add_values(struct jesy_context *ctx, struct jesy_element *array, enum jesy_type type,
+                         char *values[], const uint16_t lengths[], uint32_t count)
+{
+  struct jesy_element *first;
+  struct jesy_element *iter;
+  char *literal = NULL;
+  uint16_t literal_length = 0;
+  jesy_node_descriptor base;
+  uint32_t index;
+
+  if (!ctx) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (!array || !jesy_validate_element(ctx, array) || (array->type != JESY_ARRAY) ||
+      (type < JESY_STRING) || (type > JESY_NULL) || (count && !values && (type <= JESY_NUMBER))) {
+    ctx->status = JESY_INVALID_PARAMETER;
+    return ctx->status;
+  }
+  switch (type) {
+    case JESY_TRUE:  literal = "true";  literal_length = 4; break;
+    case JESY_FALSE: literal = "false"; literal_length = 5; break;
+    case JESY_NULL:  literal = "null";  literal_length = 4; break;
+    default: break;
+  }
+  if (count > (ctx->capacity - ctx->node_count)) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return ctx->status;
+  }
+#ifdef JESY_USE_STRING_ARENA
+  /* Measure the copies first, so that a failure leaves the array untouched.
+     The check assumes that all the nodes come behind index. */
+  {
+    uint64_t total = ((uint64_t)ctx->index + count) * sizeof(struct jesy_element);
+    for (index = 0; !literal && (index < count); index++) {
+      total += lengths ? lengths[index] : strnlen(values[index], 0xFFFF);
+    }
+    if (total > (uint64_t)(ctx->strings - (char*)ctx->pool)) {
+      ctx->status = JESY_OUT_OF_MEMORY;
+      return ctx->status;
+    }
+  }
+#endif
+
+  if (count > (ctx->capacity - ctx->index)) {
+    /* No room for a contiguous run. Recycle the freed nodes one by one. */
+    for (index = 0; index < count; index++) {
+      char *value = literal ? literal : values[index];
+      uint16_t length = literal ? literal_length
+                      : lengths ? lengths[index] : (uint16_t)strnlen(value, 0xFFFF);
+#ifdef JESY_USE_STRING_ARENA
+      if (!literal) {
+        value = jesy_arena_copy(ctx, value, length);
+      }
+#endif
+      jesy_append_element(ctx, array, type, length, value);
+    }
+    return JESY_NO_ERR;
+  }
+
+  ctx->pristine = false;
+  JESY_HASH_INVALIDATE(ctx, array);
+  base = ctx->index;
+  first = &ctx->pool[base];
+  ctx->index = (jesy_node_descriptor)(base + count);
+  ctx->node_count += count;
+  ctx->reserved = (ctx->reserved > count) ? ctx->reserved - count : 0;
+  JESY_STAT_ADD(ctx, nodes_allocated, count);
+  JESY_STAT_MAX(ctx, pool_high_water, ctx->node_count);
+
+  for (index = 0, iter = first; index < count; index++, iter++) {
+    iter->type = type;
+    if (literal) {
+      iter->value = literal;
+      iter->length = literal_length;
+    }
+    else {
+      iter->value = values[index];
+      iter->length = lengths ? lengths[index] : (uint16_t)strnlen(values[index], 0xFFFF);
+#ifdef JESY_USE_STRING_ARENA
+      iter->value = jesy_arena_copy(ctx, iter->value, iter->length);
+#endif
+    }
+    iter->parent = (jesy_node_descriptor)(array - ctx->pool);
+    iter->sibling = (jesy_node_descriptor)(base + index + 1);
+    iter->first_child = JESY_INVALID_INDEX;
+    iter->last_child = JESY_INVALID_INDEX;
+#ifdef JESY_ENABLE_KEY_IDS
+    iter->key_id = JESY_INVALID_KEY_ID;
+#endif
+#ifdef JESY_ENABLE_HASH_CACHE
+    iter->hash = 0;
+#endif
+  }
+
+  if (count) {
+    first[count - 1].sibling = JESY_INVALID_INDEX;
+    if (HAS_CHILD(array)) {
+      ctx->pool[array->last_child].sibling = base;
+    }
+    else {
+      array->first_child = base;
+    }
+    array->last_child = (jesy_node_descriptor)(base + count - 1);
+  }
+  return JESY_NO_ERR;
+}
+
+uint32_t jesy_update_key(struct jesy_context *ctx, struct jesy_element *key, char *new)
+{
+  uint32_t result = JESY_INVALID_PARAMETER;
+
+  if (ctx && key && jesy_validate_element(ctx, key)) {
+    if (key->type == JESY_KEY) {
+      size_t key_len = strlen(new);
+      if (key_len < 65535) {
+#ifdef JESY_USE_STRING_ARENA
+        if (!(new = jesy_arena_intern(ctx, new, (uint16_t)key_len))) {
+          return ctx->status;
+        }
+#endif
+        JESY_HASH_INVALIDATE(ctx, key);
+        key->length = key_len;
+        key->value = new;
+#ifdef JESY_ENABLE_KEY_IDS
+        key->key_id = jesy_key_id(ctx, new, (uint16_t)key_len, true);
+#endif
+        ctx->pristine = false;
+        result = JESY_NO_ERR;
+      }
+    }
+  }
+  return result;
+}
+
+uint32_t jesy_update_key_value(struct jesy_context *ctx, struct jesy_element *object, char *keys, enum jesy_type type, char *value)
+{
+  uint32_t result = JESY_INVALID_PARAMETER;
+
+  struct jesy_element *key = jesy_get_key(ctx, object, keys);
+  if (key) {
+    jesy_delete_element(ctx, GET_CHILD(ctx, key));
+    if (jesy_add_value(ctx, key, type, value)) {
+      result = JESY_NO_ERR;
+    }
+    else {
+      result = ctx->status;
+    }
+  }
+  return result;
+}
+
+uint32_t jesy_update_array_value(struct jesy_context *ctx, struct jesy_element *array, int16_t index, enum jesy_type type, char *value)
+{
+  uint32_t result = JESY_ELEMENT_NOT_FOUND;
+  struct jesy_element *value_element = jesy_get_array_value(ctx, array, index);
+  if (value_element) {
+    uint16_t length = (uint16_t)strnlen(value, 0xFFFF);
+#ifdef JESY_USE_STRING_ARENA
+    if (((type == JESY_STRING) || (type == JESY_NUMBER)) &&
+        !(value = jesy_arena_copy(ctx, value, length))) {
+      return ctx->status;
+    }
+#endif
+    while (HAS_CHILD(value_element)) {
+      jesy_delete_element(ctx, GET_CHILD(ctx, value_element));
+    }
+    ctx->pristine = false;
+    JESY_HASH_INVALIDATE(ctx, value_element);
+    value_element->type = type;
+    value_element->length = length;
+    value_element->value = value;
+    result = JESY_NO_ERR;
+  }
+  return result;
+}
+
+/* Encodes a code point as UTF-8.
+ * return the number of bytes */
+static uint32_t jesy_utf8_encode(uint32_t code, char *dst)
+{
+  if (code < 0x80) {
+    dst[0] = (char)code;
+    return 1;
+  }
+  if (code < 0x800) {
+    dst[0] = (char)(0xC0 | (code >> 6));
+    dst[1] = (char)(0x80 | (code & 0x3F));
+    return 2;
+  }
+  if (code < 0x10000) {
+    dst[0] = (char)(0xE0 | (code >> 12));
+    dst[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+    dst[2] = (char)(0x80 | (code & 0x3F));
+    return 3;
+  }
+  dst[0] = (char)(0xF0 | (code >> 18));
+  dst[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+  dst[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+  dst[3] = (char)(0x80 | (code & 0x3F));
+  return 4;
+}
+
+static bool jesy_read_hex4(const char *src, uint32_t *code)
+{
+  uint32_t index;
+
+  *code = 0;
+  for (index = 0; index < 4; index++) {
+    char ch = src[index];
+    uint32_t digit;
+    if (IS_DIGIT(ch)) {
+      digit = (uint32_t)(ch - '0');
+    }
+    else if ((ch >= 'a') && (ch <= 'f')) {
+      digit = (uint32_t)(ch - 'a' + 10);
+    }
+    else if ((ch >= 'A') && (ch <= 'F')) {
+      digit = (uint32_t)(ch - 'A' + 10);
+    }
+    else {
+      return false;
+    }
+    *code = (*code << 4) | digit;
+  }
+  return true;
+}
+
+/* Decodes the escape sequence at src[index]. Malformed escapes stand for the
+ * backslash itself and unpaired surrogates for U+FFFD.
+ * return the number of characters consumed */
+static uint32_t jesy_unescape_one(const char *src, uint32_t index, uint32_t length, uint32_t *code)
+{
+  static const char escapes[] = "\"\\/bfnrt";
+  static const char controls[] = "\"\\/\b\f\n\r\t";
+  const char *simple;
+  uint32_t low;
+
+  *code = '\\';
+  if ((index + 1) >= length) {
+    return 1;
+  }
+  simple = src[index + 1] ? strchr(escapes, src[index + 1]) : NULL;
+  if (simple) {
+    *code = (uint8_t)controls[simple - escapes];
+    return 2;
+  }
+  if ((src[index + 1] != 'u') || ((index + 6) > length) || !jesy_read_hex4(&src[index + 2], code)) {
+    *code = '\\';
+    return 1;
+  }
+  if ((*code >= 0xD800) && (*code <= 0xDBFF) && ((index + 12) <= length) &&
+      (src[index + 6] == '\\') && (src[index + 7] == 'u') &&
+      jesy_read_hex4(&src[index + 8], &low) && (low >= 0xDC00) && (low <= 0xDFFF)) {
+    *code = 0x10000 + ((*code - 0xD800) << 10) + (low - 0xDC00);
+    return 12;
+  }
+  if ((*code >= 0xD800) && (*code <= 0xDFFF)) {
+    *code = 0xFFFD;
+  }
+  return 6;
+}
+
+/* Converts the escaped text of a string element to raw UTF-8. See jesy_unescape_one.
+ * return the size of the raw string. Nothing is written if dst is NULL. */
+static size_t jesy_unescape(const char *src, uint16_t length, char *dst)
+{
+  size_t size = 0;
+  uint32_t index = 0;
+
+  while (index < length) {
+    const char *escape = memchr(&src[index], '\\', length - index);
+    uint32_t run = escape ? (uint32_t)(escape - &src[index]) : (length - index);
+    uint32_t code;
+    uint32_t piece_length;
+    char bytes[4];
+
+    if (dst) {
+      memcpy(&dst[size], &src[index], run);
+    }
+    size += run;
+    index += run;
+    if (!escape) {
+      break;
+    }
+
+    index += jesy_unescape_one(src, index, length, &code);
+    piece_length = jesy_utf8_encode(code, bytes);
+    if (dst) {
+      memcpy(&dst[size], bytes, piece_length);
+    }
+    size += piece_length;
+  }
+  return size;
+}
+
+/* Value of a number element. Integers from INT64_MIN to UINT64_MAX are kept
+ * exact, anything else is converted to double. */
+struct jesy_binary_number {
+  bool     integer;
+  bool     negative;
+  uint64_t magnitude;
+  double   real;
+};
+
+/* Significant digits kept by jesy_shorten_number */
+#define JESY_NUMBER_DIGITS 40
+
+/* Rewrites a JSON number of any length as -0.<digits>e<exponent> with at most
+ * JESY_NUMBER_DIGITS significant digits, so that strtod can read it from a
+ * small buffer. Dropped digits that aren't all zero leave a trailing 1 behind.
+ * The double is the same unless the value lies within 1e-40 (relative) of the
+ * midpoint of two doubles.
+ * return false if the text isn't a JSON number */
+static bool jesy_shorten_number(const char *src, uint16_t length, char *dst, size_t size)
+{
+  uint16_t index = 0;
+  long point = 0;
+  long exponent = 0;
+  uint32_t count = 0;
+  bool sticky = false;
+  bool negative_exponent = false;
+  size_t offset = 0;
+
+  assert(size >= (JESY_NUMBER_DIGITS + 16));
+  if ((index < length) && (src[index] == '-')) {
+    dst[offset++] = '-';
+    index++;
+  }
+  if ((index >= length) || !IS_DIGIT(src[index])) {
+    return false;
+  }
+  memcpy(&dst[offset], "0.", 2);
+  offset += 2;
+
+  /* Mantissa: value = 0.<digits> * 10^point */
+  for (; (index < length) && IS_DIGIT(src[index]); index++) {
+    if (count || (src[index] != '0')) {
+      point++;
+    }
+    if (count < JESY_NUMBER_DIGITS) {
+      if (count || (src[index] != '0')) {
+        dst[offset + count++] = src[index];
+      }
+    }
+    else if (src[index] != '0') {
+      sticky = true;
+    }
+  }
+  if ((index < length) && (src[index] == '.')) {
+    index++;
+    if ((index >= length) || !IS_DIGIT(src[index])) {
+      return false;
+    }
+    for (; (index < length) && IS_DIGIT(src[index]); index++) {
+      if (!count && (src[index] == '0')) {
+        point--;
+      }
+      else if (count < JESY_NUMBER_DIGITS) {
+        dst[offset + count++] = src[index];
+      }
+      else if (src[index] != '0') {
+        sticky = true;
+      }
+    }
+  }
+  if ((index < length) && ((src[index] == 'e') || (src[index] == 'E'))) {
+    index++;
+    if ((index < length) && ((src[index] == '+') || (src[index] == '-'))) {
+      negative_exponent = (src[index] == '-');
+      index++;
+    }
+    if ((index >= length) || !IS_DIGIT(src[index])) {
+      return false;
+    }
+    for (; (index < length) && IS_DIGIT(src[index]); index++) {
+      /* Far beyond the range of double, the result is zero or infinity anyway. */
+      if (exponent < 1000000) {
+        exponent = (exponent * 10) + (src[index] - '0');
+      }
+    }
+  }
+  if (index != length) {
+    return false;
+  }
+
+  if (!count) {
+    dst[offset++] = '0';
+    dst[offset] = '\0';
+    return true;
+  }
+  offset += count;
+  if (sticky) {
+    dst[offset++] = '1';
+  }
+  snprintf(&dst[offset], size - offset, "e%ld", point + (negative_exponent ? -exponent : exponent));
+  return true;
+}
+
+static bool jesy_read_number(struct jesy_element *element, struct jesy_binary_number *number)
+{
+  char text[JESY_NUMBER_DIGITS + 16];
+  const char *digits = element->value;
+  char *end = NULL;
+  uint16_t index;
+
+  number->negative = (element->length > 0) && (digits[0] == '-');
+  number->integer = (element->length > (uint16_t)number->negative);
+  number->magnitude = 0;
+  for (index = (uint16_t)number->negative; number->integer && (index < element->length); index++) {
+    uint64_t digit = (uint64_t)(digits[index] - '0');
+    if (!IS_DIGIT(digits[index]) || (number->magnitude > ((UINT64_MAX - digit) / 10))) {
+      number->integer = false;
+    }
+    else {
+      number->magnitude = (number->magnitude * 10) + digit;
+    }
+  }
+  /* -0 has no integer encoding and MessagePack stops at INT64_MIN. */
+  if (number->integer && number->negative &&
+      ((number->magnitude == 0) || (number->magnitude > ((uint64_t)INT64_MAX + 1)))) {
+    number->integer = false;
+  }
+  if (number->integer) {
+    return true;
+  }
+
+  if (element->length >= sizeof(text)) {
+    if (!jesy_shorten_number(digits, element->length, text, sizeof(text))) {
+      return false;
+    }
+    number->real = strtod(text, NULL);
+    return true;
+  }
+  if (element->length == 0) {
+    return false;
+  }
+  memcpy(text, digits, element->length);
+  text[element->length] = '\0';
+  number->real = strtod(text, &end);
+  return (*end == '\0');
+}
+
+/* Size of the buffers numbers are formatted into. */
+#define JESY_NUMBER_TEXT_LEN 32
+
+/* Allocates from the unused middle of the pool, between the nodes and the strings. */
+static void* jesy_scratch_alloc(char **top, char *limit, size_t size)
+{
+  size_t padding = (sizeof(void*) - ((uintptr_t)*top % sizeof(void*))) % sizeof(void*);
+  void *block;
+
+  if (((size_t)(limit - *top) < padding) || ((size_t)(limit - *top - padding) < size)) {
+    return NULL;
+  }
+  block = *top + padding;
+  *top += padding + size;
+  return block;
+}
+
+/* Rank of a path character: the end of a path sorts before the dot between
+ * two keys, which sorts before any character of a key. */
+static uint32_t jesy_path_rank(char ch)
+{
+  return (ch == '\0') ? 0 : (ch == '.') ? 1 : ((uint32_t)(uint8_t)ch + 2);
+}
+
+/* Orders two dotted paths key by key, a key before every longer key it begins
+ * with. All paths below a series of keys are thereby adjacent. */
+static int jesy_compare_paths(const char *a, const char *b)
+{
+  while ((*a == *b) && *a) {
+    a++;
+    b++;
+  }
+  return (jesy_path_rank(*a) < jesy_path_rank(*b)) ? -1 : (*a == *b) ? 0 : 1;
+}
+
+/* Compares the key at the beginning of a path with the text of a JSON key. */
+static int jesy_compare_path_key(const char *path, const struct jesy_element *key)
+{
+  uint16_t index;
+
+  for (index = 0; index < key->length; index++) {
+    uint32_t rank = jesy_path_rank(path[index]);
+    uint32_t other = (uint32_t)(uint8_t)key->value[index] + 2;
+    if (rank != other) {
+      return (rank < other) ? -1 : 1;
+    }
+  }
+  return (jesy_path_rank(path[index]) < 2) ? 0 : 1;
+}
+
+/* Sorts the indexes of the binding table entries by their paths (heapsort). */
+static void jesy_sort_paths(const struct jesy_binding *table, uint32_t *order, uint32_t count)
+{
+  uint32_t start = count / 2;
+  uint32_t end = count;
+
+  while (end > 1) {
+    uint32_t root;
+    uint32_t child;
+    uint32_t swap;
+
+    if (start > 0) {
+      start--;
+    }
+    else {
+      end--;
+      swap = order[0];
+      order[0] = order[end];
+      order[end] = swap;
+    }
+    for (root = start; (child = (2 * root) + 1) < end; root = child) {
+      if (((child + 1) < end) && (jesy_compare_paths(table[order[child]].path, table[order[child + 1]].path) < 0)) {
+        child++;
+      }
+      if (jesy_compare_paths(table[order[root]].path, table[order[child]].path) >= 0) {
+        break;
+      }
+      swap = order[root];
+      order[root] = order[child];
+      order[child] = swap;
+    }
+  }
+}
+
+/* Sorted table entries whose paths begin with the series of keys of a level.
+ * offset is where the next key starts in each of their paths. */
+struct jesy_bind_range {
+  uint32_t first;
+  uint32_t last;
+  size_t   offset;
+};
+
+/* Binary search for the first entry of a range whose next key is not less
+ * (upper: greater) than the key. */
+static uint32_t jesy_find_path_key(const struct jesy_binding *table, const uint32_t *order,
+                                   const struct jesy_bind_range *range, const struct jesy_element *key, bool upper)
+{
+  uint32_t first = range->first;
+  uint32_t last = range->last;
+
+  while (first < last) {
+    uint32_t middle = first + ((last - first) / 2);
+    int cmp = jesy_compare_path_key(table[order[middle]].path + range->offset, key);
+    if ((cmp < 0) || (upper && (cmp == 0))) {
+      first = middle + 1;
+    }
+    else {
+      last = middle;
+    }
+  }
+  return first;
+}
+
+static uint32_t jesy_convert_value(struct jesy_element *value, enum jesy_bind_type type,
+                                   uint8_t *member, size_t size)
+{
+  char number[JESY_NUMBER_DIGITS + 16];
+  char *end = NULL;
+
+  if (!value) {
+    return JESY_UNEXPECTED_NODE;
+  }
+  if (value->type == JESY_NULL) {
+    return JESY_NO_ERR;
+  }
+
+  if (type == JESY_BIND_BOOL) {
+    bool flag = (value->type == JESY_TRUE);
+    if (((value->type != JESY_TRUE) && (value->type != JESY_FALSE)) || (size != sizeof(flag))) {
+      return JESY_UNEXPECTED_NODE;
+    }
+    memcpy(member, &flag, sizeof(flag));
+    return JESY_NO_ERR;
+  }
+
+  if (type == JESY_BIND_STRING) {
+    size_t raw;
+    if (value->type != JESY_STRING) {
+      return JESY_UNEXPECTED_NODE;
+    }
+    /* The member receives the raw characters, escapes are resolved. */
+    raw = jesy_unescape(value->value, value->length, NULL);
+    if (raw >= size) {
+      return JESY_OUT_OF_MEMORY;
+    }
+    jesy_unescape(value->value, value->length, (char*)member);
+    member[raw] = '\0';
+    return JESY_NO_ERR;
+  }
+
+  if (value->type != JESY_NUMBER) {
+    return JESY_UNEXPECTED_NODE;
+  }
+  if (value->length < sizeof(number)) {
+    memcpy(number, value->value, value->length);
+    number[value->length] = '\0';
+  }
+  /* Longer texts are out of range of the integer types, a double reads their
+   * significant digits only. */
+  else if ((type != JESY_BIND_DOUBLE) ||
+           !jesy_shorten_number(value->value, value->length, number, sizeof(number))) {
+    return JESY_UNEXPECTED_NODE;
+  }
+  errno = 0;
+
+  switch (type) {
+    case JESY_BIND_DOUBLE: {
+      double real = strtod(number, &end);
+      if ((*end != '\0') || (size != sizeof(real))) {
+        return JESY_UNEXPECTED_NODE;
+      }
+      /* Overflow is reported, underflow keeps the nearest representable value. */
+      if ((errno == ERANGE) && ((real == HUGE_VAL) || (real == -HUGE_VAL))) {
+        return JESY_UNEXPECTED_NODE;
+      }
+      memcpy(member, &real, sizeof(real));
+      break;
+    }
+    case JESY_BIND_INT32:
+    case JESY_BIND_INT64: {
+      long long integer = strtoll(number, &end, 10);
+      if ((*end != '\0') || errno) {
+        return JESY_UNEXPECTED_NODE;
+      }
+      if (type == JESY_BIND_INT32) {
+        int32_t narrow = (int32_t)integer;
+        if ((integer < INT32_MIN) || (integer > INT32_MAX) || (size != sizeof(narrow))) {
+          return JESY_UNEXPECTED_NODE;
+        }
+        memcpy(member, &narrow, sizeof(narrow));
+      }
+      else {
+        int64_t wide = (int64_t)integer;
+        if (size != sizeof(wide)) {
+          return JESY_UNEXPECTED_NODE;
+        }
+        memcpy(member, &wide, sizeof(wide));
+      }
+      break;
+    }
+    case JESY_BIND_UINT32:
+    case JESY_BIND_UINT64: {
+      unsigned long long integer = strtoull(number, &end, 10);
+      if ((number[0] == '-') || (*end != '\0') || errno) {
+        return JESY_UNEXPECTED_NODE;
+      }
+      if (type == JESY_BIND_UINT32) {
+        uint32_t narrow = (uint32_t)integer;
+        if ((integer > UINT32_MAX) || (size != sizeof(narrow))) {
+          return JESY_UNEXPECTED_NODE;
+        }
+        memcpy(member, &narrow, sizeof(narrow));
+      }
+      else {
+        uint64_t wide = (uint64_t)integer;
+        if (size != sizeof(wide)) {
+          return JESY_UNEXPECTED_NODE;
+        }
+        memcpy(member, &wide, sizeof(wide));
+      }
+      break;
+    }
+    default:
+      return JESY_INVALID_PARAMETER;
+  }
+  return JESY_NO_ERR;
+}
+
+uint32_t jesy_convert_token(struct jesy_context *ctx, enum jesy_bind_type type, void *dst, size_t size)
+{
+  struct jesy_element value = { 0 };
+
+  if (!ctx || !dst) {
+    return JESY_INVALID_PARAMETER;
+  }
+
+  switch (ctx->token.type) {
+    case JESY_TOKEN_STRING: value.type = JESY_STRING; break;
+    case JESY_TOKEN_NUMBER: value.type = JESY_NUMBER; break;
+    case JESY_TOKEN_TRUE:   value.type = JESY_TRUE;   break;
+    case JESY_TOKEN_FALSE:  value.type = JESY_FALSE;  break;
+    case JESY_TOKEN_NULL:   value.type = JESY_NULL;   break;
+    default:
+      ctx->status = JESY_UNEXPECTED_TOKEN;
+      return ctx->status;
+  }
+  value.length = ctx->token.length;
+  value.value = &ctx->json_data[ctx->token.offset];
+
+  ctx->status = jesy_convert_value(&value, type, (uint8_t*)dst, size);
+  if (ctx->status == JESY_NO_ERR) {
+    ctx->token = jesy_get_token(ctx);
+  }
+  return ctx->status;
+}
+
+uint32_t jesy_bind(struct jesy_context *ctx, struct jesy_element *object,
+                   const struct jesy_binding *table, uint32_t count, void *dst)
+{
+  /* Series of keys leading from the object to the current key */
+  struct jesy_element *keys[JESY_MAX_DEPTH];
+  /* Table entries below the keys of each level */
+  struct jesy_bind_range ranges[JESY_MAX_DEPTH];
+  struct jesy_element *iter;
+  char *scratch;
+  uint32_t *order;
+  uint32_t depth = 0;
+  uint32_t idx;
+
+  if (!ctx || !object || !table || !dst || !jesy_validate_element(ctx, object)) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (object->type != JESY_OBJECT) {
+    return JESY_UNEXPECTED_NODE;
+  }
+
+  /* The entries are sorted once by path, then each key is looked up once. */
+  scratch = (char*)(ctx->pool + ctx->index);
+  order = jesy_scratch_alloc(&scratch, ctx->strings, (size_t)count * sizeof(*order));
+  if (!order) {
+    return JESY_OUT_OF_MEMORY;
+  }
+  for (idx = 0; idx < count; idx++) {
+    order[idx] = idx;
+  }
+  jesy_sort_paths(table, order, count);
+  ranges[0].first = 0;
+  ranges[0].last = count;
+  ranges[0].offset = 0;
+
+  iter = GET_CHILD(ctx, object);
+  while (iter) {
+    struct jesy_element *value = GET_CHILD(ctx, iter);
+    const struct jesy_bind_range *range = &ranges[depth];
+    uint32_t first = jesy_find_path_key(table, order, range, iter, false);
+    uint32_t last = jesy_find_path_key(table, order, range, iter, true);
+    size_t end = range->offset + iter->length;
+
+    keys[depth] = iter;
+    /* Paths ending with this key sort before the longer ones. */
+    for (; (first < last) && (table[order[first]].path[end] == '\0'); first++) {
+      const struct jesy_binding *entry = &table[order[first]];
+      uint32_t status = jesy_convert_value(value, entry->type, (uint8_t*)dst + entry->offset, entry->size);
+      if (status != JESY_NO_ERR) {
+        return status;
+      }
+    }
+
+    /* Only step into objects that lead to a requested key. */
+    if ((first < last) && value && (value->type == JESY_OBJECT) && HAS_CHILD(value) &&
+        ((depth + 1) < JESY_MAX_DEPTH)) {
+      iter = &ctx->pool[value->first_child];
+      depth++;
+      ranges[depth].first = first;
+      ranges[depth].last = last;
+      ranges[depth].offset = end + 1;
+      continue;
+    }
+
+    while (!HAS_SIBLING(iter) && (depth > 0)) {
+      iter = keys[--depth];
+    }
+    iter = GET_SIBLING(ctx, iter);
+  }
+
+  return JESY_NO_ERR;
+}
+
+/* Returns the short escape letter of a character or zero if there is none. */
+static char jesy_escape_letter(uint8_t ch)
+{
+  switch (ch) {
+    case '"':  return '"';
+    case '\\': return '\\';
+    case '\b': return 'b';
+    case '\f': return 'f';
+    case '\n': return 'n';
+    case '\r': return 'r';
+    case '\t': return 't';
+    default:   return 0;
+  }
+}
+
+/* Bytes that end a run of plain characters: controls, NUL included, '"' and '\\' */
+static const uint8_t jesy_escape_special[256] = {
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  ['"'] = 1, ['\\'] = 1,
+};
+
+/* Writes the escape sequence of a special character and returns its length. */
+static size_t jesy_escape_char(uint8_t ch, char escape[6])
+{
+  static const char hex[] = "0123456789abcdef";
+
+  escape[0] = '\\';
+  escape[1] = jesy_escape_letter(ch);
+  if (escape[1]) {
+    return 2;
+  }
+  memcpy(&escape[1], "u00", 3);
+  escape[4] = hex[ch >> 4];
+  escape[5] = hex[ch & 0x0F];
+  return 6;
+}
+
+/* Writes length bytes of raw text as a quoted and escaped JSON string. */
+static void jesy_output_escaped(struct jesy_output *out, const char *src, size_t length)
+{
+  const uint8_t *iter = (const uint8_t*)src;
+  const uint8_t *end = iter + length;
+
+  jesy_output_char(out, '"');
+  while (iter < end) {
+    const uint8_t *start = iter;
+    char escape[6];
+
+    while ((iter < end) && !jesy_escape_special[*iter]) {
+      iter++;
+    }
+    jesy_output_write(out, (const char*)start, (size_t)(iter - start));
+    if (iter < end) {
+      jesy_output_write(out, escape, jesy_escape_char(*iter, escape));
+      iter++;
+    }
+  }
+  jesy_output_char(out, '"');
+}
+
+static bool jesy_render_bound_value(struct jesy_output *out, const struct jesy_binding *binding, const void *src)
+{
+  const uint8_t *member = (const uint8_t*)src + binding->offset;
+  char number[JESY_NUMBER_TEXT_LEN];
+  int len = 0;
+
+  switch (binding->type) {
+    case JESY_BIND_BOOL: {
+      bool flag;
+      memcpy(&flag, member, sizeof(flag));
+      if (flag) {
+        jesy_output_write(out, "true", sizeof("true") - 1);
+      }
+      else {
+        jesy_output_write(out, "false", sizeof("false") - 1);
+      }
+      return true;
+    }
+    case JESY_BIND_STRING:
+      jesy_output_escaped(out, (const char*)member, strnlen((const char*)member, binding->size));
+      return true;
+    case JESY_BIND_INT32: {
+      int32_t integer;
+      memcpy(&integer, member, sizeof(integer));
+      len = snprintf(number, sizeof(number), "%ld", (long)integer);
+      break;
+    }
+    case JESY_BIND_INT64: {
+      int64_t integer;
+      memcpy(&integer, member, sizeof(integer));
+      len = snprintf(number, sizeof(number), "%lld", (long long)integer);
+      break;
+    }
+    case JESY_BIND_UINT32: {
+      uint32_t integer;
+      memcpy(&integer, member, sizeof(integer));
+      len = snprintf(number, sizeof(number), "%lu", (unsigned long)integer);
+      break;
+    }
+    case JESY_BIND_UINT64: {
+      uint64_t integer;
+      memcpy(&integer, member, sizeof(integer));
+      len = snprintf(number, sizeof(number), "%llu", (unsigned long long)integer);
+      break;
+    }
+    case JESY_BIND_DOUBLE: {
+      double real;
+      int precision;
+      memcpy(&real, member, sizeof(real));
+      if (!isfinite(real)) {
+        return false;
+      }
+      /* Use the shortest representation that converts back to the same value. */
+      for (precision = 15; precision <= 17; precision++) {
+        len = snprintf(number, sizeof(number), "%.*g", precision, real);
+        if (strtod(number, NULL) == real) {
+          break;
+        }
+      }
+      break;
+    }
+    default:
+      return false;
+  }
+
+  if ((len <= 0) || ((size_t)len >= sizeof(number))) {
+    return false;
+  }
+  jesy_output_write(out, number, (size_t)len);
+  return true;
+}
+
+uint32_t jesy_render_binding(const struct jesy_binding *table, uint32_t count,
+                             const void *src, char *dst, uint32_t length)
+{
+  struct jesy_output out = { dst, dst ? length : 0, 0, false };
+  const char *previous = NULL;
+  uint32_t open = 0;
+  uint32_t idx;
+
+  if (!table || !src) {
+    return 0;
+  }
+
+  jesy_output_char(&out, '{');
+  for (idx = 0; idx < count; idx++) {
+    const char *path = table[idx].path;
+    const char *dot;
+    uint32_t common = 0;
+
+    /* Count the leading objects that are shared with the previous entry. */
+    if (previous) {
+      const char *prev = previous;
+      const char *prev_dot;
+      while ((dot = strchr(path, '.')) && (prev_dot = strchr(prev, '.')) &&
+             ((dot - path) == (prev_dot - prev)) && (0 == memcmp(path, prev, (size_t)(dot - path)))) {
+        common++;
+        path = dot + 1;
+        prev = prev_dot + 1;
+      }
+      while (open > common) {
+        jesy_output_char(&out, '}');
+        open--;
+      }
+      jesy_output_char(&out, ',');
+    }
+
+    while ((dot = strchr(path, '.'))) {
+      jesy_output_char(&out, '"');
+      jesy_output_write(&out, path, (size_t)(dot - path));
+      jesy_output_write(&out, "\":{", 3);
+      open++;
+      path = dot + 1;
+    }
+    jesy_output_char(&out, '"');
+    jesy_output_write(&out, path, strlen(path));
+    jesy_output_write(&out, "\":", 2);
+    if (!jesy_render_bound_value(&out, &table[idx], src)) {
+      return 0;
+    }
+    previous = table[idx].path;
+  }
+  while (open > 0) {
+    jesy_output_char(&out, '}');
+    open--;
+  }
+  jesy_output_char(&out, '}');
+
+  if (out.overflow) {
+    return 0;
+  }
+  return (uint32_t)out.offset;
+}
+
+struct jesy_element* jesy_clone(struct jesy_context *dst_ctx, struct jesy_element *dst_parent,
+                                struct jesy_context *src_ctx, struct jesy_element *src_element)
+{
+  struct jesy_element *iter = src_element;
+  struct jesy_element *parent = dst_parent;
+  struct jesy_element *top = NULL;
+
+  if (!dst_ctx || !src_ctx || !src_element || !jesy_validate_element(src_ctx, src_element)) {
+    return NULL;
+  }
+  if ((!dst_parent && dst_ctx->root) ||
+      (dst_parent && !jesy_validate_element(dst_ctx, dst_parent))) {
+    dst_ctx->status = JESY_INVALID_PARAMETER;
+    return NULL;
+  }
+
+  /* Copying a subtree into itself would never end. */
+  if ((dst_ctx == src_ctx) && dst_parent) {
+    struct jesy_element *ancestor = dst_parent;
+    while (ancestor) {
+      if (ancestor == src_element) {
+        dst_ctx->status = JESY_INVALID_PARAMETER;
+        return NULL;
+      }
+      ancestor = GET_PARENT(dst_ctx, ancestor);
+    }
+  }
+
+  while (iter) {
+    struct jesy_element *copy = jesy_append_element(dst_ctx, parent, iter->type, iter->length, iter->value);
+    if (!copy) {
+      /* Out of memory. Don't leave a partial copy behind. */
+      if (top) {
+        jesy_delete_element(dst_ctx, top);
+      }
+      return NULL;
+    }
+    if (!top) {
+      top = copy;
+    }
+
+    if (HAS_CHILD(iter)) {
+      parent = copy;
+      iter = &src_ctx->pool[iter->first_child];
+      continue;
+    }
+
+    while (true) {
+      if (iter == src_element) {
+        iter = NULL;
+        break;
+      }
+      if (HAS_SIBLING(iter)) {
+        iter = &src_ctx->pool[iter->sibling];
+        break;
+      }
+      iter = &src_ctx->pool[iter->parent];
+      if (iter != src_element) {
+        parent = &dst_ctx->pool[parent->parent];
+      }
+    }
+  }
+
+  return top;
+}
+
+/* Replaces an element with a copy of another one at the same position. */
+static uint32_t jesy_replace_element(struct jesy_context *ctx, struct jesy_element *target,
+                                     struct jesy_context *src_ctx, struct jesy_element *src)
+{
+  struct jesy_element *parent = GET_PARENT(ctx, target);
+  struct jesy_element *prev;
+  struct jesy_element *copy;
+
+  if (!parent) {
+    /* The root is always an object. */
+    return JESY_UNEXPECTED_NODE;
+  }
+
+  copy = jesy_clone(ctx, parent, src_ctx, src);
+  if (!copy) {
+    return ctx->status;
+  }
+  jesy_unlink(ctx, copy);
+  prev = jesy_unlink(ctx, target);
+  jesy_link(ctx, parent, prev, copy);
+  jesy_delete_element(ctx, target);
+  return JESY_NO_ERR;
+}
+
+/* Turns a value element into an empty object in place. */
+static void jesy_make_object(struct jesy_context *ctx, struct jesy_element *element)
+{
+  while (HAS_CHILD(element)) {
+    jesy_delete_element(ctx, &ctx->pool[element->first_child]);
+  }
+  JESY_HASH_INVALIDATE(ctx, element);
+  element->type = JESY_OBJECT;
+  element->length = 0;
+  element->value = NULL;
+}
+
+uint32_t jesy_merge_patch(struct jesy_context *ctx, struct jesy_element *target,
+                          struct jesy_context *patch_ctx, struct jesy_element *patch)
+{
+  /* Pairs of target objects and the next patch member to be merged into them */
+  struct {
+    struct jesy_element *target;
+    struct jesy_element *member;
+  } stack[JESY_MAX_DEPTH];
+  uint32_t depth = 0;
+
+  if (!ctx || !target || !patch_ctx || !patch ||
+      !jesy_validate_element(ctx, target) || !jesy_validate_element(patch_ctx, patch) ||
+      (target->type == JESY_KEY) || (patch->type == JESY_KEY)) {
+    return JESY_INVALID_PARAMETER;
+  }
+  ctx->status = JESY_NO_ERR;
+  ctx->pristine = false;
+
+  if (patch->type != JESY_OBJECT) {
+    ctx->status = jesy_replace_element(ctx, target, patch_ctx, patch);
+    return ctx->status;
+  }
+  if (target->type != JESY_OBJECT) {
+    jesy_make_object(ctx, target);
+  }
+
+  stack[depth].target = target;
+  stack[depth].member = GET_CHILD(patch_ctx, patch);
+  depth++;
+
+  while (depth > 0) {
+    struct jesy_element *patch_key = stack[depth - 1].member;
+    struct jesy_element *patch_value;
+    struct jesy_element *key;
+    struct jesy_element *value;
+
+    if (!patch_key) {
+      depth--;
+      continue;
+    }
+    stack[depth - 1].member = GET_SIBLING(patch_ctx, patch_key);
+
+    patch_value = GET_CHILD(patch_ctx, patch_key);
+    if (!patch_value) {
+      ctx->status = JESY_UNEXPECTED_NODE;
+      break;
+    }
+    key = jesy_find_key(ctx, stack[depth - 1].target, patch_key->value, patch_key->length);
+
+    if (patch_value->type == JESY_NULL) {
+      if (key) {
+        jesy_delete_element(ctx, key);
+      }
+      continue;
+    }
+
+    if (!key) {
+      key = jesy_append_element(ctx, stack[depth - 1].target, JESY_KEY, patch_key->length, patch_key->value);
+      if (!key) {
+        break;
+      }
+    }
+    value = GET_CHILD(ctx, key);
+
+    if (patch_value->type == JESY_OBJECT) {
+      if (depth >= JESY_MAX_DEPTH) {
+        ctx->status = JESY_MAX_DEPTH_EXCEEDED;
+        break;
+      }
+      if (!value) {
+        value = jesy_append_element(ctx, key, JESY_OBJECT, 0, NULL);
+        if (!value) {
+          break;
+        }
+      }
+      else if (value->type != JESY_OBJECT) {
+        jesy_make_object(ctx, value);
+      }
+      stack[depth].target = value;
+      stack[depth].member = GET_CHILD(patch_ctx, patch_value);
+      depth++;
+      continue;
+    }
+
+    if (value) {
+      jesy_delete_element(ctx, value);
+    }
+    if (!jesy_clone(ctx, key, patch_ctx, patch_value)) {
+      break;
+    }
+  }
+
+  return ctx->status;
+}
+
+/* Counts the elements of a subtree including its root. */
+static uint32_t jesy_count_nodes(struct jesy_context *ctx, struct jesy_element *element)
+{
+  struct jesy_element *iter = element;
+  uint32_t count = 0;
+
+  while (iter) {
+    count++;
+    if (HAS_CHILD(iter)) {
+      iter = &ctx->pool[iter->first_child];
+      continue;
+    }
+    while (iter) {
+      if (iter == element) {
+        iter = NULL;
+      }
+      else if (HAS_SIBLING(iter)) {
+        iter = &ctx->pool[iter->sibling];
+        break;
+      }
+      else {
+        iter = &ctx->pool[iter->parent];
+        if (iter == element) {
+          iter = NULL;
+        }
+      }
+    }
+  }
+  return count;
+}
+
+static uint32_t jesy_count_children(struct jesy_context *ctx, struct jesy_element *element)
+{
+  struct jesy_element *iter = GET_CHILD(ctx, element);
+  uint32_t count = 0;
+
+  for (; iter; iter = GET_SIBLING(ctx, iter)) {
+    count++;
+  }
+  return count;
+}
+
+/* Exact decimal value of a JSON number: 0.<digits> * 10^exponent, where the
+ * digits are read from the text skipping a '.' and a value without digits is zero. */
+struct jesy_decimal {
+  const char *digits;
+  uint16_t    count;
+  long        exponent;
+  bool        negative;
+};
+
+/* return false if the text isn't a JSON number */
+static bool jesy_read_decimal(const char *src, uint16_t length, struct jesy_decimal *decimal)
+{
+  uint16_t index = 0;
+  uint16_t total = 0;
+  long exponent = 0;
+  bool negative_exponent = false;
+
+  decimal->digits = NULL;
+  decimal->count = 0;
+  decimal->exponent = 0;
+  decimal->negative = (length > 0) && (src[0] == '-');
+  index = decimal->negative ? 1 : 0;
+  if ((index >= length) || !IS_DIGIT(src[index])) {
+    return false;
+  }
+  for (; (index < length) && IS_DIGIT(src[index]); index++) {
+    if (!decimal->digits && (src[index] != '0')) {
+      decimal->digits = &src[index];
+    }
+    if (decimal->digits) {
+      decimal->exponent++;
+      total++;
+      decimal->count = (src[index] != '0') ? total : decimal->count;
+    }
+  }
+  if ((index < length) && (src[index] == '.')) {
+    index++;
+    if ((index >= length) || !IS_DIGIT(src[index])) {
+      return false;
+    }
+    for (; (index < length) && IS_DIGIT(src[index]); index++) {
+      if (!decimal->digits && (src[index] != '0')) {
+        decimal->digits = &src[index];
+      }
+      if (decimal->digits) {
+        total++;
+        decimal->count = (src[index] != '0') ? total : decimal->count;
+      }
+      else {
+        decimal->exponent--;
+      }
+    }
+  }
+  if ((index < length) && ((src[index] == 'e') || (src[index] == 'E'))) {
+    index++;
+    if ((index < length) && ((src[index] == '+') || (src[index] == '-'))) {
+      negative_exponent = (src[index] == '-');
+      index++;
+    }
+    if ((index >= length) || !IS_DIGIT(src[index])) {
+      return false;
+    }
+    for (; (index < length) && IS_DIGIT(src[index]); index++) {
+      if (exponent < 100000000) {
+        exponent = (exponent * 10) + (src[index] - '0');
+      }
+    }
+  }
+  decimal->exponent += negative_exponent ? -exponent : exponent;
+  return (index == length);
+}
+
+/* Compares two numbers by their exact decimal value, so 1, 1.0 and 10e-1 are
+ * equal while integers beyond the precision of double are still told apart. */
+static bool jesy_equal_number(struct jesy_element *a, struct jesy_element *b)
+{
+  struct jesy_decimal decimal_a;
+  struct jesy_decimal decimal_b;
+  const char *digit_a;
+  const char *digit_b;
+  uint16_t index;
+
+  if (!jesy_read_decimal(a->value, a->length, &decimal_a) ||
+      !jesy_read_decimal(b->value, b->length, &decimal_b)) {
+    return false;
+  }
+  if (!decimal_a.count || !decimal_b.count) {
+    return !decimal_a.count && !decimal_b.count; /* 0 and -0 */
+  }
+  if ((decimal_a.negative != decimal_b.negative) || (decimal_a.count != decimal_b.count) ||
+      (decimal_a.exponent != decimal_b.exponent)) {
+    return false;
+  }
+  digit_a = decimal_a.digits;
+  digit_b = decimal_b.digits;
+  for (index = 0; index < decimal_a.count; index++, digit_a++, digit_b++) {
+    digit_a += (*digit_a == '.') ? 1 : 0;
+    digit_b += (*digit_b == '.') ? 1 : 0;
+    if (*digit_a != *digit_b) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* Delivers the next byte of the raw (unescaped) string at src[*index].
+ * pending holds the rest of a decoded escape sequence. */
+static char jesy_next_raw_byte(const char *src, uint16_t length, uint32_t *index,
+                               char pending[4], uint32_t *pending_length)
+{
+  uint32_t code;
+  char byte;
+
+  if (!*pending_length) {
+    if (src[*index] != '\\') {
+      return src[(*index)++];
+    }
+    *index += jesy_unescape_one(src, *index, length, &code);
+    *pending_length = jesy_utf8_encode(code, pending);
+  }
+  byte = pending[0];
+  memmove(pending, &pending[1], --(*pending_length));
+  return byte;
+}
+
+/* Compares two strings by their characters, so "\u0041" equals "A". */
+static bool jesy_equal_string(struct jesy_element *a, struct jesy_element *b)
+{
+  char pending_a[4];
+  char pending_b[4];
+  uint32_t pending_length_a = 0;
+  uint32_t pending_length_b = 0;
+  uint32_t index_a = 0;
+  uint32_t index_b = 0;
+
+  while (((index_a < a->length) || pending_length_a) && ((index_b < b->length) || pending_length_b)) {
+    if (jesy_next_raw_byte(a->value, a->length, &index_a, pending_a, &pending_length_a) !=
+        jesy_next_raw_byte(b->value, b->length, &index_b, pending_b, &pending_length_b)) {
+      return false;
+    }
+  }
+  return (index_a >= a->length) && !pending_length_a && (index_b >= b->length) && !pending_length_b;
+}
+
+/* Compares two values that are not objects or arrays. */
+static bool jesy_equal_scalar(struct jesy_element *a, struct jesy_element *b)
+{
+  if (a->type != b->type) {
+    return false;
+  }
+  if ((a->length == b->length) && (0 == memcmp(a->value, b->value, a->length))) {
+    return true;
+  }
+  if (a->type == JESY_NUMBER) {
+    return jesy_equal_number(a, b);
+  }
+  if (a->type == JESY_STRING) {
+    return jesy_equal_string(a, b);
+  }
+  return (a->type == JESY_TRUE) || (a->type == JESY_FALSE) || (a->type == JESY_NULL);
+}
+
+bool jesy_equal(struct jesy_context *ctx_a, struct jesy_element *a,
+                struct jesy_context *ctx_b, struct jesy_element *b)
+{
+  /* Pairs of containers being compared and the next member of a to be checked */
+  struct {
+    struct jesy_element *container_b;
+    struct jesy_element *member_a;
+    struct jesy_element *member_b;
+  } stack[JESY_MAX_DEPTH];
+  uint32_t depth = 0;
+
+  if (!ctx_a || !ctx_b || !a || !b ||
+      !jesy_validate_element(ctx_a, a) || !jesy_validate_element(ctx_b, b)) {
+    return false;
+  }
+
+  while (true) {
+    if ((a->type != b->type) || (a->type == JESY_KEY)) {
+      return false;
+    }
+    if ((a->type == JESY_OBJECT) || (a->type == JESY_ARRAY)) {
+      if (jesy_count_children(ctx_a, a) != jesy_count_children(ctx_b, b)) {
+        return false;
+      }
+      if (depth >= JESY_MAX_DEPTH) {
+        return false;
+      }
+      stack[depth].container_b = b;
+      stack[depth].member_a = GET_CHILD(ctx_a, a);
+      stack[depth].member_b = GET_CHILD(ctx_b, b);
+      depth++;
+    }
+    else if (!jesy_equal_scalar(a, b)) {
+      return false;
+    }
+
+    /* Pick the next pair of values to be compared. */
+    while (depth > 0) {
+      struct jesy_element *member_a = stack[depth - 1].member_a;
+      struct jesy_element *container_b = stack[depth - 1].container_b;
+      if (!member_a) {
+        depth--;
+        continue;
+      }
+      stack[depth - 1].member_a = GET_SIBLING(ctx_a, member_a);
+      if (container_b->type == JESY_ARRAY) {
+        a = member_a;
+        b = stack[depth - 1].member_b;
+        stack[depth - 1].member_b = GET_SIBLING(ctx_b, b);
+      }
+      else {
+        /* Object members are compared regardless of their order. */
+        struct jesy_element *key_b = jesy_find_key(ctx_b, container_b, member_a->value, member_a->length);
+        a = GET_CHILD(ctx_a, member_a);
+        b = key_b ? GET_CHILD(ctx_b, key_b) : NULL;
+        if (!a || !b) {
+          return false;
+        }
+      }
+      break;
+    }
+    if (depth == 0) {
+      return true;
+    }
+  }
+}
+
+/* Finalizer of MurmurHash3. Spreads every input bit over the whole word. */
+static inline uint64_t jesy_hash_mix(uint64_t hash)
+{
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDull;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53ull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+/* Hashes the type and the text of a single node, 8 bytes per round. The text
+ * of containers is ignored since built ones have none. */
+static uint64_t jesy_hash_node(struct jesy_element *element)
+{
+  const uint8_t *text = (const uint8_t*)element->value;
+  uint32_t length = ((element->type == JESY_OBJECT) || (element->type == JESY_ARRAY)) ? 0 : element->length;
+  uint64_t hash = (0x9E3779B97F4A7C15ull * (element->type + 1)) ^ length;
+
+  while (length > 0) {
+    uint32_t size = (length < 8) ? length : 8;
+    uint64_t word = 0;
+    uint32_t index;
+    for (index = 0; index < size; index++) {
+      word |= (uint64_t)text[index] << (index * 8);
+    }
+    hash = jesy_hash_mix(hash ^ word);
+    text += size;
+    length -= size;
+  }
+  return jesy_hash_mix(hash);
+}
+
+uint64_t jesy_hash(struct jesy_context *ctx, struct jesy_element *element, bool unordered)
+{
+  /* Containers and keys being hashed with the hash of their members so far.
+     Members of an object are summed up if their order doesn't matter. */
+  struct {
+    uint64_t hash;
+    uint64_t sum;
+  } stack[JESY_MAX_DEPTH];
+  struct jesy_element *iter = element;
+  uint32_t depth = 0;
+  uint64_t hash;
+
+  if (!ctx) {
+    return 0;
+  }
+  if (!element || !jesy_validate_element(ctx, element)) {
+    ctx->status = JESY_INVALID_PARAMETER;
+    return 0;
+  }
+  ctx->status = JESY_NO_ERR;
+
+#ifdef JESY_ENABLE_HASH_CACHE
+  if (ctx->hash_unordered != unordered) {
+    jesy_node_descriptor index;
+    for (index = 0; index < ctx->index; index++) {
+      ctx->pool[index].hash = 0;
+    }
+    ctx->hash_unordered = unordered;
+  }
+#endif
+
+  while (true) {
+    /* Descend to the leaves or to the nodes with a cached hash. */
+    hash = 0;
+#ifdef JESY_ENABLE_HASH_CACHE
+    hash = iter->hash;
+#endif
+    if (!hash && HAS_CHILD(iter)) {
+      if (depth >= JESY_MAX_DEPTH) {
+        ctx->status = JESY_MAX_DEPTH_EXCEEDED;
+        return 0;
+      }
+      stack[depth].hash = jesy_hash_node(iter);
+      stack[depth].sum = 0;
+      depth++;
+      iter = &ctx->pool[iter->first_child];
+      continue;
+    }
+    if (!hash) {
+      hash = jesy_hash_node(iter);
+    }
+
+    /* The subtree of iter is hashed. Fold it into the enclosing nodes. */
+    while (true) {
+      struct jesy_element *parent;
+
+      /* Zero is reserved for unknown hashes and failures. */
+      hash = hash ? hash : 1;
+#ifdef JESY_ENABLE_HASH_CACHE
+      iter->hash = hash;
+#endif
+      if (iter == element) {
+        return hash;
+      }
+      parent = &ctx->pool[iter->parent];
+      if (unordered && (parent->type == JESY_OBJECT)) {
+        stack[depth - 1].sum += hash;
+      }
+      else {
+        stack[depth - 1].hash = jesy_hash_mix(stack[depth - 1].hash ^ hash);
+      }
+      if (HAS_SIBLING(iter)) {
+        iter = &ctx->pool[iter->sibling];
+        break;
+      }
+      iter = parent;
+      depth--;
+      hash = jesy_hash_mix(stack[depth].hash + stack[depth].sum);
+    }
+  }
+}
+
+enum jesy_patch_op {
+  JESY_PATCH_ADD,
+  JESY_PATCH_REMOVE,
+  JESY_PATCH_REPLACE,
+  JESY_PATCH_MOVE,
+  JESY_PATCH_COPY,
+  JESY_PATCH_TEST,
+};
+
+struct jesy_patch_operation {
+  enum jesy_patch_op op;
+  char *path;
+  uint16_t path_length;
+  char *from;
+  uint16_t from_length;
+  struct jesy_element *value;
+};
+
+/* Every mutation is recorded, so that a failing operation can undo all the
+ * previous ones. Detached subtrees are released only after the whole patch
+ * succeeded. */
+enum jesy_journal_action {
+  JESY_JOURNAL_INSERT, /* A new subtree was linked. Undo by deleting it. */
+  JESY_JOURNAL_ATTACH, /* An existing subtree was linked. Undo by unlinking it. */
+  JESY_JOURNAL_DETACH, /* A subtree was unlinked. Undo by linking it after prev. */
+  JESY_JOURNAL_ROOT,   /* The root was replaced. Undo by deleting the new root. */
+};
+
+struct jesy_journal_entry {
+  enum jesy_journal_action action;
+  struct jesy_element *element;
+  struct jesy_element *parent;
+  struct jesy_element *prev;
+};
+
+/* A move touches at most 4 places: the source key, the source value, the
+ * replaced value and the destination. */
+#define JESY_PATCH_JOURNAL_ENTRIES 4
+
+struct jesy_patch_state {
+  struct jesy_context *ctx;
+  /* Undo journal in the unused part of the pool, right below the string area */
+  struct jesy_journal_entry *journal;
+  uint32_t journal_capacity;
+  uint32_t journal_length;
+  /* The last resolved parent path. Operations on siblings share it. */
+  char *cached_path;
+  uint16_t cached_length;
+  struct jesy_element *cached_parent;
+};
+
+/* Location of a JSON pointer inside the tree */
+struct jesy_pointer_ref {
+  /* The object or array containing the referenced element */
+  struct jesy_element *parent;
+  /* The last reference token, still ~ escaped */
+  char *token;
+  uint16_t token_length;
+  /* The referenced key of an object or item of an array. NULL if missing. */
+  struct jesy_element *element;
+  /* The item preceding the referenced array position */
+  struct jesy_element *prev;
+  /* The referenced array position is right after the last item */
+  bool append;
+};
+
+static void jesy_journal(struct jesy_patch_state *state, enum jesy_journal_action action,
+                         struct jesy_element *element, struct jesy_element *parent,
+                         struct jesy_element *prev)
+{
+  struct jesy_journal_entry *entry;
+
+  assert(state->journal_length < state->journal_capacity);
+  entry = &state->journal[state->journal_length++];
+  entry->action = action;
+  entry->element = element;
+  entry->parent = parent;
+  entry->prev = prev;
+}
+
+static void jesy_journal_detach(struct jesy_patch_state *state, struct jesy_element *element)
+{
+  struct jesy_element *parent = GET_PARENT(state->ctx, element);
+  struct jesy_element *prev = jesy_unlink(state->ctx, element);
+  jesy_journal(state, JESY_JOURNAL_DETACH, element, parent, prev);
+}
+
+static void jesy_journal_rollback(struct jesy_patch_state *state)
+{
+  while (state->journal_length > 0) {
+    struct jesy_journal_entry *entry = &state->journal[--state->journal_length];
+    switch (entry->action) {
+      case JESY_JOURNAL_INSERT:
+        jesy_delete_element(state->ctx, entry->element);
+        break;
+      case JESY_JOURNAL_ATTACH:
+        jesy_unlink(state->ctx, entry->element);
+        break;
+      case JESY_JOURNAL_DETACH:
+        jesy_link(state->ctx, entry->parent, entry->prev, entry->element);
+        break;
+      case JESY_JOURNAL_ROOT:
+        jesy_delete_element(state->ctx, state->ctx->root);
+        state->ctx->root = entry->element;
+        break;
+    }
+  }
+}
+
+static void jesy_journal_commit(struct jesy_patch_state *state)
+{
+  uint32_t index;
+
+  for (index = 0; index < state->journal_length; index++) {
+    struct jesy_journal_entry *entry = &state->journal[index];
+    uint32_t later;
+    bool last = true;
+
+    if (entry->action != JESY_JOURNAL_DETACH) {
+      continue;
+    }
+    /* The same subtree might be detached several times. Only the last record counts. */
+    for (later = index + 1; later < state->journal_length; later++) {
+      if ((state->journal[later].action == JESY_JOURNAL_DETACH) &&
+          (state->journal[later].element == entry->element)) {
+        last = false;
+        break;
+      }
+    }
+    if (last && !HAS_PARENT(entry->element)) {
+      jesy_delete_element(state->ctx, entry->element);
+    }
+  }
+  /* Replaced roots may hold subtrees attached by later operations, so they go last. */
+  for (index = 0; index < state->journal_length; index++) {
+    struct jesy_journal_entry *entry = &state->journal[index];
+    if ((entry->action == JESY_JOURNAL_ROOT) && (entry->element != state->ctx->root)) {
+      jesy_delete_element(state->ctx, entry->element);
+    }
+  }
+  state->journal_length = 0;
+}
+
+/* Compares a reference token with ~0 and ~1 escapes against a key name. */
+static bool jesy_match_token(const char *token, uint16_t token_length, const char *name, uint16_t length)
+{
+  uint16_t index = 0;
+
+  while (token_length > 0) {
+    char c = *token++;
+    token_length--;
+    if (c == '~') {
+      if (token_length == 0) {
+        return false;
+      }
+      c = (*token == '0') ? '~' : '/';
+      token++;
+      token_length--;
+    }
+    if ((index >= length) || (name[index] != c)) {
+      return false;
+    }
+    index++;
+  }
+  return index == length;
+}
+
+/* Parses an array index without leading zeros.
+ * return false if the token is not a valid index */
+static bool jesy_parse_index(const char *token, uint16_t length, uint32_t *index)
+{
+  uint32_t value = 0;
+  uint16_t pos;
+
+  if ((length == 0) || ((token[0] == '0') && (length > 1))) {
+    return false;
+  }
+  for (pos = 0; pos < length; pos++) {
+    if ((token[pos] < '0') || (token[pos] > '9') || (value > (UINT32_MAX / 10) - 1)) {
+      return false;
+    }
+    value = (value * 10) + (token[pos] - '0');
+  }
+  *index = value;
+  return true;
+}
+
+/* Looks up the key of an object or the item of an array addressed by a
+ * reference token. For arrays, ref receives the insert position as well. */
+static struct jesy_element* jesy_resolve_token(struct jesy_context *ctx, struct jesy_element *container,
+                                               const char *token, uint16_t length,
+                                               struct jesy_pointer_ref *ref)
+{
+  struct jesy_element *iter = GET_CHILD(ctx, container);
+  struct jesy_element *last = NULL;
+  bool end = (length == 1) && (token[0] == '-');
+  uint32_t index = 0;
+
+  if (container->type == JESY_OBJECT) {
+    for (; iter; iter = GET_SIBLING(ctx, iter)) {
+      if (jesy_match_token(token, length, iter->value, iter->length)) {
+        return iter;
+      }
+    }
+    return NULL;
+  }
+
+  if ((container->type != JESY_ARRAY) || (!end && !jesy_parse_index(token, length, &index))) {
+    return NULL;
+  }
+  while (iter && (end || (index > 0))) {
+    last = iter;
+    iter = GET_SIBLING(ctx, iter);
+    index--;
+  }
+  if (ref) {
+    ref->prev = last;
+    ref->append = !iter && (end || (index == 0));
+  }
+  return iter;
+}
+
+/* Resolves a JSON pointer (RFC 6901) down to the container of its last token. */
+static uint32_t jesy_resolve_pointer(struct jesy_patch_state *state, char *path, uint16_t length,
+                                     struct jesy_pointer_ref *ref)
+{
+  struct jesy_context *ctx = state->ctx;
+  struct jesy_element *iter = ctx->root;
+  uint16_t parent_length = length;
+  uint16_t pos = 0;
+  bool cacheable = (NULL == memchr(path, '\\', length));
+
+  memset(ref, 0, sizeof(*ref));
+  if ((length == 0) || (path[0] != '/')) {
+    return JESY_INVALID_PARAMETER;
+  }
+  while (path[parent_length - 1] != '/') {
+    parent_length--;
+  }
+  parent_length--;
+  ref->token = &path[parent_length + 1];
+  ref->token_length = length - parent_length - 1;
+
+  if (cacheable && state->cached_parent && (state->cached_length == parent_length) &&
+      (0 == memcmp(state->cached_path, path, parent_length))) {
+    iter = state->cached_parent;
+  }
+  else {
+    while (pos < parent_length) {
+      uint16_t end = pos + 1;
+      struct jesy_element *member;
+      while ((end < parent_length) && (path[end] != '/')) {
+        end++;
+      }
+      member = jesy_resolve_token(ctx, iter, &path[pos + 1], end - pos - 1, NULL);
+      if (!member) {
+        return JESY_ELEMENT_NOT_FOUND;
+      }
+      iter = (member->type == JESY_KEY) ? GET_CHILD(ctx, member) : member;
+      if (!iter) {
+        return JESY_UNEXPECTED_NODE;
+      }
+      pos = end;
+    }
+    if ((iter->type != JESY_OBJECT) && (iter->type != JESY_ARRAY)) {
+      return JESY_ELEMENT_NOT_FOUND;
+    }
+    if (cacheable) {
+      state->cached_path = path;
+      state->cached_length = parent_length;
+      state->cached_parent = iter;
+    }
+  }
+
+  ref->parent = iter;
+  ref->element = jesy_resolve_token(ctx, iter, ref->token, ref->token_length, ref);
+  return JESY_NO_ERR;
+}
+
+/* Drops the cached parent if a container on its path has been modified. */
+static void jesy_patch_invalidate(struct jesy_patch_state *state, const char *path, uint16_t length)
+{
+  uint16_t parent_length = length;
+
+  while ((parent_length > 0) && (path[parent_length - 1] != '/')) {
+    parent_length--;
+  }
+  if (parent_length > 0) {
+    parent_length--;
+  }
+  if (state->cached_parent && (state->cached_length > parent_length) &&
+      (state->cached_path[parent_length] == '/') &&
+      (0 == memcmp(state->cached_path, path, parent_length))) {
+    state->cached_parent = NULL;
+  }
+}
+
+/* Copies a value into ctx without linking it anywhere. A temporary holder
+ * allows copying a subtree into itself. */
+static struct jesy_element* jesy_patch_copy(struct jesy_context *ctx,
+                                            struct jesy_context *src_ctx, struct jesy_element *src)
+{
+  struct jesy_element *holder = jesy_allocate(ctx);
+  struct jesy_element *copy = NULL;
+
+  if (holder) {
+    holder->type = JESY_ARRAY;
+    holder->length = 0;
+    holder->value = NULL;
+    copy = jesy_clone(ctx, holder, src_ctx, src);
+    if (copy) {
+      jesy_unlink(ctx, copy);
+    }
+    jesy_free(ctx, holder);
+  }
+  return copy;
+}
+
+/* Links a detached value at the referenced location as defined by the add operation. */
+static uint32_t jesy_patch_attach(struct jesy_patch_state *state, struct jesy_pointer_ref *ref,
+                                  struct jesy_element *value, enum jesy_journal_action action)
+{
+  struct jesy_context *ctx = state->ctx;
+  struct jesy_element *parent = ref->parent;
+  struct jesy_element *prev = NULL;
+
+  if (parent->type == JESY_OBJECT) {
+    struct jesy_element *key = ref->element;
+    if (key) {
+      if (HAS_CHILD(key)) {
+        jesy_journal_detach(state, &ctx->pool[key->first_child]);
+      }
+    }
+    else {
+      /* The new key refers to the path string, so it can't hold unescaped characters. */
+      if (memchr(ref->token, '~', ref->token_length)) {
+        return JESY_INVALID_PARAMETER;
+      }
+      key = jesy_append_element(ctx, parent, JESY_KEY, ref->token_length, ref->token);
+      if (!key) {
+        return ctx->status;
+      }
+      jesy_journal(state, JESY_JOURNAL_INSERT, key, parent, NULL);
+    }
+    parent = key;
+  }
+  else {
+    /* New items are inserted in front of the referenced one or appended. */
+    if (!ref->element && !ref->append) {
+      return JESY_ELEMENT_NOT_FOUND;
+    }
+    prev = ref->prev;
+  }
+
+  jesy_link(ctx, parent, prev, value);
+  jesy_journal(state, action, value, parent, prev);
+  return JESY_NO_ERR;
+}
+
+/* Returns the value referenced by a pointer. For object members it's the value of the key. */
+static struct jesy_element* jesy_patch_value(struct jesy_context *ctx, struct jesy_pointer_ref *ref)
+{
+  if (!ref->element) {
+    return NULL;
+  }
+  return (ref->element->type == JESY_KEY) ? GET_CHILD(ctx, ref->element) : ref->element;
+}
+
+static uint32_t jesy_patch_apply_op(struct jesy_patch_state *state, struct jesy_patch_operation *op,
+                                    struct jesy_context *patch_ctx)
+{
+  struct jesy_context *ctx = state->ctx;
+  struct jesy_pointer_ref ref;
+  struct jesy_element *value;
+  uint32_t status;
+
+  if (op->op == JESY_PATCH_TEST) {
+    if (op->path_length == 0) {
+      value = ctx->root;
+    }
+    else {
+      status = jesy_resolve_pointer(state, op->path, op->path_length, &ref);
+      if (status != JESY_NO_ERR) {
+        return status;
+      }
+      value = jesy_patch_value(ctx, &ref);
+      if (!value) {
+        return JESY_ELEMENT_NOT_FOUND;
+      }
+    }
+    return jesy_equal(ctx, value, patch_ctx, op->value) ? JESY_NO_ERR : JESY_PATCH_TEST_FAILED;
+  }
+
+  if ((op->op == JESY_PATCH_MOVE) || (op->op == JESY_PATCH_COPY)) {
+    status = jesy_resolve_pointer(state, op->from, op->from_length, &ref);
+    if (status != JESY_NO_ERR) {
+      return status;
+    }
+    value = jesy_patch_value(ctx, &ref);
+    if (!value) {
+      return JESY_ELEMENT_NOT_FOUND;
+    }
+
+    if (op->op == JESY_PATCH_COPY) {
+      value = jesy_patch_copy(ctx, ctx, value);
+      if (!value) {
+        return ctx->status;
+      }
+    }
+    else if ((op->from_length == op->path_length) && (0 == memcmp(op->from, op->path, op->path_length))) {
+      /* Moving a value onto itself changes nothing. */
+      return JESY_NO_ERR;
+    }
+    else {
+      /* A value can't be moved into one of its own children. */
+      if ((op->path_length > op->from_length) && (op->path[op->from_length] == '/') &&
+          (0 == memcmp(op->from, op->path, op->from_length))) {
+        return JESY_INVALID_PARAMETER;
+      }
+      jesy_journal_detach(state, value);
+      if (ref.element != value) {
+        jesy_journal_detach(state, ref.element);
+      }
+      jesy_patch_invalidate(state, op->from, op->from_length);
+    }
+  }
+  else if ((op->op == JESY_PATCH_ADD) || (op->op == JESY_PATCH_REPLACE)) {
+    value = jesy_patch_copy(ctx, patch_ctx, op->value);
+    if (!value) {
+      return ctx->status;
+    }
+    if (op->path_length == 0) {
+      /* The whole document is replaced. */
+      struct jesy_element *root = ctx->root;
+      jesy_unlink(ctx, root);
+      ctx->root = value;
+      jesy_journal(state, JESY_JOURNAL_ROOT, root, NULL, NULL);
+      state->cached_parent = NULL;
+      return JESY_NO_ERR;
+    }
+  }
+  else {
+    value = NULL;
+  }
+
+  status = jesy_resolve_pointer(state, op->path, op->path_length, &ref);
+  if ((status == JESY_NO_ERR) && (op->op == JESY_PATCH_REMOVE)) {
+    if (!ref.element) {
+      status = JESY_ELEMENT_NOT_FOUND;
+    }
+    else {
+      jesy_journal_detach(state, ref.element);
+    }
+  }
+  else if ((status == JESY_NO_ERR) && (op->op == JESY_PATCH_REPLACE)) {
+    if (!ref.element) {
+      status = JESY_ELEMENT_NOT_FOUND;
+    }
+    else if (ref.element->type != JESY_KEY) {
+      /* Replacing an array item keeps its position. */
+      jesy_journal_detach(state, ref.element);
+      ref.element = NULL;
+      ref.append = true;
+    }
+  }
+  if ((status == JESY_NO_ERR) && value) {
+    status = jesy_patch_attach(state, &ref, value,
+                               (op->op == JESY_PATCH_MOVE) ? JESY_JOURNAL_ATTACH : JESY_JOURNAL_INSERT);
+  }
+  if ((status != JESY_NO_ERR) && value && (op->op != JESY_PATCH_MOVE)) {
+    /* The copy hasn't been linked, so the journal doesn't know about it. */
+    jesy_delete_element(ctx, value);
+  }
+  jesy_patch_invalidate(state, op->path, op->path_length);
+  return status;
+}
+
+/* Reads and validates a single operation object of a patch. */
+static uint32_t jesy_patch_read_op(struct jesy_context *patch_ctx, struct jesy_element *object,
+                                   struct jesy_patch_operation *op, uint32_t *nodes)
+{
+  static const struct {
+    const char *name;
+    uint16_t length;
+    enum jesy_patch_op op;
+  } names[] = {
+    { "add",     3, JESY_PATCH_ADD },
+    { "remove",  6, JESY_PATCH_REMOVE },
+    { "replace", 7, JESY_PATCH_REPLACE },
+    { "move",    4, JESY_PATCH_MOVE },
+    { "copy",    4, JESY_PATCH_COPY },
+    { "test",    4, JESY_PATCH_TEST },
+  };
+  struct jesy_element *name = NULL;
+  struct jesy_element *path;
+  struct jesy_element *from;
+  struct jesy_element *iter;
+  uint32_t index;
+
+  if (object->type != JESY_OBJECT) {
+    return JESY_INVALID_PARAMETER;
+  }
+  iter = jesy_find_key(patch_ctx, object, "op", 2);
+  name = iter ? GET_CHILD(patch_ctx, iter) : NULL;
+  iter = jesy_find_key(patch_ctx, object, "path", 4);
+  path = iter ? GET_CHILD(patch_ctx, iter) : NULL;
+  iter = jesy_find_key(patch_ctx, object, "from", 4);
+  from = iter ? GET_CHILD(patch_ctx, iter) : NULL;
+  iter = jesy_find_key(patch_ctx, object, "value", 5);
+  op->value = iter ? GET_CHILD(patch_ctx, iter) : NULL;
+
+  if (!name || (name->type != JESY_STRING) || !path || (path->type != JESY_STRING)) {
+    return JESY_INVALID_PARAMETER;
+  }
+  for (index = 0; index < sizeof(names) / sizeof(names[0]); index++) {
+    if ((names[index].length == name->length) && (0 == memcmp(names[index].name, name->value, name->length))) {
+      break;
+    }
+  }
+  if (index == sizeof(names) / sizeof(names[0])) {
+    return JESY_INVALID_PARAMETER;
+  }
+  op->op = names[index].op;
+  op->path = path->value;
+  op->path_length = path->length;
+  op->from = NULL;
+  op->from_length = 0;
+
+  /* The root itself can only be tested or replaced as a whole. */
+  if ((op->path_length == 0) ? ((op->op != JESY_PATCH_TEST) && (op->op != JESY_PATCH_ADD) &&
+                                (op->op != JESY_PATCH_REPLACE))
+                             : (op->path[0] != '/')) {
+    return JESY_INVALID_PARAMETER;
+  }
+
+  switch (op->op) {
+    case JESY_PATCH_ADD:
+    case JESY_PATCH_REPLACE:
+    case JESY_PATCH_TEST:
+      if (!op->value) {
+        return JESY_INVALID_PARAMETER;
+      }
+      if (op->op != JESY_PATCH_TEST) {
+        /* The copied value, a new key and a temporary holder */
+        *nodes += jesy_count_nodes(patch_ctx, op->value) + 2;
+      }
+      break;
+    case JESY_PATCH_MOVE:
+    case JESY_PATCH_COPY:
+      if (!from || (from->type != JESY_STRING) || (from->length == 0) || (from->value[0] != '/')) {
+        return JESY_INVALID_PARAMETER;
+      }
+      op->from = from->value;
+      op->from_length = from->length;
+      break;
+    default:
+      break;
+  }
+  return JESY_NO_ERR;
+}
+
+uint32_t jesy_apply_patch(struct jesy_context *ctx, struct jesy_context *patch_ctx, struct jesy_element *patch)
+{
+  struct jesy_patch_operation op;
+  struct jesy_patch_state state;
+  struct jesy_element *iter;
+  uint32_t count = 0;
+  uint32_t nodes = 0;
+  uint32_t capacity;
+  uint32_t saved_capacity;
+  size_t size;
+  char *journal;
+
+  if (!ctx || !patch_ctx || !patch || !ctx->root ||
+      !jesy_validate_element(patch_ctx, patch) || (patch->type != JESY_ARRAY)) {
+    return JESY_INVALID_PARAMETER;
+  }
+
+  /* Validate the whole patch before touching the tree. */
+  ctx->status = JESY_NO_ERR;
+  state.ctx = ctx;
+  state.journal = NULL;
+  state.journal_capacity = 0;
+  state.journal_length = 0;
+  state.cached_parent = NULL;
+  for (iter = GET_CHILD(patch_ctx, patch); iter; iter = GET_SIBLING(patch_ctx, iter)) {
+    ctx->status = jesy_patch_read_op(patch_ctx, iter, &op, &nodes);
+    if (ctx->status != JESY_NO_ERR) {
+      return ctx->status;
+    }
+    if (op.op == JESY_PATCH_COPY) {
+      /* Estimated on the unpatched tree. If earlier operations enlarge the
+         source, the copy may still run out of nodes and roll back the patch. */
+      struct jesy_pointer_ref ref;
+      struct jesy_element *value = NULL;
+      if (JESY_NO_ERR == jesy_resolve_pointer(&state, op.from, op.from_length, &ref)) {
+        value = jesy_patch_value(ctx, &ref);
+      }
+      /* The copied value, a new key and a temporary holder */
+      nodes += (value ? jesy_count_nodes(ctx, value) : 0) + 2;
+    }
+    count++;
+  }
+
+  /* The journal takes the top of the unused part of the pool. The nodes must
+     stay below it while the patch is applied. */
+  size = (size_t)count * JESY_PATCH_JOURNAL_ENTRIES * sizeof(struct jesy_journal_entry);
+  if (size > (size_t)(ctx->strings - (char*)ctx->pool)) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return ctx->status;
+  }
+  journal = ctx->strings - size;
+  journal -= (uintptr_t)journal % sizeof(void*);
+  capacity = (journal < (char*)ctx->pool) ? 0
+           : (uint32_t)((journal - (char*)ctx->pool) / sizeof(struct jesy_element));
+  if (capacity > ctx->capacity) {
+    capacity = ctx->capacity;
+  }
+  if ((capacity < (ctx->index + ctx->reserved)) || (nodes > (capacity - ctx->node_count))) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return ctx->status;
+  }
+
+  state.journal = (struct jesy_journal_entry*)(void*)journal;
+  state.journal_capacity = count * JESY_PATCH_JOURNAL_ENTRIES;
+  state.cached_parent = NULL;
+  saved_capacity = ctx->capacity;
+  ctx->capacity = capacity;
+  for (iter = GET_CHILD(patch_ctx, patch); iter; iter = GET_SIBLING(patch_ctx, iter)) {
+    jesy_patch_read_op(patch_ctx, iter, &op, &nodes);
+    ctx->status = jesy_patch_apply_op(&state, &op, patch_ctx);
+    if (ctx->status != JESY_NO_ERR) {
+      break;
+    }
+  }
+  if (ctx->status != JESY_NO_ERR) {
+    uint32_t status = ctx->status;
+    jesy_journal_rollback(&state);
+    ctx->status = status;
+  }
+  else {
+    jesy_journal_commit(&state);
+  }
+  ctx->capacity = saved_capacity;
+  return ctx->status;
+}
+
+/* Open addressing table of object keys. Keys are looked up by their parent
+ * object and name, so a single table serves all the objects of a tree. */
+struct jesy_key_table {
+  jesy_node_descriptor *slots;
+  uint32_t mask;
+};
+
+/* Builds the key table of a subtree in the given scratch memory.
+ * return the size of the used scratch memory in bytes. Zero if it doesn't fit. */
+static size_t jesy_key_table_init(struct jesy_context *ctx, struct jesy_element *root,
+                                  struct jesy_key_table *table, void *scratch, size_t size)
+{
+  struct jesy_element *iter = root;
+  uint32_t keys = 0;
+  uint32_t slots = 2;
+
+  table->slots = NULL;
+  table->mask = 0;
+
+  /* Count the keys to size the table for a load factor of at most 50%. */
+  while (iter) {
+    if (iter->type == JESY_KEY) {
+      keys++;
+    }
+    if (HAS_CHILD(iter)) {
+      iter = &ctx->pool[iter->first_child];
+      continue;
+    }
+    while (iter && (iter != root) && !HAS_SIBLING(iter)) {
+      iter = GET_PARENT(ctx, iter);
+    }
+    iter = (iter && (iter != root)) ? &ctx->pool[iter->sibling] : NULL;
+  }
+  while (slots < (keys * 2)) {
+    slots <<= 1;
+  }
+  if ((keys == 0) || ((slots * sizeof(jesy_node_descriptor)) > size)) {
+    return 0;
+  }
+
+  table->slots = scratch;
+  table->mask = slots - 1;
+  memset(table->slots, 0xFF, slots * sizeof(jesy_node_descriptor));
+
+  iter = root;
+  while (iter) {
+    if (iter->type == JESY_KEY) {
+      uint32_t slot = jesy_key_hash(iter->parent, iter->value, iter->length) & table->mask;
+      while (table->slots[slot] != JESY_INVALID_INDEX) {
+        slot = (slot + 1) & table->mask;
+      }
+      table->slots[slot] = (jesy_node_descriptor)(iter - ctx->pool);
+    }
+    if (HAS_CHILD(iter)) {
+      iter = &ctx->pool[iter->first_child];
+      continue;
+    }
+    while (iter && (iter != root) && !HAS_SIBLING(iter)) {
+      iter = GET_PARENT(ctx, iter);
+    }
+    iter = (iter && (iter != root)) ? &ctx->pool[iter->sibling] : NULL;
+  }
+  return slots * sizeof(jesy_node_descriptor);
+}
+
+static struct jesy_element* jesy_key_table_find(struct jesy_context *ctx, struct jesy_key_table *table,
+                                                struct jesy_element *object, const char *name, uint16_t length)
+{
+  jesy_node_descriptor parent = (jesy_node_descriptor)(object - ctx->pool);
+  uint32_t slot;
+
+  if (!table->slots) {
+    return jesy_find_key(ctx, object, name, length);
+  }
+  slot = jesy_key_hash(parent, name, length) & table->mask;
+  while (table->slots[slot] != JESY_INVALID_INDEX) {
+    struct jesy_element *key = &ctx->pool[table->slots[slot]];
+    if ((key->parent == parent) && (key->length == length) && (0 == memcmp(key->value, name, length))) {
+      return key;
+    }
+    slot = (slot + 1) & table->mask;
+  }
+  return NULL;
+}
+
+/* Checks whether two parsed containers have the same source text. The text
+ * ends with the last descendant, the closing brackets follow implicitly. */
+static bool jesy_same_source(struct jesy_context *ctx_a, struct jesy_element *a,
+                             struct jesy_context *ctx_b, struct jesy_element *b)
+{
+  struct jesy_element *last_a = a;
+  struct jesy_element *last_b = b;
+  size_t length;
+
+  if (!ctx_a->pristine || !ctx_b->pristine || !a->value || !b->value) {
+    return false;
+  }
+  while (HAS_CHILD(last_a)) {
+    last_a = &ctx_a->pool[last_a->last_child];
+  }
+  while (HAS_CHILD(last_b)) {
+    last_b = &ctx_b->pool[last_b->last_child];
+  }
+  length = (size_t)((last_a->value + last_a->length) - a->value);
+  if ((last_a == a) || (last_b == b) ||
+      (length != (size_t)((last_b->value + last_b->length) - b->value))) {
+    return false;
+  }
+  return (a->value == b->value) || (0 == memcmp(a->value, b->value, length));
+}
+
+/* Appends an operation object to the patch array. */
+static uint32_t jesy_diff_emit(struct jesy_context *out_ctx, struct jesy_element *patch, const char *op,
+                               const char *path, uint16_t path_length,
+                               struct jesy_context *ctx_b, struct jesy_element *value)
+{
+  struct jesy_element *object = jesy_append_element(out_ctx, patch, JESY_OBJECT, 0, NULL);
+  struct jesy_element *key;
+  char *copy = jesy_string_alloc(out_ctx, path_length);
+
+  if (!object || !copy) {
+    return out_ctx->status;
+  }
+  memcpy(copy, path, path_length);
+  if (!(key = jesy_append_element(out_ctx, object, JESY_KEY, 2, "op")) ||
+      !jesy_append_element(out_ctx, key, JESY_STRING, (uint16_t)strlen(op), (char*)op) ||
+      !(key = jesy_append_element(out_ctx, object, JESY_KEY, 4, "path")) ||
+      !jesy_append_element(out_ctx, key, JESY_STRING, path_length, copy)) {
+    return out_ctx->status;
+  }
+  if (value) {
+    if (!(key = jesy_append_element(out_ctx, object, JESY_KEY, 5, "value")) ||
+        !jesy_clone(out_ctx, key, ctx_b, value)) {
+      return out_ctx->status;
+    }
+  }
+  return JESY_NO_ERR;
+}
+
+/* Appends a reference token to a JSON pointer. Keys get ~0 and ~1 escaped.
+ * return the new length of the path or zero if it doesn't fit */
+static uint16_t jesy_path_append(char *path, uint16_t length, struct jesy_element *key, uint32_t index)
+{
+  char digits[10];
+  uint16_t count = 0;
+  uint16_t pos;
+
+  if (length >= JESY_MAX_PATH_LENGTH) {
+    return 0;
+  }
+  path[length++] = '/';
+
+  if (!key) {
+    do {
+      digits[count++] = (char)('0' + (index % 10));
+      index /= 10;
+    } while (index);
+    if ((length + count) > JESY_MAX_PATH_LENGTH) {
+      return 0;
+    }
+    while (count) {
+      path[length++] = digits[--count];
+    }
+    return length;
+  }
+
+  for (pos = 0; pos < key->length; pos++) {
+    char c = key->value[pos];
+    if ((length + 2) > JESY_MAX_PATH_LENGTH) {
+      return 0;
+    }
+    if ((c == '~') || (c == '/')) {
+      path[length++] = '~';
+      c = (c == '~') ? '0' : '1';
+    }
+    path[length++] = c;
+  }
+  return length;
+}
+
+uint32_t jesy_diff(struct jesy_context *ctx_a, struct jesy_element *root_a,
+                   struct jesy_context *ctx_b, struct jesy_element *root_b,
+                   struct jesy_context *out_ctx)
+{
+  struct {
+    struct jesy_element *a;
+    struct jesy_element *b;
+    /* Next member of a and b. For objects, b is iterated after a. */
+    struct jesy_element *member_a;
+    struct jesy_element *member_b;
+    uint32_t index;
+    uint16_t path_length;
+  } stack[JESY_MAX_DEPTH];
+  char path[JESY_MAX_PATH_LENGTH];
+  uint16_t path_length = 0;
+  uint32_t depth = 0;
+  struct jesy_key_table table_a;
+  struct jesy_key_table table_b;
+  struct jesy_element *patch;
+  struct jesy_element *a = root_a;
+  struct jesy_element *b = root_b;
+  uint8_t *scratch;
+  uint8_t *scratch_end;
+
+  if (!ctx_a || !ctx_b || !out_ctx || !root_a || !root_b || out_ctx->root ||
+      (out_ctx == ctx_a) || (out_ctx == ctx_b) ||
+      !jesy_validate_element(ctx_a, root_a) || !jesy_validate_element(ctx_b, root_b) ||
+      (root_a->type == JESY_KEY) || (root_b->type == JESY_KEY)) {
+    return JESY_INVALID_PARAMETER;
+  }
+  out_ctx->status = JESY_NO_ERR;
+  patch = jesy_append_element(out_ctx, NULL, JESY_OBJECT, 0, NULL);
+  if (!patch || !(patch = jesy_append_element(out_ctx, patch, JESY_KEY, 5, "patch")) ||
+      !(patch = jesy_append_element(out_ctx, patch, JESY_ARRAY, 0, NULL))) {
+    return out_ctx->status;
+  }
+
+  /* The unused nodes of both pools serve as scratch memory for the key tables. */
+  scratch = (uint8_t*)(ctx_a->pool + ctx_a->index);
+  scratch_end = (uint8_t*)ctx_a->strings;
+  scratch += jesy_key_table_init(ctx_a, root_a, &table_a, scratch, (size_t)(scratch_end - scratch));
+  if (ctx_b != ctx_a) {
+    scratch = (uint8_t*)(ctx_b->pool + ctx_b->index);
+    scratch_end = (uint8_t*)ctx_b->strings;
+  }
+  jesy_key_table_init(ctx_b, root_b, &table_b, scratch, (size_t)(scratch_end - scratch));
+
+  while (true) {
+    /* Compare a and b located at path. */
+    if ((a->type != b->type) ||
+        (((a->type != JESY_OBJECT) && (a->type != JESY_ARRAY)) && !jesy_equal_scalar(a, b))) {
+      if (JESY_NO_ERR != jesy_diff_emit(out_ctx, patch, "replace", path, path_length, ctx_b, b)) {
+        break;
+      }
+    }
+    else if (((a->type == JESY_OBJECT) || (a->type == JESY_ARRAY)) &&
+             !jesy_same_source(ctx_a, a, ctx_b, b)) {
+      if (depth >= JESY_MAX_DEPTH) {
+        out_ctx->status = JESY_MAX_DEPTH_EXCEEDED;
+        break;
+      }
+      stack[depth].a = a;
+      stack[depth].b = b;
+      stack[depth].member_a = GET_CHILD(ctx_a, a);
+      stack[depth].member_b = GET_CHILD(ctx_b, b);
+      stack[depth].index = 0;
+      stack[depth].path_length = path_length;
+      depth++;
+    }
+
+    /* Pick the next pair of values to be compared. Members existing on one
+       side only are handled right away. */
+    a = NULL;
+    while ((depth > 0) && !a && (out_ctx->status == JESY_NO_ERR)) {
+      struct jesy_element *member_a = stack[depth - 1].member_a;
+      struct jesy_element *member_b = stack[depth - 1].member_b;
+      struct jesy_element *added = NULL;
+      bool removed = false;
+      bool fits = true;
+
+      path_length = stack[depth - 1].path_length;
+      if (!member_a && !member_b) {
+        depth--;
+        continue;
+      }
+
+      if (stack[depth - 1].a->type == JESY_ARRAY) {
+        /* Extra items are removed at the position where the shorter array
+           ends, so the index doesn't advance. New items are appended. */
+        if (member_a) {
+          path_length = jesy_path_append(path, path_length, NULL, stack[depth - 1].index);
+          fits = (path_length > 0);
+          a = member_b ? member_a : NULL;
+          b = member_b;
+          removed = !member_b;
+          stack[depth - 1].index += member_b ? 1 : 0;
+          stack[depth - 1].member_a = GET_SIBLING(ctx_a, member_a);
+        }
+        else if ((path_length + 2) <= JESY_MAX_PATH_LENGTH) {
+          path[path_length++] = '/';
+          path[path_length++] = '-';
+          added = member_b;
+        }
+        else {
+          fits = false;
+        }
+        if (member_b) {
+          stack[depth - 1].member_b = GET_SIBLING(ctx_b, member_b);
+        }
+      }
+      else if (member_a) {
+        struct jesy_element *key = jesy_key_table_find(ctx_b, &table_b, stack[depth - 1].b,
+                                                       member_a->value, member_a->length);
+        path_length = jesy_path_append(path, path_length, member_a, 0);
+        fits = (path_length > 0);
+        if (key) {
+          a = GET_CHILD(ctx_a, member_a);
+          b = GET_CHILD(ctx_b, key);
+          if (!a || !b) {
+            out_ctx->status = JESY_UNEXPECTED_NODE;
+          }
+        }
+        removed = !key;
+        stack[depth - 1].member_a = GET_SIBLING(ctx_a, member_a);
+      }
+      else {
+        if (!jesy_key_table_find(ctx_a, &table_a, stack[depth - 1].a, member_b->value, member_b->length)) {
+          path_length = jesy_path_append(path, path_length, member_b, 0);
+          fits = (path_length > 0);
+          added = GET_CHILD(ctx_b, member_b);
+          if (!added) {
+            out_ctx->status = JESY_UNEXPECTED_NODE;
+          }
+        }
+        stack[depth - 1].member_b = GET_SIBLING(ctx_b, member_b);
+      }
+
+      if (!fits) {
+        out_ctx->status = JESY_OUT_OF_MEMORY;
+      }
+      else if (out_ctx->status == JESY_NO_ERR) {
+        if (removed) {
+          jesy_diff_emit(out_ctx, patch, "remove", path, path_length, ctx_b, NULL);
+        }
+        else if (added) {
+          jesy_diff_emit(out_ctx, patch, "add", path, path_length, ctx_b, added);
+        }
+      }
+    }
+    if (!a || (out_ctx->status != JESY_NO_ERR)) {
+      break;
+    }
+  }
+
+  return out_ctx->status;
+}
+
+/* Binary encodings of the node tree. */
+enum jesy_binary_format {
+  JESY_BINARY_CBOR,
+  JESY_BINARY_MSGPACK,
+};
+
+/* Member count of an indefinite length CBOR array or map */
+#define JESY_BINARY_INDEFINITE UINT64_MAX
+
+/* Writes a lead byte followed by the lowest size bytes of value in big-endian order. */
+static void jesy_output_be(struct jesy_output *out, uint8_t lead, uint64_t value, uint32_t size)
+{
+  char bytes[9];
+  uint32_t index;
+
+  bytes[0] = (char)lead;
+  for (index = size; index > 0; index--) {
+    bytes[index] = (char)(value & 0xFF);
+    value >>= 8;
+  }
+  jesy_output_write(out, bytes, size + 1);
+}
+
+/* Writes a CBOR head with the argument in its shortest form. */
+static void jesy_cbor_head(struct jesy_output *out, uint8_t major, uint64_t value)
+{
+  major = (uint8_t)(major << 5);
+  if (value < 24) {
+    jesy_output_be(out, (uint8_t)(major | value), 0, 0);
+  }
+  else if (value <= 0xFF) {
+    jesy_output_be(out, major | 24, value, 1);
+  }
+  else if (value <= 0xFFFF) {
+    jesy_output_be(out, major | 25, value, 2);
+  }
+  else if (value <= 0xFFFFFFFF) {
+    jesy_output_be(out, major | 26, value, 4);
+  }
+  else {
+    jesy_output_be(out, major | 27, value, 8);
+  }
+}
+
+/* Writes the head of an object, an array or a string of the given size. */
+static void jesy_binary_head(struct jesy_output *out, enum jesy_binary_format format,
+                             uint16_t type, uint64_t size)
+{
+  uint8_t fix;
+  uint8_t wide;
+  uint64_t fix_limit;
+
+  if (format == JESY_BINARY_CBOR) {
+    jesy_cbor_head(out, (type == JESY_OBJECT) ? 5 : (type == JESY_ARRAY) ? 4 : 3, size);
+    return;
+  }
+
+  /* MessagePack has a fix, a 16 and a 32 bit form of each, strings also an 8 bit form. */
+  fix = (type == JESY_OBJECT) ? 0x80 : (type == JESY_ARRAY) ? 0x90 : 0xA0;
+  wide = (type == JESY_OBJECT) ? 0xDE : (type == JESY_ARRAY) ? 0xDC : 0xDA;
+  fix_limit = (type == JESY_STRING) ? 32 : 16;
+  if (size < fix_limit) {
+    jesy_output_be(out, (uint8_t)(fix | size), 0, 0);
+  }
+  else if ((type == JESY_STRING) && (size <= 0xFF)) {
+    jesy_output_be(out, 0xD9, size, 1);
+  }
+  else if (size <= 0xFFFF) {
+    jesy_output_be(out, wide, size, 2);
+  }
+  else {
+    jesy_output_be(out, wide + 1, size, 4);
+  }
+}
+
+/* Writes the head and the raw bytes of a string or a key. */
+static void jesy_binary_string(struct jesy_output *out, enum jesy_binary_format format,
+                               struct jesy_element *element)
+{
+  size_t size = jesy_unescape(element->value, element->length, NULL);
+
+  jesy_binary_head(out, format, JESY_STRING, size);
+  if (out->buffer && !out->overflow) {
+    if ((out->offset + size) > out->length) {
+      out->overflow = true;
+      return;
+    }
+    jesy_unescape(element->value, element->length, &out->buffer[out->offset]);
+  }
+  out->offset += size;
+}
+
+static void jesy_binary_number(struct jesy_output *out, enum jesy_binary_format format,
+                               const struct jesy_binary_number *number)
+{
+  uint64_t magnitude = number->magnitude;
+
+  if (!number->integer) {
+    uint64_t bits;
+    memcpy(&bits, &number->real, sizeof(bits));
+    jesy_output_be(out, (format == JESY_BINARY_CBOR) ? 0xFB : 0xCB, bits, 8);
+  }
+  else if (format == JESY_BINARY_CBOR) {
+    jesy_cbor_head(out, number->negative ? 1 : 0, number->negative ? (magnitude - 1) : magnitude);
+  }
+  else if (!number->negative) {
+    if (magnitude < 0x80) {
+      jesy_output_be(out, (uint8_t)magnitude, 0, 0);
+    }
+    else if (magnitude <= 0xFF) {
+      jesy_output_be(out, 0xCC, magnitude, 1);
+    }
+    else if (magnitude <= 0xFFFF) {
+      jesy_output_be(out, 0xCD, magnitude, 2);
+    }
+    else if (magnitude <= 0xFFFFFFFF) {
+      jesy_output_be(out, 0xCE, magnitude, 4);
+    }
+    else {
+      jesy_output_be(out, 0xCF, magnitude, 8);
+    }
+  }
+  else {
+    /* Two's complement of the magnitude, truncated to the chosen width */
+    uint64_t bits = (uint64_t)0 - magnitude;
+    if (magnitude <= 32) {
+      jesy_output_be(out, (uint8_t)bits, 0, 0);
+    }
+    else if (magnitude <= 0x80) {
+      jesy_output_be(out, 0xD0, bits, 1);
+    }
+    else if (magnitude <= 0x8000) {
+      jesy_output_be(out, 0xD1, bits, 2);
+    }
+    else if (magnitude <= 0x80000000) {
+      jesy_output_be(out, 0xD2, bits, 4);
+    }
+    else {
+      jesy_output_be(out, 0xD3, bits, 8);
+    }
+  }
+}
+
+/* Walks the tree like jesy_render_subtree and writes CBOR or MessagePack. Both
+ * encodings prefix the containers with their member count, so there is
+ * nothing to write when a container is left. */
+static size_t jesy_render_binary(struct jesy_context *ctx, struct jesy_output *out,
+                                 enum jesy_binary_format format)
+{
+  struct jesy_element *root = ctx->root;
+  struct jesy_element *iter = root;
+  struct jesy_binary_number number;
+  bool cbor = (format == JESY_BINARY_CBOR);
+
+  while (iter && !out->overflow) {
+    uint16_t parent_type = PARENT_TYPE(ctx, iter);
+
+    /* Objects may only contain keys and keys may only hold a single value. */
+    if (((parent_type == JESY_OBJECT) != (iter->type == JESY_KEY)) ||
+        ((parent_type == JESY_KEY) && HAS_SIBLING(iter))) {
+      ctx->status = JESY_UNEXPECTED_NODE;
+      return 0;
+    }
+
+    switch (iter->type) {
+      case JESY_OBJECT:
+      case JESY_ARRAY:
+        jesy_binary_head(out, format, iter->type, jesy_count_children(ctx, iter));
+        if (HAS_CHILD(iter)) {
+          iter = &ctx->pool[iter->first_child];
+          continue;
+        }
+        break;
+
+      case JESY_KEY:
+        if (!HAS_CHILD(iter)) {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          return 0;
+        }
+        jesy_binary_string(out, format, iter);
+        iter = &ctx->pool[iter->first_child];
+        continue;
+
+      case JESY_STRING:
+        jesy_binary_string(out, format, iter);
+        break;
+
+      case JESY_NUMBER:
+        if (!jesy_read_number(iter, &number)) {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          return 0;
+        }
+        jesy_binary_number(out, format, &number);
+        break;
+
+      case JESY_TRUE:
+        jesy_output_be(out, cbor ? 0xF5 : 0xC3, 0, 0);
+        break;
+
+      case JESY_FALSE:
+        jesy_output_be(out, cbor ? 0xF4 : 0xC2, 0, 0);
+        break;
+
+      case JESY_NULL:
+        jesy_output_be(out, cbor ? 0xF6 : 0xC0, 0, 0);
+        break;
+
+      default:
+        ctx->status = JESY_UNEXPECTED_NODE;
+        return 0;
+    }
+
+    /* The element is completed. Continue with its sibling or climb up. */
+    while (iter) {
+      if (iter == root) {
+        iter = NULL;
+        break;
+      }
+      if (HAS_SIBLING(iter)) {
+        iter = &ctx->pool[iter->sibling];
+        break;
+      }
+      iter = &ctx->pool[iter->parent];
+    }
+  }
+
+  if (out->overflow) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return 0;
+  }
+  return out->offset;
+}
+
+static uint32_t jesy_render_binary_buffer(struct jesy_context *ctx, uint8_t *dst, uint32_t length,
+                                          enum jesy_binary_format format)
+{
+  struct jesy_output out = { (char*)dst, length, 0, false };
+
+  if (!ctx) {
+    return 0;
+  }
+  ctx->status = JESY_NO_ERR;
+  if (!ctx->root) {
+    return 0;
+  }
+  return (uint32_t)jesy_render_binary(ctx, &out, format);
+}
+
+uint32_t jesy_render_cbor(struct jesy_context *ctx, uint8_t *dst, uint32_t length)
+{
+  return jesy_render_binary_buffer(ctx, dst, length, JESY_BINARY_CBOR);
+}
+
+uint32_t jesy_render_msgpack(struct jesy_context *ctx, uint8_t *dst, uint32_t length)
+{
+  return jesy_render_binary_buffer(ctx, dst, length, JESY_BINARY_MSGPACK);
+}
+
+/* Item decoded from a CBOR or MessagePack head. */
+struct jesy_binary_item {
+  /* jesy_type of the item, JESY_NONE for a CBOR break */
+  uint16_t type;
+  bool     real;
+  bool     negative;
+  /* Integer magnitude (minus one if negative), string size or member count */
+  uint64_t value;
+  double   number;
+  /* Bytes of a string */
+  char    *bytes;
+};
+
+/* Reads count bytes in big-endian order.
+ * return false if the data ends before. */
+static bool jesy_read_be(const uint8_t *data, uint32_t size, uint32_t *offset, uint32_t count, uint64_t *value)
+{
+  if ((size - *offset) < count) {
+    return false;
+  }
+  *value = 0;
+  while (count--) {
+    *value = (*value << 8) | data[(*offset)++];
+  }
+  return true;
+}
+
+static double jesy_half_to_double(uint16_t half)
+{
+  int exponent = (half >> 10) & 0x1F;
+  double mantissa = half & 0x3FF;
+  double value;
+
+  if (exponent == 0) {
+    value = ldexp(mantissa, -24);
+  }
+  else if (exponent == 31) {
+    value = (mantissa != 0) ? NAN : INFINITY;
+  }
+  else {
+    value = ldexp(mantissa + 1024, exponent - 25);
+  }
+  return (half & 0x8000) ? -value : value;
+}
+
+/* Reads the real number of the given width in bytes. */
+static bool jesy_read_real(const uint8_t *data, uint32_t size, uint32_t *offset, uint32_t width,
+                           struct jesy_binary_item *item)
+{
+  uint64_t bits;
+
+  if (!jesy_read_be(data, size, offset, width, &bits)) {
+    return false;
+  }
+  item->type = JESY_NUMBER;
+  item->real = true;
+  if (width == 2) {
+    item->number = jesy_half_to_double((uint16_t)bits);
+  }
+  else if (width == 4) {
+    uint32_t narrow = (uint32_t)bits;
+    float single;
+    memcpy(&single, &narrow, sizeof(single));
+    item->number = single;
+  }
+  else {
+    memcpy(&item->number, &bits, sizeof(item->number));
+  }
+  return true;
+}
+
+/* Decodes the next CBOR item. Tags are skipped, the tagged item is taken as it is.
+ * Byte strings, indefinite length strings and simple values other than
+ * false, true and null have no JSON counterpart. */
+static uint32_t jesy_read_cbor(uint8_t *data, uint32_t size, uint32_t *offset, struct jesy_binary_item *item)
+{
+  uint8_t major;
+  uint8_t info;
+  uint64_t value = 0;
+
+  do {
+    if (*offset >= size) {
+      return JESY_UNEXPECTED_EOF;
+    }
+    major = data[*offset] >> 5;
+    info = data[*offset] & 0x1F;
+    (*offset)++;
+    if (info < 24) {
+      value = info;
+    }
+    else if (info <= 27) {
+      if ((major == 7) && (info > 24)) {
+        return jesy_read_real(data, size, offset, 1u << (info - 24), item) ? JESY_NO_ERR : JESY_UNEXPECTED_EOF;
+      }
+      if (!jesy_read_be(data, size, offset, 1u << (info - 24), &value)) {
+        return JESY_UNEXPECTED_EOF;
+      }
+    }
+    else if ((info == 31) && ((major == 4) || (major == 5) || (major == 7))) {
+      value = JESY_BINARY_INDEFINITE;
+    }
+    else {
+      return JESY_UNEXPECTED_TOKEN;
+    }
+  } while (major == 6);
+
+  item->real = false;
+  item->negative = false;
+  item->value = value;
+  switch (major) {
+    case 0:
+      item->type = JESY_NUMBER;
+      break;
+    case 1:
+      item->type = JESY_NUMBER;
+      item->negative = true;
+      break;
+    case 3:
+      if ((size - *offset) < value) {
+        return JESY_UNEXPECTED_EOF;
+      }
+      item->type = JESY_STRING;
+      item->bytes = (char*)&data[*offset];
+      *offset += (uint32_t)value;
+      break;
+    case 4:
+      item->type = JESY_ARRAY;
+      break;
+    case 5:
+      item->type = JESY_OBJECT;
+      break;
+    case 7:
+      if (value == JESY_BINARY_INDEFINITE) {
+        item->type = JESY_NONE;
+      }
+      else if (info == 20) {
+        item->type = JESY_FALSE;
+      }
+      else if (info == 21) {
+        item->type = JESY_TRUE;
+      }
+      else if (info == 22) {
+        item->type = JESY_NULL;
+      }
+      else {
+        return JESY_UNEXPECTED_TOKEN;
+      }
+      break;
+    default:
+      return JESY_UNEXPECTED_TOKEN;
+  }
+  return JESY_NO_ERR;
+}
+
+/* Decodes the next MessagePack item. Binaries and extension types have no
+ * JSON counterpart. */
+static uint32_t jesy_read_msgpack(uint8_t *data, uint32_t size, uint32_t *offset, struct jesy_binary_item *item)
+{
+  uint8_t lead;
+  uint32_t width = 0;
+  bool is_signed = false;
+
+  if (*offset >= size) {
+    return JESY_UNEXPECTED_EOF;
+  }
+  lead = data[(*offset)++];
+  item->real = false;
+  item->negative = false;
+  item->value = 0;
+
+  if (lead <= 0x7F) {
+    item->type = JESY_NUMBER;
+    item->value = lead;
+  }
+  else if (lead <= 0x8F) {
+    item->type = JESY_OBJECT;
+    item->value = lead & 0x0F;
+  }
+  else if (lead <= 0x9F) {
+    item->type = JESY_ARRAY;
+    item->value = lead & 0x0F;
+  }
+  else if (lead <= 0xBF) {
+    item->type = JESY_STRING;
+    item->value = lead & 0x1F;
+  }
+  else if (lead >= 0xE0) {
+    /* Negative fixint: -32 to -1 */
+    item->type = JESY_NUMBER;
+    item->negative = true;
+    item->value = (uint64_t)(0xFF - lead);
+  }
+  else if (lead == 0xC0) {
+    item->type = JESY_NULL;
+  }
+  else if (lead == 0xC2) {
+    item->type = JESY_FALSE;
+  }
+  else if (lead == 0xC3) {
+    item->type = JESY_TRUE;
+  }
+  else if ((lead == 0xCA) || (lead == 0xCB)) {
+    return jesy_read_real(data, size, offset, (lead == 0xCA) ? 4 : 8, item) ? JESY_NO_ERR : JESY_UNEXPECTED_EOF;
+  }
+  else if ((lead >= 0xCC) && (lead <= 0xD3)) {
+    item->type = JESY_NUMBER;
+    is_signed = (lead >= 0xD0);
+    width = 1u << ((lead - 0xCC) & 0x03);
+  }
+  else if ((lead >= 0xD9) && (lead <= 0xDB)) {
+    item->type = JESY_STRING;
+    width = 1u << (lead - 0xD9);
+  }
+  else if ((lead >= 0xDC) && (lead <= 0xDF)) {
+    item->type = (lead <= 0xDD) ? JESY_ARRAY : JESY_OBJECT;
+    width = (lead & 0x01) ? 4 : 2;
+  }
+  else {
+    return JESY_UNEXPECTED_TOKEN;
+  }
+
+  if (width && !jesy_read_be(data, size, offset, width, &item->value)) {
+    return JESY_UNEXPECTED_EOF;
+  }
+  if (is_signed && ((item->value >> ((width * 8) - 1)) & 1)) {
+    /* -1 - value is the complement of the two's complement bits */
+    uint64_t mask = (width == 8) ? UINT64_MAX : ((1ull << (width * 8)) - 1);
+    item->negative = true;
+    item->value = ~item->value & mask;
+  }
+  if (item->type == JESY_STRING) {
+    if ((size - *offset) < item->value) {
+      return JESY_UNEXPECTED_EOF;
+    }
+    item->bytes = (char*)&data[*offset];
+    *offset += (uint32_t)item->value;
+  }
+  return JESY_NO_ERR;
+}
+
+/* Returns the JSON text of a string item. The bytes are referenced in place
+ * unless they need escaping, then an escaped copy is made in the string area. */
+static char* jesy_binary_text(struct jesy_context *ctx, const struct jesy_binary_item *item, uint16_t *length)
+{
+  static const char hex[] = "0123456789abcdef";
+  const uint8_t *bytes = (const uint8_t*)item->bytes;
+  uint64_t size = 0;
+  uint64_t index;
+  char *text;
+  char *dst;
+
+  for (index = 0; (index < item->value) && (size <= 0xFFFF); index++) {
+    size += jesy_escape_letter(bytes[index]) ? 2 : (bytes[index] < 0x20) ? 6 : 1;
+  }
+  if (size > 0xFFFF) {
+    ctx->status = JESY_UNEXPECTED_TOKEN;
+    return NULL;
+  }
+  *length = (uint16_t)size;
+  if (size == item->value) {
+    return item->bytes;
+  }
+
+  text = jesy_string_alloc(ctx, (uint32_t)size);
+  if (!text) {
+    return NULL;
+  }
+  for (dst = text, index = 0; index < item->value; index++) {
+    uint8_t ch = bytes[index];
+    char letter = jesy_escape_letter(ch);
+    if (letter) {
+      *dst++ = '\\';
+      *dst++ = letter;
+    }
+    else if (ch < 0x20) {
+      memcpy(dst, "\\u00", 4);
+      dst[4] = hex[ch >> 4];
+      dst[5] = hex[ch & 0x0F];
+      dst += 6;
+    }
+    else {
+      *dst++ = (char)ch;
+    }
+  }
+  return text;
+}
+
+/* Formats the number of an item as JSON text in the string area. Reals get the
+ * shortest text that reads back to the same value and keep a fraction or an
+ * exponent, so they are rendered as reals again. */
+static char* jesy_binary_number_text(struct jesy_context *ctx, const struct jesy_binary_item *item, uint16_t *length)
+{
+  char text[JESY_NUMBER_TEXT_LEN];
+  char *copy;
+  size_t size;
+
+  if (item->real) {
+    int precision;
+    if (!isfinite(item->number)) {
+      ctx->status = JESY_UNEXPECTED_TOKEN;
+      return NULL;
+    }
+    for (precision = 1; precision < 17; precision++) {
+      snprintf(text, sizeof(text), "%.*g", precision, item->number);
+      if (strtod(text, NULL) == item->number) {
+        break;
+      }
+    }
+    snprintf(text, sizeof(text), "%.*g", precision, item->number);
+    if (!strpbrk(text, ".e")) {
+      strcat(text, ".0");
+    }
+    size = strlen(text);
+  }
+  else if (item->negative && (item->value == UINT64_MAX)) {
+    size = strlen(strcpy(text, "-18446744073709551616"));
+  }
+  else {
+    /* Digits from the end. Negative values are stored as the magnitude minus one. */
+    uint64_t magnitude = item->value + (item->negative ? 1 : 0);
+    char *digit = &text[sizeof(text)];
+    do {
+      *--digit = (char)('0' + (magnitude % 10));
+      magnitude /= 10;
+    } while (magnitude);
+    if (item->negative) {
+      *--digit = '-';
+    }
+    size = (size_t)(&text[sizeof(text)] - digit);
+    memmove(text, digit, size);
+  }
+
+  copy = jesy_string_alloc(ctx, (uint32_t)size);
+  if (copy) {
+    memcpy(copy, text, size);
+    *length = (uint16_t)size;
+  }
+  return copy;
+}
+
+/* Builds the node tree of a CBOR or MessagePack document without recursion.
+ * Containers are tracked on ctx->containers, with the members left to read
+ * next to them. */
+static uint32_t jesy_parse_binary(struct jesy_context *ctx, uint8_t *data, uint32_t length,
+                                  enum jesy_binary_format format)
+{
+  uint64_t remaining[JESY_MAX_DEPTH];
+  struct jesy_element *top = NULL;
+  struct jesy_element *key = NULL;
+  struct jesy_element *node;
+  struct jesy_binary_item item;
+  uint32_t offset = 0;
+  uint16_t value_length;
+  char *value;
+
+  if (!ctx || (!data && length)) {
+    return JESY_INVALID_PARAMETER;
+  }
+  ctx->json_data = (char*)data;
+  ctx->json_size = length;
+  ctx->depth = 0;
+  ctx->status = JESY_NO_ERR;
+
+  do {
+    if (ctx->depth) {
+      top = &ctx->pool[ctx->containers[ctx->depth - 1]];
+      if (remaining[ctx->depth - 1] == 0) {
+        ctx->depth--;
+        continue;
+      }
+    }
+
+    ctx->status = (format == JESY_BINARY_CBOR) ? jesy_read_cbor(data, length, &offset, &item)
+                                               : jesy_read_msgpack(data, length, &offset, &item);
+    if (ctx->status != JESY_NO_ERR) {
+      break;
+    }
+    if (item.type == JESY_NONE) {
+      /* A break closes an indefinite length container. */
+      if (!ctx->depth || key || (remaining[ctx->depth - 1] != JESY_BINARY_INDEFINITE)) {
+        ctx->status = JESY_UNEXPECTED_TOKEN;
+        break;
+      }
+      ctx->depth--;
+      continue;
+    }
+    /* Like in JSON, the root must be an object. */
+    if (!ctx->root && (item.type != JESY_OBJECT)) {
+      ctx->status = JESY_UNEXPECTED_TOKEN;
+      break;
+    }
+
+    if (ctx->depth && (top->type == JESY_OBJECT) && !key) {
+      if (item.type != JESY_STRING) {
+        ctx->status = JESY_UNEXPECTED_TOKEN;
+        break;
+      }
+      if (!(value = jesy_binary_text(ctx, &item, &value_length))) {
+        break;
+      }
+#ifndef JESY_ALLOW_DUPLICATE_KEYS
+      /* Only the last value of a duplicated key is kept. */
+      if ((key = jesy_find_key(ctx, top, value, value_length))) {
+        jesy_delete_element(ctx, jesy_get_child(ctx, key));
+        continue;
+      }
+#endif
+      key = jesy_append_element(ctx, top, JESY_KEY, value_length, value);
+      continue;
+    }
+
+    value = NULL;
+    value_length = 0;
+    if (item.type == JESY_STRING) {
+      value = jesy_binary_text(ctx, &item, &value_length);
+    }
+    else if (item.type == JESY_NUMBER) {
+      value = jesy_binary_number_text(ctx, &item, &value_length);
+    }
+    else if (item.type == JESY_TRUE) {
+      value = "true";
+      value_length = 4;
+    }
+    else if (item.type == JESY_FALSE) {
+      value = "false";
+      value_length = 5;
+    }
+    else if (item.type == JESY_NULL) {
+      value = "null";
+      value_length = 4;
+    }
+    if ((ctx->status != JESY_NO_ERR) ||
+        !(node = jesy_append_element(ctx, key ? key : top, item.type, value_length, value))) {
+      break;
+    }
+    key = NULL;
+    if (ctx->depth && (remaining[ctx->depth - 1] != JESY_BINARY_INDEFINITE)) {
+      remaining[ctx->depth - 1]--;
+    }
+    if ((item.type == JESY_OBJECT) || (item.type == JESY_ARRAY)) {
+      if (ctx->depth >= JESY_MAX_DEPTH) {
+        ctx->status = JESY_MAX_DEPTH_EXCEEDED;
+        break;
+      }
+      remaining[ctx->depth] = item.value;
+      ctx->containers[ctx->depth++] = (jesy_node_descriptor)(node - ctx->pool);
+    }
+  } while ((ctx->depth || !ctx->root) && (ctx->status == JESY_NO_ERR));
+
+  if ((ctx->status == JESY_NO_ERR) && (offset != length)) {
+    ctx->status = JESY_UNEXPECTED_TOKEN;
+  }
+  ctx->offset = offset;
+  ctx->iter = ctx->root;
+  ctx->pristine = false;
+  return ctx->status;
+}
+
+uint32_t jesy_parse_cbor(struct jesy_context *ctx, uint8_t *data, uint32_t length)
+{
+  return jesy_parse_binary(ctx, data, length, JESY_BINARY_CBOR);
+}
+
+uint32_t jesy_parse_msgpack(struct jesy_context *ctx, uint8_t *data, uint32_t length)
+{
+  return jesy_parse_binary(ctx, data, length, JESY_BINARY_MSGPACK);
+}
+
+/* Returns the code point of the UTF-8 sequence at text[*index] and steps over
+ * it. Bytes that don't start a complete sequence are taken as they are. */
+static uint32_t jesy_utf8_decode(const char *text, uint32_t length, uint32_t *index)
+{
+  uint8_t lead = (uint8_t)text[*index];
+  uint32_t size = (lead >= 0xF0) ? 4 : (lead >= 0xE0) ? 3 : (lead >= 0xC0) ? 2 : 1;
+  uint32_t code = (size == 1) ? lead : (lead & (0x3F >> (size - 1)));
+  uint32_t offset;
+
+  if ((*index + size) > length) {
+    size = 1;
+    code = lead;
+  }
+  for (offset = 1; offset < size; offset++) {
+    code = (code << 6) | ((uint8_t)text[*index + offset] & 0x3F);
+  }
+  *index += size;
+  return code;
+}
+
+/* Delivers the UTF-16 code units of an escaped key name one by one. */
+struct jesy_utf16_cursor {
+  const char *text;
+  uint32_t    length;
+  uint32_t    index;
+  uint32_t    low;
+};
+
+/* return the next code unit or -1 at the end of the name */
+static int32_t jesy_utf16_next(struct jesy_utf16_cursor *cursor)
+{
+  uint32_t code;
+
+  if (cursor->low) {
+    code = cursor->low;
+    cursor->low = 0;
+    return (int32_t)code;
+  }
+  if (cursor->index >= cursor->length) {
+    return -1;
+  }
+  if (cursor->text[cursor->index] == '\\') {
+    cursor->index += jesy_unescape_one(cursor->text, cursor->index, cursor->length, &code);
+  }
+  else {
+    code = jesy_utf8_decode(cursor->text, cursor->length, &cursor->index);
+  }
+  if (code >= 0x10000) {
+    code -= 0x10000;
+    cursor->low = 0xDC00 + (code & 0x3FF);
+    code = 0xD800 + (code >> 10);
+  }
+  return (int32_t)code;
+}
+
+/* Compares the names of two keys by their UTF-16 code units as RFC 8785 requires. */
+static int32_t jesy_compare_keys(struct jesy_element *a, struct jesy_element *b)
+{
+  struct jesy_utf16_cursor cursor_a = { a->value, a->length, 0, 0 };
+  struct jesy_utf16_cursor cursor_b = { b->value, b->length, 0, 0 };
+  int32_t unit_a;
+  int32_t unit_b;
+
+  do {
+    unit_a = jesy_utf16_next(&cursor_a);
+    unit_b = jesy_utf16_next(&cursor_b);
+  } while ((unit_a == unit_b) && (unit_a >= 0));
+  return unit_a - unit_b;
+}
+
+/* Sorts the members of an object by their names without recursion (bottom-up
+ * merge sort). Members with equal names keep their order. temp must hold
+ * count descriptors. */
+static void jesy_sort_members(struct jesy_context *ctx, jesy_node_descriptor *members,
+                              jesy_node_descriptor *temp, uint32_t count)
+{
+  jesy_node_descriptor *src = members;
+  jesy_node_descriptor *dst = temp;
+  jesy_node_descriptor *swap;
+  uint32_t width;
+
+  for (width = 1; width < count; width *= 2) {
+    uint32_t start;
+    for (start = 0; start < count; start += 2 * width) {
+      uint32_t left = start;
+      uint32_t middle = ((count - start) > width) ? (start + width) : count;
+      uint32_t right = middle;
+      uint32_t end = ((count - middle) > width) ? (middle + width) : count;
+      uint32_t index;
+      for (index = start; index < end; index++) {
+        if ((right < end) &&
+            ((left >= middle) || (jesy_compare_keys(&ctx->pool[src[right]], &ctx->pool[src[left]]) < 0))) {
+          dst[index] = src[right++];
+        }
+        else {
+          dst[index] = src[left++];
+        }
+      }
+    }
+    swap = src;
+    src = dst;
+    dst = swap;
+  }
+  if (src != members) {
+    memcpy(members, src, count * sizeof(*members));
+  }
+}
+
+/* Writes a string with only the escapes RFC 8785 allows: \" \\ \b \f \n \r \t
+ * and \u00xx for the other control characters. Everything else is raw UTF-8. */
+static void jesy_canonical_string(struct jesy_output *out, const char *src, uint16_t length)
+{
+  static const char hex[] = "0123456789abcdef";
+  uint32_t index = 0;
+
+  jesy_output_char(out, '"');
+  while (index < length) {
+    uint32_t start = index;
+    uint32_t code;
+    char bytes[6];
+
+    while ((index < length) && (src[index] != '\\') && (src[index] != '"') && ((uint8_t)src[index] >= 0x20)) {
+      index++;
+    }
+    jesy_output_write(out, &src[start], index - start);
+    if (index >= length) {
+      break;
+    }
+
+    if (src[index] == '\\') {
+      index += jesy_unescape_one(src, index, length, &code);
+    }
+    else {
+      code = (uint8_t)src[index++];
+    }
+    if ((code < 0x20) || (code == '"') || (code == '\\')) {
+      char letter = jesy_escape_letter((uint8_t)code);
+      if (letter) {
+        bytes[0] = '\\';
+        bytes[1] = letter;
+        jesy_output_write(out, bytes, 2);
+      }
+      else {
+        memcpy(bytes, "\\u00", 4);
+        bytes[4] = hex[code >> 4];
+        bytes[5] = hex[code & 0x0F];
+        jesy_output_write(out, bytes, 6);
+      }
+    }
+    else {
+      jesy_output_write(out, bytes, jesy_utf8_encode(code, bytes));
+    }
+  }
+  jesy_output_char(out, '"');
+}
+
+/* Writes a number the way ECMAScript converts a double to a string, i.e. the
+ * shortest digits that read back to the same double.
+ * return false if the number can't be converted or isn't finite */
+static bool jesy_canonical_number(struct jesy_output *out, struct jesy_element *element)
+{
+  struct jesy_binary_number number;
+  char scientific[JESY_NUMBER_TEXT_LEN];
+  char digits[JESY_NUMBER_TEXT_LEN];
+  char text[JESY_NUMBER_TEXT_LEN];
+  double value;
+  int precision;
+  int exponent;
+  int count = 0;
+  int size = 0;
+  char *iter;
+
+  if (!jesy_read_number(element, &number)) {
+    return false;
+  }
+  value = number.integer ? (double)number.magnitude : number.real;
+  if (number.integer && number.negative) {
+    value = -value;
+  }
+  if (!isfinite(value)) {
+    return false;
+  }
+  if (value == 0) {
+    jesy_output_char(out, '0');
+    return true;
+  }
+  if (value < 0) {
+    jesy_output_char(out, '-');
+    value = -value;
+  }
+
+  for (precision = 1; precision < 17; precision++) {
+    snprintf(scientific, sizeof(scientific), "%.*e", precision - 1, value);
+    if (strtod(scientific, NULL) == value) {
+      break;
+    }
+  }
+  snprintf(scientific, sizeof(scientific), "%.*e", precision - 1, value);
+
+  /* d.ddde[+-]x: collect the digits without trailing zeros, value = 0.digits * 10^exponent */
+  for (iter = scientific; *iter != 'e'; iter++) {
+    if (IS_DIGIT(*iter)) {
+      digits[count++] = *iter;
+    }
+  }
+  exponent = atoi(iter + 1) + 1;
+  while ((count > 1) && (digits[count - 1] == '0')) {
+    count--;
+  }
+
+  if ((count <= exponent) && (exponent <= 21)) {
+    memcpy(text, digits, (size_t)count);
+    memset(&text[count], '0', (size_t)(exponent - count));
+    size = exponent;
+  }
+  else if ((0 < exponent) && (exponent <= 21)) {
+    memcpy(text, digits, (size_t)exponent);
+    text[exponent] = '.';
+    memcpy(&text[exponent + 1], &digits[exponent], (size_t)(count - exponent));
+    size = count + 1;
+  }
+  else if ((-6 < exponent) && (exponent <= 0)) {
+    memcpy(text, "0.", 2);
+    memset(&text[2], '0', (size_t)-exponent);
+    memcpy(&text[2 - exponent], digits, (size_t)count);
+    size = 2 - exponent + count;
+  }
+  else {
+    text[size++] = digits[0];
+    if (count > 1) {
+      text[size++] = '.';
+      memcpy(&text[size], &digits[1], (size_t)(count - 1));
+      size += count - 1;
+    }
+    size += snprintf(&text[size], sizeof(text) - (size_t)size, "e%c%d",
+                     (exponent > 0) ? '+' : '-', abs(exponent - 1));
+  }
+  jesy_output_write(out, text, (size_t)size);
+  return true;
+}
+
+/* Open container of the canonical renderer, stored in the scratch area. */
+struct jesy_canonical_frame {
+  struct jesy_canonical_frame *parent;
+  struct jesy_element *container;
+  /* Members of an object in the order of their names */
+  jesy_node_descriptor *members;
+  uint32_t count;
+  uint32_t next;
+  /* Next member of an array */
+  struct jesy_element *cursor;
+};
+
+/* Walks the tree once and writes (or only counts) the canonical JSON. The
+ * members of each object are sorted in the scratch area, the tree itself is
+ * left untouched. */
+static size_t jesy_render_canonical_tree(struct jesy_context *ctx, struct jesy_output *out)
+{
+  char *scratch = (char*)(ctx->pool + ctx->index);
+  struct jesy_canonical_frame *top = NULL;
+  struct jesy_element *iter = ctx->root;
+
+  while (iter && !out->overflow) {
+    switch (iter->type) {
+      case JESY_OBJECT:
+      case JESY_ARRAY:
+        jesy_output_char(out, iter->type == JESY_OBJECT ? '{' : '[');
+        if (HAS_CHILD(iter)) {
+          struct jesy_canonical_frame *frame = jesy_scratch_alloc(&scratch, ctx->strings, sizeof(*frame));
+          if (!frame) {
+            ctx->status = JESY_OUT_OF_MEMORY;
+            return 0;
+          }
+          frame->parent = top;
+          frame->container = iter;
+          frame->next = 0;
+          frame->cursor = &ctx->pool[iter->first_child];
+          frame->members = NULL;
+          frame->count = 0;
+          if (iter->type == JESY_OBJECT) {
+            struct jesy_element *member;
+            jesy_node_descriptor *temp;
+            frame->count = jesy_count_children(ctx, iter);
+            frame->members = jesy_scratch_alloc(&scratch, ctx->strings, frame->count * sizeof(jesy_node_descriptor));
+            temp = frame->members ? jesy_scratch_alloc(&scratch, ctx->strings, frame->count * sizeof(jesy_node_descriptor)) : NULL;
+            if (!temp) {
+              ctx->status = JESY_OUT_OF_MEMORY;
+              return 0;
+            }
+            for (member = frame->cursor; member; member = GET_SIBLING(ctx, member)) {
+              frame->members[frame->next++] = (jesy_node_descriptor)(member - ctx->pool);
+            }
+            frame->next = 0;
+            jesy_sort_members(ctx, frame->members, temp, frame->count);
+            /* The merge buffer is only needed while sorting. */
+            scratch = (char*)temp;
+          }
+          top = frame;
+        }
+        else {
+          jesy_output_char(out, iter->type == JESY_OBJECT ? '}' : ']');
+        }
+        break;
+
+      case JESY_STRING:
+        jesy_canonical_string(out, iter->value, iter->length);
+        break;
+
+      case JESY_NUMBER:
+        if (!jesy_canonical_number(out, iter)) {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          return 0;
+        }
+        break;
+
+      case JESY_TRUE:
+        jesy_output_write(out, "true", 4);
+        break;
+
+      case JESY_FALSE:
+        jesy_output_write(out, "false", 5);
+        break;
 
-    if (HAS_SIBLING(iter)) {
-      iter = jesy_get_sibling(ctx, iter);
-      *dst++ = ',';
-      continue;
+      case JESY_NULL:
+        jesy_output_write(out, "null", 4);
+        break;
+
+      default:
+        ctx->status = JESY_UNEXPECTED_NODE;
+        return 0;
     }
 
-     while ((iter = jesy_get_parent(ctx, iter))) {
-      if (iter->type == JESY_OBJECT) {
-        *dst++ = '}';
+    /* Continue with the next member of the innermost container or close it. */
+    iter = NULL;
+    while (top && !iter) {
+      struct jesy_element *member;
+      if (top->members ? (top->next >= top->count) : !top->cursor) {
+        jesy_output_char(out, top->container->type == JESY_OBJECT ? '}' : ']');
+        scratch = (char*)top;
+        top = top->parent;
+        continue;
       }
-      else if (iter->type == JESY_ARRAY) {
-        *dst++ = ']';
+      if (top->next++) {
+        jesy_output_char(out, ',');
       }
-      if (HAS_SIBLING(iter)) {
-        iter = jesy_get_sibling(ctx, iter);
-        *dst++ = ',';
-        break;
+      if (top->members) {
+        member = &ctx->pool[top->members[top->next - 1]];
+        /* Objects may only contain keys and keys may only hold a single value. */
+        iter = GET_CHILD(ctx, member);
+        if ((member->type != JESY_KEY) || !iter || HAS_SIBLING(iter)) {
+          ctx->status = JESY_UNEXPECTED_NODE;
+          return 0;
+        }
+        jesy_canonical_string(out, member->value, member->length);
+        jesy_output_char(out, ':');
+      }
+      else {
+        iter = top->cursor;
+        top->cursor = GET_SIBLING(ctx, iter);
       }
     }
   }
 
-  ctx->iter = ctx->root;
-  return dst - buffer;
+  if (out->overflow) {
+    ctx->status = JESY_OUT_OF_MEMORY;
+    return 0;
+  }
+  return out->offset;
 }
 
-struct jesy_element* jesy_get_root(struct jesy_context *ctx)
+uint32_t jesy_render_canonical(struct jesy_context *ctx, char *dst, uint32_t length)
 {
-  if (ctx) {
-    return ctx->root;
+  struct jesy_output out = { dst, length, 0, false };
+
+  if (!ctx || !dst) {
+    return 0;
   }
-  return NULL;
+  ctx->status = JESY_NO_ERR;
+  if (!ctx->root) {
+    return 0;
+  }
+  return (uint32_t)jesy_render_canonical_tree(ctx, &out);
 }
 
+size_t jesy_evaluate_canonical(struct jesy_context *ctx)
+{
+  struct jesy_output out = { NULL, 0, 0, false };
 
-struct jesy_element* jesy_get_key(struct jesy_context *ctx, struct jesy_element *object, char *keys)
+  if (!ctx) {
+    return 0;
+  }
+  ctx->status = JESY_NO_ERR;
+  if (!ctx->root) {
+    return 0;
+  }
+  return jesy_render_canonical_tree(ctx, &out);
+}
+
+/* States of the open containers of a jesy_writer */
+#define JESY_WRITER_OBJECT   0x01
+#define JESY_WRITER_MEMBERS  0x02
+#define JESY_WRITER_KEY      0x04
+
+/* Hands the buffered output over to the sink. */
+static bool jesy_writer_flush(struct jesy_writer *writer)
 {
-  struct jesy_element *key_element = NULL;
-  struct jesy_element *iter = NULL;
-  uint32_t key_len;
-  char *dot;
+  if (writer->offset && !writer->sink(writer->sink_arg, writer->buffer, writer->offset)) {
+    writer->status = JESY_RENDER_FAILED;
+    return false;
+  }
+  writer->offset = 0;
+  return true;
+}
 
-  if (ctx && object && keys && jesy_validate_element(ctx, object)) {
-    if (object->type != JESY_OBJECT) {
-      return NULL;
-    }
-    while (dot = strchr(keys, '.')) {
-      key_len = dot - keys;
-      iter = GET_CHILD(ctx, object);
-      while (iter) {
-        if ((iter->length == key_len) && (0 == memcmp(iter->value, keys, key_len))) {
-          if (iter->type == JESY_KEY) {
-            object = GET_CHILD(ctx, iter);
-            if (object->type != JESY_OBJECT) {
-              return NULL;
-            }
-          }
-          break;
-        }
-        iter = GET_SIBLING(ctx, iter);
+static void jesy_writer_put_slow(struct jesy_writer *writer, const char *src, size_t len)
+{
+  if (!len || writer->status) {
+    return;
+  }
+  if (len > (size_t)(writer->length - writer->offset)) {
+    if (writer->sink) {
+      if (!jesy_writer_flush(writer)) {
+        return;
       }
-      keys = keys + key_len + sizeof(*dot);
-    }
-    key_len = strlen(keys);
-    iter = GET_CHILD(ctx, object);
-    while (iter) {
-      if ((iter->length == key_len) && (0 == memcmp(iter->value, keys, key_len))) {
-        if (iter->type == JESY_KEY) {
-          key_element = iter;
+      if (len > writer->length) {
+        if (!writer->sink(writer->sink_arg, src, len)) {
+          writer->status = JESY_RENDER_FAILED;
+          return;
         }
-        break;
+        writer->size += len;
+        return;
       }
-      iter = GET_SIBLING(ctx, iter);
+    }
+    else if (writer->buffer) {
+      writer->status = JESY_OUT_OF_MEMORY;
+      return;
+    }
+    else {
+      /* Only counting */
+      writer->size += len;
+      return;
     }
   }
-  return key_element;
+  memcpy(&writer->buffer[writer->offset], src, len);
+  writer->offset += (uint32_t)len;
+  writer->size += len;
 }
 
-struct jesy_element* jesy_get_key_value(struct jesy_context *ctx, struct jesy_element *object, char *keys)
+/* Copies into the buffer directly as long as it has room, anything else is
+ * left to jesy_writer_put_slow. */
+static inline void jesy_writer_put(struct jesy_writer *writer, const char *src, size_t len)
 {
-  struct jesy_element *value_element = NULL;
-  struct jesy_element *key = jesy_get_key(ctx, object, keys);
-  if (key) {
-    value_element = GET_CHILD(ctx, key);
+  if (!writer->status && (len <= (size_t)(writer->length - writer->offset)) && writer->buffer) {
+    memcpy(&writer->buffer[writer->offset], src, len);
+    writer->offset += (uint32_t)len;
+    writer->size += len;
+  }
+  else {
+    jesy_writer_put_slow(writer, src, len);
   }
-  return value_element;
 }
 
-struct jesy_element* jesy_get_array_value(struct jesy_context *ctx, struct jesy_element *array, int16_t index)
+static inline void jesy_writer_char(struct jesy_writer *writer, char ch)
 {
-  struct jesy_element *iter = NULL;
-  if (ctx && array && jesy_validate_element(ctx, array)) {
-    if (array->type != JESY_ARRAY) {
-      return NULL;
+  if (!writer->status && (writer->offset < writer->length) && writer->buffer) {
+    writer->buffer[writer->offset++] = ch;
+    writer->size++;
+  }
+  else {
+    jesy_writer_put_slow(writer, &ch, 1);
+  }
+}
+
+static void jesy_writer_break(struct jesy_writer *writer)
+{
+  char indent[16];
+  size_t remaining = (size_t)writer->format->indent * writer->depth;
+
+  jesy_writer_put(writer, writer->format->newline, writer->newline_length);
+  memset(indent, writer->format->indent_char, sizeof(indent));
+  while (remaining) {
+    size_t len = remaining < sizeof(indent) ? remaining : sizeof(indent);
+    jesy_writer_put(writer, indent, len);
+    remaining -= len;
+  }
+}
+
+/* Writes the separator of a new member or element of the innermost container. */
+static void jesy_writer_separate(struct jesy_writer *writer, uint8_t *level)
+{
+  if (*level & JESY_WRITER_MEMBERS) {
+    jesy_writer_char(writer, ',');
+    if (!writer->newline_length && writer->format->space_after_comma) {
+      jesy_writer_char(writer, ' ');
     }
+  }
+  if (writer->newline_length) {
+    jesy_writer_break(writer);
+  }
+  *level |= JESY_WRITER_MEMBERS;
+}
 
-    if (index >= 0) {
-      iter = HAS_CHILD(array) ? &ctx->pool[array->first_child] : NULL;
-      for (; iter && index > 0; index--) {
-        iter = HAS_SIBLING(iter) ? &ctx->pool[iter->sibling] : NULL;
-      }
+/* Checks that a value may follow and writes its separator.
+ * return false if the value is not allowed */
+static bool jesy_writer_value(struct jesy_writer *writer)
+{
+  uint8_t *level;
+
+  if (writer->status) {
+    return false;
+  }
+  if (!writer->depth) {
+    if (writer->done) {
+      writer->status = JESY_UNEXPECTED_NODE;
+      return false;
     }
+    return true;
   }
-  return iter;
+
+  level = &writer->levels[writer->depth - 1];
+  if (*level & JESY_WRITER_OBJECT) {
+    if (!(*level & JESY_WRITER_KEY)) {
+      writer->status = JESY_UNEXPECTED_NODE;
+      return false;
+    }
+    *level &= (uint8_t)~JESY_WRITER_KEY;
+  }
+  else {
+    jesy_writer_separate(writer, level);
+  }
+  return true;
 }
 
-struct jesy_element* jesy_add_element(struct jesy_context *ctx, struct jesy_element *parent, enum jesy_type type, uint16_t length, char *value)
+static void jesy_writer_escaped(struct jesy_writer *writer, const char *src)
 {
-  if (!ctx) {
-    ctx->status = JESY_INVALID_PARAMETER;
-    return NULL;
+  const uint8_t *iter = (const uint8_t*)src;
+
+  jesy_writer_char(writer, '"');
+  while (*iter) {
+    const uint8_t *start = iter;
+    char escape[6];
+
+    while (!jesy_escape_special[*iter]) {
+      iter++;
+    }
+    jesy_writer_put(writer, (const char*)start, (size_t)(iter - start));
+    if (!*iter) {
+      break;
+    }
+    jesy_writer_put(writer, escape, jesy_escape_char(*iter, escape));
+    iter++;
   }
+  jesy_writer_char(writer, '"');
+}
 
-  if (!parent && ctx->root) { /* JSON is not empty. Invalid request. */
-    ctx->status = JESY_INVALID_PARAMETER;
-    return NULL;
+static uint32_t jesy_writer_scalar(struct jesy_writer *writer, const char *text, size_t len)
+{
+  if (jesy_writer_value(writer)) {
+    jesy_writer_put(writer, text, len);
+    writer->done = !writer->depth;
+  }
+  return writer->status;
+}
+
+static uint32_t jesy_writer_begin(struct jesy_writer *writer, uint8_t level)
+{
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (jesy_writer_value(writer)) {
+    if (writer->depth >= JESY_MAX_DEPTH) {
+      writer->status = JESY_MAX_DEPTH_EXCEEDED;
+      return writer->status;
+    }
+    jesy_writer_char(writer, (level & JESY_WRITER_OBJECT) ? '{' : '[');
+    writer->levels[writer->depth++] = level;
   }
+  return writer->status;
+}
 
-  if (parent && !jesy_validate_element(ctx, parent)) {
-    ctx->status = JESY_INVALID_PARAMETER;
-    return NULL;
+static uint32_t jesy_writer_end(struct jesy_writer *writer, uint8_t type)
+{
+  uint8_t level;
+
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
   }
-  return jesy_append_element(ctx, parent, type, length, value);
+  if (writer->status) {
+    return writer->status;
+  }
+  level = writer->depth ? writer->levels[writer->depth - 1] : 0;
+  if (!writer->depth || ((level & JESY_WRITER_OBJECT) != type) || (level & JESY_WRITER_KEY)) {
+    writer->status = JESY_UNEXPECTED_NODE;
+    return writer->status;
+  }
+  writer->depth--;
+  if ((level & JESY_WRITER_MEMBERS) && writer->newline_length) {
+    jesy_writer_break(writer);
+  }
+  jesy_writer_char(writer, type ? '}' : ']');
+  writer->done = !writer->depth;
+  return writer->status;
 }
 
-struct jesy_element* jesy_add_object(struct jesy_context *ctx, struct jesy_element *parent)
+void jesy_writer_init(struct jesy_writer *writer, char *buffer, uint32_t length,
+                      const struct jesy_format *format)
 {
-  return jesy_add_element(ctx, parent, JESY_OBJECT, 0, NULL);
+  static const struct jesy_format compact = { NULL, 0, ' ', false, false };
+
+  if (!writer) {
+    return;
+  }
+  memset(writer, 0, sizeof(*writer));
+  writer->buffer = buffer;
+  writer->length = buffer ? length : 0;
+  writer->format = format ? format : &compact;
+  writer->newline_length = writer->format->newline ? strlen(writer->format->newline) : 0;
+  writer->status = JESY_NO_ERR;
 }
 
-struct jesy_element* jesy_add_array(struct jesy_context *ctx, struct jesy_element *parent)
+void jesy_writer_set_sink(struct jesy_writer *writer, jesy_writer_sink sink, void *arg)
 {
-  return jesy_add_element(ctx, parent, JESY_ARRAY, 0, NULL);
+  if (writer) {
+    writer->sink = sink;
+    writer->sink_arg = arg;
+  }
 }
 
-struct jesy_element* jesy_add_key(struct jesy_context *ctx, struct jesy_element *parent, char *key)
+uint32_t jesy_writer_begin_object(struct jesy_writer *writer)
 {
-  return jesy_add_element(ctx, parent, JESY_KEY, (uint16_t)strnlen(key, 0xFFFF), key);
+  return jesy_writer_begin(writer, JESY_WRITER_OBJECT);
 }
 
-struct jesy_element* jesy_add_value(struct jesy_context *ctx, struct jesy_element *parent, enum jesy_type type, char *value)
+uint32_t jesy_writer_end_object(struct jesy_writer *writer)
 {
-  return jesy_add_element(ctx, parent, type, (uint16_t)strnlen(value, 0xFFFF), value);
+  return jesy_writer_end(writer, JESY_WRITER_OBJECT);
 }
 
-struct jesy_element* jesy_add_value_string(struct jesy_context *ctx, struct jesy_element *parent, char *value)
+uint32_t jesy_writer_begin_array(struct jesy_writer *writer)
 {
-  return jesy_add_value(ctx, parent, JESY_STRING, value);
+  return jesy_writer_begin(writer, 0);
 }
 
-struct jesy_element* jesy_add_value_number(struct jesy_context *ctx, struct jesy_element *parent, char *value)
+uint32_t jesy_writer_end_array(struct jesy_writer *writer)
 {
-  return jesy_add_value(ctx, parent, JESY_NUMBER, value);
+  return jesy_writer_end(writer, 0);
 }
 
-struct jesy_element* jesy_add_value_true(struct jesy_context *ctx, struct jesy_element *parent)
+uint32_t jesy_writer_key(struct jesy_writer *writer, const char *key)
 {
-  return jesy_add_value(ctx, parent, JESY_TRUE, "true");
+  uint8_t *level;
+
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (writer->status) {
+    return writer->status;
+  }
+  if (!key) {
+    writer->status = JESY_INVALID_PARAMETER;
+    return writer->status;
+  }
+  level = writer->depth ? &writer->levels[writer->depth - 1] : NULL;
+  if (!level || !(*level & JESY_WRITER_OBJECT) || (*level & JESY_WRITER_KEY)) {
+    writer->status = JESY_UNEXPECTED_NODE;
+    return writer->status;
+  }
+  jesy_writer_separate(writer, level);
+  jesy_writer_escaped(writer, key);
+  jesy_writer_put(writer, ": ", writer->format->space_after_colon ? 2 : 1);
+  *level |= JESY_WRITER_KEY;
+  return writer->status;
 }
 
-struct jesy_element* jesy_add_value_false(struct jesy_context *ctx, struct jesy_element *parent)
+uint32_t jesy_writer_string(struct jesy_writer *writer, const char *value)
 {
-  return jesy_add_value(ctx, parent, JESY_FALSE, "false");
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (!value && !writer->status) {
+    writer->status = JESY_INVALID_PARAMETER;
+  }
+  if (jesy_writer_value(writer)) {
+    jesy_writer_escaped(writer, value);
+    writer->done = !writer->depth;
+  }
+  return writer->status;
 }
 
-struct jesy_element* jesy_add_value_null(struct jesy_context *ctx, struct jesy_element *parent)
+uint32_t jesy_writer_number(struct jesy_writer *writer, const char *value)
 {
-  return jesy_add_value(ctx, parent, JESY_NULL, "null");
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if ((!value || !*value) && !writer->status) {
+    writer->status = JESY_INVALID_PARAMETER;
+  }
+  return jesy_writer_scalar(writer, value, writer->status ? 0 : strlen(value));
 }
 
-uint32_t jesy_update_key(struct jesy_context *ctx, struct jesy_element *key, char *new)
+uint32_t jesy_writer_uint(struct jesy_writer *writer, uint64_t value)
 {
-  uint32_t result = JESY_INVALID_PARAMETER;
+  char text[JESY_NUMBER_TEXT_LEN];
+  char *iter = &text[sizeof(text)];
 
-  if (ctx && key && jesy_validate_element(ctx, key)) {
-    if (key->type == JESY_KEY) {
-      size_t key_len = strlen(new);
-      if (key_len < 65535) {
-        key->length = key_len;
-        key->value = new;
-        result = JESY_NO_ERR;
-      }
-    }
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
   }
-  return result;
+  do {
+    *--iter = (char)('0' + (value % 10));
+    value /= 10;
+  } while (value);
+  return jesy_writer_scalar(writer, iter, (size_t)(&text[sizeof(text)] - iter));
 }
 
-uint32_t jesy_update_key_value(struct jesy_context *ctx, struct jesy_element *object, char *keys, enum jesy_type type, char *value)
+uint32_t jesy_writer_int(struct jesy_writer *writer, int64_t value)
 {
-  uint32_t result = JESY_INVALID_PARAMETER;
+  char text[JESY_NUMBER_TEXT_LEN];
+  char *iter = &text[sizeof(text)];
+  uint64_t magnitude = (value < 0) ? (0 - (uint64_t)value) : (uint64_t)value;
 
-  struct jesy_element *key = jesy_get_key(ctx, object, keys);
-  if (key) {
-    jesy_delete_element(ctx, GET_CHILD(ctx, key));
-    if (jesy_add_value(ctx, key, type, value)) {
-      result = JESY_NO_ERR;
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  do {
+    *--iter = (char)('0' + (magnitude % 10));
+    magnitude /= 10;
+  } while (magnitude);
+  if (value < 0) {
+    *--iter = '-';
+  }
+  return jesy_writer_scalar(writer, iter, (size_t)(&text[sizeof(text)] - iter));
+}
+
+uint32_t jesy_writer_double(struct jesy_writer *writer, double value)
+{
+  char text[JESY_NUMBER_TEXT_LEN];
+  int precision;
+  int len = 0;
+
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (!isfinite(value)) {
+    if (!writer->status) {
+      writer->status = JESY_INVALID_PARAMETER;
     }
-    else {
-      result = ctx->status;
+    return writer->status;
+  }
+  /* Use the shortest representation that converts back to the same value. */
+  for (precision = 15; precision <= 17; precision++) {
+    len = snprintf(text, sizeof(text), "%.*g", precision, value);
+    if (strtod(text, NULL) == value) {
+      break;
     }
   }
-  return result;
+  return jesy_writer_scalar(writer, text, (size_t)len);
 }
 
-uint32_t jesy_update_array_value(struct jesy_context *ctx, struct jesy_element *array, int16_t index, enum jesy_type type, char *value)
+uint32_t jesy_writer_bool(struct jesy_writer *writer, bool value)
 {
-  uint32_t result = JESY_ELEMENT_NOT_FOUND;
-  struct jesy_element *value_element = jesy_get_array_value(ctx, array, index);
-  if (value_element) {
-    while (HAS_CHILD(value_element)) {
-      jesy_delete_element(ctx, GET_CHILD(ctx, value_element));
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  return value ? jesy_writer_scalar(writer, "true", sizeof("true") - 1)
+               : jesy_writer_scalar(writer, "false", sizeof("false") - 1);
+}
+
+uint32_t jesy_writer_null(struct jesy_writer *writer)
+{
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  return jesy_writer_scalar(writer, "null", sizeof("null") - 1);
+}
+
+uint32_t jesy_writer_finish(struct jesy_writer *writer)
+{
+  if (!writer) {
+    return JESY_INVALID_PARAMETER;
+  }
+  if (writer->status) {
+    return writer->status;
+  }
+  if (!writer->done) {
+    writer->status = JESY_UNEXPECTED_EOF;
+    return writer->status;
+  }
+  if (writer->sink) {
+    jesy_writer_flush(writer);
+  }
+  return writer->status;
+}
+
+#ifdef JESY_ENABLE_KEY_IDS
+uint16_t jesy_get_key_id(struct jesy_context *ctx, const char *name, uint16_t length)
+{
+  if (!ctx || !name) {
+    return JESY_INVALID_KEY_ID;
+  }
+  return jesy_key_id(ctx, name, length, false);
+}
+
+uint16_t jesy_get_key_id_count(struct jesy_context *ctx)
+{
+  return ctx ? ctx->key_id_count : 0;
+}
+
+const char* jesy_get_key_name(struct jesy_context *ctx, uint16_t key_id, uint16_t *length)
+{
+  if (!ctx || (key_id >= ctx->key_id_count)) {
+    return NULL;
+  }
+  if (length) {
+    *length = ctx->key_name_lengths[key_id];
+  }
+  return ctx->key_names[key_id];
+}
+
+struct jesy_element* jesy_get_key_by_id(struct jesy_context *ctx, struct jesy_element *object, uint16_t key_id)
+{
+  struct jesy_element *iter;
+
+  if (!ctx || !object || !jesy_validate_element(ctx, object) ||
+      (object->type != JESY_OBJECT) || (key_id == JESY_INVALID_KEY_ID)) {
+    return NULL;
+  }
+  for (iter = GET_CHILD(ctx, object); iter; iter = GET_SIBLING(ctx, iter)) {
+    if (iter->key_id == key_id) {
+      return iter;
     }
-    value_element->type = type;
-    value_element->length = (uint16_t)strnlen(value, 0xFFFF);
-    value_element->value = value;
-    result = JESY_NO_ERR;
   }
-  return result;
-}
\ No newline at end of file
+  return NULL;
+}
+#endif
+
+#ifdef JESY_ENABLE_STATS
+uint32_t jesy_get_stats(struct jesy_context *ctx, struct jesy_stats *stats, bool reset)
+{
+  if (!ctx || !stats) {
+    return JESY_INVALID_PARAMETER;
+  }
+  *stats = ctx->stats;
+  if (reset) {
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    ctx->stats.pool_high_water = ctx->node_count;
+  }
+  return JESY_NO_ERR;
+}
+#endif
@@ -2,6 +2,7 @@
 #define JESY_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef NDEBUG
@@ -25,6 +26,93 @@
 
 //#define JESY_USE_32BIT_NODE_DESCRIPTOR
 
+/* Uncomment to let jesy_add_key, jesy_add_value* and the update functions copy
+ * their strings into the string area at the end of the node pool, so the
+ * caller's buffers don't need to outlive the context. Key names are interned:
+ * equal names share a single copy. The copies are only released by
+ * jesy_init_context, so deleting elements doesn't give the space back.
+ */
+//#define JESY_USE_STRING_ARENA
+
+/* Uncomment to collect counters of the parser, allocator and renderer in the
+ * context. See jesy_get_stats. When left disabled, no counting code is compiled.
+ * Cycle counts use JESY_CYCLE_COUNTER(), which defaults to the time stamp
+ * counter on x86 and can be defined to any 64-bit tick source.
+ */
+//#define JESY_ENABLE_STATS
+
+/* Uncomment to assign a small integer ID to every distinct key name. The IDs
+ * are kept in a dictionary in the context and stored in the key elements, so
+ * key lookups compare integers instead of strings. Names beyond JESY_MAX_KEY_IDS
+ * get JESY_INVALID_KEY_ID and are compared as strings.
+ */
+//#define JESY_ENABLE_KEY_IDS
+
+/* Uncomment to build jesy_parse_parallel and jesy_render_parallel, which
+ * process large documents on several POSIX threads. Link with -lpthread.
+ */
+//#define JESY_ENABLE_THREADS
+
+/* Uncomment to cache the result of jesy_hash in every node. Modifications drop
+ * the cached hashes of the modified node and its ancestors only, so rehashing
+ * a mostly unchanged document visits the changed paths alone. Each node grows
+ * by 8 bytes.
+ */
+//#define JESY_ENABLE_HASH_CACHE
+
+/* Uncomment to build jesy_render_iov and jesy_render_next_iov, which describe
+ * the rendered JSON as a struct iovec list for writev. Requires <sys/uio.h>.
+ */
+//#define JESY_ENABLE_IOVEC
+
+#ifdef JESY_ENABLE_IOVEC
+  #include <sys/uio.h>
+#endif
+
+/* Upper limit of the threads used by jesy_parse_parallel and jesy_render_parallel. */
+#ifndef JESY_MAX_THREADS
+  #define JESY_MAX_THREADS 16
+#endif
+
+/* jesy_render_parallel cuts the split containers into about this many chunks
+ * per thread, so threads finishing early pick up the remaining work. */
+#ifndef JESY_RENDER_CHUNKS_PER_THREAD
+  #define JESY_RENDER_CHUNKS_PER_THREAD 4
+#endif
+
+/* Maximum number of containers split by jesy_render_parallel. Three chunk
+ * records of 40 bytes per container are kept on the stack. */
+#ifndef JESY_MAX_RENDER_CHUNKS
+  #define JESY_MAX_RENDER_CHUNKS 64
+#endif
+
+/* Capacity of the key name dictionary. Each entry costs a pointer and 6 bytes
+ * in jesy_context, e.g. 14 bytes on 64-bit targets and 896 bytes for 64 IDs. */
+#ifndef JESY_MAX_KEY_IDS
+  #define JESY_MAX_KEY_IDS 64
+#endif
+
+#define JESY_INVALID_KEY_ID 0xFFFF
+
+/* Number of hash buckets for the interned key names. */
+#ifndef JESY_KEY_BUCKETS
+  #define JESY_KEY_BUCKETS 32
+#endif
+
+/* Maximum nesting level of objects and arrays. The parser keeps a stack of the
+ * open containers in the context, so each level costs one node descriptor in
+ * jesy_context and one byte of stack in jesy_check and jesy_minify. Deeper
+ * documents are rejected with JESY_MAX_DEPTH_EXCEEDED.
+ */
+#ifndef JESY_MAX_DEPTH
+  #define JESY_MAX_DEPTH 64
+#endif
+
+/* Maximum length of a JSON pointer generated by jesy_diff. */
+#ifndef JESY_MAX_PATH_LENGTH
+  #define JESY_MAX_PATH_LENGTH 256
+#endif
+
 typedef enum jesy_status {
   JESY_NO_ERR = 0,
   JESY_PARSING_FAILED,
@@ -35,6 +123,9 @@ typedef enum jesy_status {
   JESY_UNEXPECTED_EOF,
   JESY_INVALID_PARAMETER,
   JESY_ELEMENT_NOT_FOUND,
+  JESY_MAX_DEPTH_EXCEEDED,
+  JESY_PATCH_TEST_FAILED,
+  JESY_IN_PROGRESS,
 } jesy_status;
 
 enum jesy_token_type {
@@ -70,16 +161,20 @@ enum jesy_type {
 /* A 32bit node descriptor limits the total number of nodes to 4294967295.
    Note that 0xFFFFFFFF is used as an invalid node index. */
 typedef uint32_t jesy_node_descriptor;
+#define JESY_INVALID_INDEX 0xFFFFFFFF
 #else
 /* A 16bit node descriptor limits the total number of nodes to 65535.
    Note that 0xFFFF is used as an invalid node index. */
 typedef uint16_t jesy_node_descriptor;
+#define JESY_INVALID_INDEX 0xFFFF
 #endif
 
 struct jesy_free_node {
   struct jesy_free_node *next;
 };
 
+struct jesy_interned_key;
+
 /* An element is a TLV with additional members to track the its position in the
    JSON tree. */
 struct jesy_element {
@@ -87,6 +182,11 @@ struct jesy_element {
   uint16_t type;
   /* Length of value */
   uint16_t length;
+#ifdef JESY_ENABLE_KEY_IDS
+  /* Dictionary ID of a key name, JESY_INVALID_KEY_ID for other elements.
+     It occupies the padding before value on 64-bit targets. */
+  uint16_t key_id;
+#endif
   /* Value of element */
   char    *value;
   /* Index of the parent node. Each node holds the index of its parent. */
@@ -100,6 +200,26 @@ struct jesy_element {
      actual value of the node. See jesy.h */
   /* Index */
   jesy_node_descriptor last_child;
+#ifdef JESY_ENABLE_HASH_CACHE
+  /* Hash of the subtree computed by jesy_hash, zero if unknown */
+  uint64_t hash;
+#endif
+};
+
+/* Describes the layout of a rendered JSON. See jesy_render_format. */
+struct jesy_format {
+  /* Line break to be emitted before each member, element and closing bracket
+     of non-empty objects and arrays, e.g. "\n" or "\r\n". NULL or "" keeps the
+     whole JSON on a single line. */
+  const char *newline;
+  /* Number of indentation symbols per nesting level. Only used with line breaks. */
+  uint8_t     indent;
+  /* Indentation symbol, usually ' ' or '\t'. */
+  char        indent_char;
+  /* Emit a space after each ':' */
+  bool        space_after_colon;
+  /* Emit a space after each ','. Ignored if line breaks are enabled. */
+  bool        space_after_comma;
 };
 
 struct jesy_token {
@@ -108,6 +228,26 @@ struct jesy_token {
   uint32_t offset;
 };
 
+/* Counters collected with JESY_ENABLE_STATS */
+struct jesy_stats {
+  /* Tokens delivered by the tokenizer */
+  uint32_t tokens;
+  /* Nodes handed out by the allocator and those of them taken from the free list */
+  uint32_t nodes_allocated;
+  uint32_t free_list_hits;
+  /* Nodes given back to the allocator */
+  uint32_t nodes_freed;
+  /* Highest number of nodes in use at the same time */
+  uint32_t pool_high_water;
+  /* Deepest nesting of objects and arrays seen by the parser */
+  uint32_t max_depth;
+  /* Bytes written by jesy_render and jesy_render_format */
+  uint64_t bytes_rendered;
+  /* Ticks of JESY_CYCLE_COUNTER() spent in jesy_parse and in the render functions */
+  uint64_t parse_cycles;
+  uint64_t render_cycles;
+};
+
 struct jesy_context {
   uint32_t status;
   /* Number of nodes in the current JSON */
@@ -133,6 +273,11 @@ struct jesy_context {
   jesy_node_descriptor  index;
   /* Holds the last token delivered by tokenizer. */
   struct jesy_token token;
+  /* Number of currently open objects and arrays while parsing. */
+  uint16_t  depth;
+  /* Indices of the open objects and arrays while parsing. The innermost one is
+     on top, so closing a container or a ',' doesn't need to climb the tree. */
+  jesy_node_descriptor containers[JESY_MAX_DEPTH];
   /* Internal node iterator */
   struct jesy_element *iter;
   /* Holds the main object node */
@@ -140,6 +285,35 @@ struct jesy_context {
   /* Singly Linked list of freed nodes. This way the deleted nodes can be recycled
      by the allocator. */
   struct jesy_free_node *free;
+  /* Lower end of the string area. Generated strings are allocated from the end
+     of the pool downwards, shrinking the node capacity. */
+  char *strings;
+  /* Number of nodes set aside by jesy_reserve. They are allocated in a row
+     behind index and the string area can't grow into them. */
+  uint32_t reserved;
+#ifdef JESY_ENABLE_KEY_IDS
+  /* Distinct key names in the order of their appearance. The index is the ID.
+     The lengths are kept apart to avoid padding behind each pointer. */
+  const char *key_names[JESY_MAX_KEY_IDS];
+  uint16_t key_name_lengths[JESY_MAX_KEY_IDS];
+  uint16_t key_id_count;
+  /* Open addressing table of key ID + 1. Zero marks an empty slot. */
+  uint16_t key_id_slots[JESY_MAX_KEY_IDS * 2];
+#endif
+#ifdef JESY_USE_STRING_ARENA
+  /* Chains of interned key names in the string area */
+  struct jesy_interned_key *keys[JESY_KEY_BUCKETS];
+#endif
+#ifdef JESY_ENABLE_STATS
+  struct jesy_stats stats;
+#endif
+  /* True while the tree exactly mirrors json_data, i.e. after a successful
+     jesy_parse and before any modification. */
+  bool pristine;
+#ifdef JESY_ENABLE_HASH_CACHE
+  /* Whether the cached hashes ignore the order of object members */
+  bool hash_unordered;
+#endif
 };
 
 /* Initialize a new JESy context. The context contains the required data for both
@@ -162,6 +336,96 @@ struct jesy_context* jesy_init_context(void *mem_pool, uint32_t pool_size);
  */
 uint32_t jesy_parse(struct jesy_context* ctx, char *json_data, uint32_t json_length);
 
+/* Maximum number of paths given to jesy_parse_projection. */
+#define JESY_MAX_PROJECTION_PATHS 32
+
+/* Parses only the parts of a JSON selected by a set of paths. Values that no
+ * path leads to are skipped by a scan that only follows quotes and brackets,
+ * so neither nodes nor tokens are spent on them.
+ * param [in] ctx is an initialized context
+ * param [in] json_data in form of string no need to be NUL terminated.
+ * param [in] json_length is the size of json to be parsed.
+ * param [in] paths key names separated with a dot ".", like in jesy_get_key.
+ *            The value of a matching key is kept as a whole. Arrays on the
+ *            way are transparent: "items.id" selects the id key of each
+ *            object in the items array.
+ * param [in] path_count number of paths, at most JESY_MAX_PROJECTION_PATHS.
+ *
+ * return status of the parsing process see: enum jesy_status
+ *
+ * note: The tree holds the selected keys with the objects and arrays leading
+ *       to them. Containers without any selected value are dropped. Skipped
+ *       values are only checked for balanced quotes and brackets.
+ */
+uint32_t jesy_parse_projection(struct jesy_context* ctx, char *json_data, uint32_t json_length,
+                               const char *const *paths, uint32_t path_count);
+
+/* Starts an incremental parse. The JSON is parsed by repeated calls of
+ * jesy_parse_step, so a large document can be spread over several iterations
+ * of a loop. The resulting tree is identical to the one of jesy_parse.
+ * param [in] ctx is an initialized context
+ * param [in] json_data in form of string no need to be NUL terminated.
+ * param [in] json_length is the size of json to be parsed.
+ *
+ * return JESY_IN_PROGRESS or a status code of type enum jesy_status in case of a failure.
+ *
+ * note: The JSON data must not be modified until the parse is completed.
+ */
+uint32_t jesy_parse_begin(struct jesy_context* ctx, char *json_data, uint32_t json_length);
+
+/* Continues a parse started by jesy_parse_begin for a bounded amount of work.
+ * param [in] ctx the context
+ * param [in] max_tokens number of steps of the parser state machine to run.
+ *            A step consumes one to four tokens, i.e. a value with the ':' or
+ *            ',' around it. Zero runs a single step.
+ *
+ * return JESY_IN_PROGRESS while the JSON isn't completed, otherwise the final
+ *        status as jesy_parse would return it. Calls after completion only
+ *        return the final status again.
+ *
+ * note: The return value is also available in ctx->status. The tree may be
+ *       read in between, but must not be modified until the parse is completed.
+ */
+uint32_t jesy_parse_step(struct jesy_context* ctx, uint32_t max_tokens);
+
+#ifdef JESY_ENABLE_THREADS
+/* Parses a JSON like jesy_parse using several threads. The values of the
+ * largest array held by a root key are cut into segments by a structural scan
+ * that skips the strings. The segments are measured with jesy_estimate_nodes
+ * and parsed concurrently into the pool regions the serial parser would use,
+ * then linked into the array.
+ * param [in] ctx is an initialized context
+ * param [in] json_data in form of string no need to be NUL terminated.
+ * param [in] json_length is the size of json to be parsed.
+ * param [in] threads number of threads including the calling one, limited to JESY_MAX_THREADS.
+ *
+ * return status of the parsing process see: enum jesy_status
+ *
+ * note: The resulting tree is identical to the one of jesy_parse. If there is
+ *       nothing to split or any part fails, the JSON is parsed again on the
+ *       calling thread, so the status and ctx->offset match jesy_parse.
+ * note: The pool needs one spare node per segment. With JESY_ENABLE_KEY_IDS
+ *       the JSON is always parsed serially.
+ */
+uint32_t jesy_parse_parallel(struct jesy_context* ctx, char *json_data, uint32_t json_length, uint32_t threads);
+#endif
+
+/* Builds the tree of a CBOR (RFC 8949) or MessagePack document, as jesy_parse
+ * does for JSON. Strings are referenced in the binary data unless they contain
+ * characters that need escaping in JSON. Escaped strings and the text of
+ * numbers are generated in the string area at the end of the pool.
+ * param [in] ctx the Jesy context
+ * param [in] data the binary document. The root item must be a map with string keys.
+ * param [in] length is the size of data in bytes.
+ *
+ * return a status code of type enum jesy_status
+ *
+ * note: Byte strings, extension types, undefined and non-finite reals have
+ *       no JSON counterpart and are rejected. CBOR tags are ignored.
+ */
+uint32_t jesy_parse_cbor(struct jesy_context* ctx, uint8_t *data, uint32_t length);
+uint32_t jesy_parse_msgpack(struct jesy_context* ctx, uint8_t *data, uint32_t length);
+
 /* Render a tree of JSON elements into the destination buffer as a non-NUL terminated string.
  * param [in] ctx the Jesy context containing a JSON tree.
  * param [in] dst the destination buffer to hold the JSON string.
@@ -183,9 +447,385 @@ uint32_t jesy_render(struct jesy_context *ctx, char *dst, uint32_t length);
  */
 size_t jesy_evaluate(struct jesy_context *ctx);
 
+/* Render a tree of JSON elements into the destination buffer using a custom format.
+ * param [in] ctx the Jesy context containing a JSON tree.
+ * param [in] dst the destination buffer to hold the JSON string.
+ * param [in] length is the size of destination buffer in bytes.
+ * param [in] format describes line breaks, indentation and spacing. NULL renders a compact JSON.
+ *
+ * return the size of JSON string. If zero, there where probably a failure. Check the ctx->status
+ *
+ * note: The tree is validated and rendered in a single pass. In case of a too
+ *       small buffer, ctx->status is set to JESY_OUT_OF_MEMORY and the content
+ *       of dst is undefined.
+ */
+uint32_t jesy_render_format(struct jesy_context *ctx, char *dst, uint32_t length, const struct jesy_format *format);
+
+/* Calculates the exact buffer size that jesy_render_format requires for the given format.
+ * return the required buffer size or zero in case of an invalid tree. Check ctx->status.
+ */
+size_t jesy_evaluate_format(struct jesy_context *ctx, const struct jesy_format *format);
+
+/* Renders the tree as canonical JSON (RFC 8785): compact, object members sorted
+ * by the UTF-16 code units of their names, strings with the minimal escaping
+ * and numbers in the shortest form that reads back to the same double.
+ * param [in] ctx the Jesy context containing a JSON tree.
+ * param [in] dst the destination buffer to hold the JSON string.
+ * param [in] length is the size of destination buffer in bytes.
+ *
+ * return the size of JSON string. If zero, there where probably a failure. Check the ctx->status
+ *
+ * note: The members are sorted in the unused space between the nodes and the
+ *       string area of the pool, the tree isn't modified. JESY_OUT_OF_MEMORY
+ *       is reported if the space doesn't suffice.
+ */
+uint32_t jesy_render_canonical(struct jesy_context *ctx, char *dst, uint32_t length);
+
+/* Calculates the exact buffer size that jesy_render_canonical requires.
+ * return the required buffer size or zero in case of an invalid tree. Check ctx->status.
+ */
+size_t jesy_evaluate_canonical(struct jesy_context *ctx);
+
+/* Receives the output of a jesy_writer. The data is only valid during the call.
+ * return false to abort the writing */
+typedef bool (*jesy_writer_sink)(void *arg, const char *data, size_t length);
+
+/* Writes JSON directly from a sequence of calls, without building a tree.
+ * Only the nesting state of the open objects and arrays is kept, so the memory
+ * is constant. The first failure sticks, later calls return it again. */
+struct jesy_writer {
+  /* Destination buffer. With a sink, it only collects the output between two
+     calls of the sink and may be NULL. Without a sink, NULL only counts bytes. */
+  char     *buffer;
+  uint32_t  length;
+  /* Number of bytes in the buffer */
+  uint32_t  offset;
+  /* Number of bytes written so far, including those passed to the sink */
+  size_t    size;
+  jesy_writer_sink sink;
+  void     *sink_arg;
+  const struct jesy_format *format;
+  size_t    newline_length;
+  uint32_t  status;
+  /* Number of open objects and arrays and the state of each of them */
+  uint16_t  depth;
+  uint8_t   levels[JESY_MAX_DEPTH];
+  /* True once the root value is completed */
+  bool      done;
+};
+
+/* Prepares a writer.
+ * param [out] writer the caller-owned writer state
+ * param [in] buffer the destination buffer. NULL only calculates the size.
+ * param [in] length is the size of destination buffer in bytes.
+ * param [in] format the layout like in jesy_render_format. NULL writes a compact JSON.
+ */
+void jesy_writer_init(struct jesy_writer *writer, char *buffer, uint32_t length,
+                      const struct jesy_format *format);
+
+/* Passes the output to a sink instead of keeping it in the buffer. The buffer
+ * given to jesy_writer_init is handed over whenever it's full. Larger pieces
+ * and all the output of a writer without a buffer go to the sink directly.
+ * note: Must be called before anything is written. */
+void jesy_writer_set_sink(struct jesy_writer *writer, jesy_writer_sink sink, void *arg);
+
+/* Opening and closing of objects and arrays. Each member of an object must be
+ * started with jesy_writer_key.
+ * return a status code of type enum jesy_status. JESY_UNEXPECTED_NODE marks a
+ *        call that would make the JSON invalid. */
+uint32_t jesy_writer_begin_object(struct jesy_writer *writer);
+uint32_t jesy_writer_end_object(struct jesy_writer *writer);
+uint32_t jesy_writer_begin_array(struct jesy_writer *writer);
+uint32_t jesy_writer_end_array(struct jesy_writer *writer);
+
+/* Writes a key or a value. Keys and strings are NUL-terminated UTF-8 and get
+ * escaped as needed. The text of jesy_writer_number must be a valid JSON number
+ * and is written as is. Doubles take the shortest form that reads back to the
+ * same value, NaN and infinities are rejected.
+ * return a status code of type enum jesy_status */
+uint32_t jesy_writer_key(struct jesy_writer *writer, const char *key);
+uint32_t jesy_writer_string(struct jesy_writer *writer, const char *value);
+uint32_t jesy_writer_number(struct jesy_writer *writer, const char *value);
+uint32_t jesy_writer_int(struct jesy_writer *writer, int64_t value);
+uint32_t jesy_writer_uint(struct jesy_writer *writer, uint64_t value);
+uint32_t jesy_writer_double(struct jesy_writer *writer, double value);
+uint32_t jesy_writer_bool(struct jesy_writer *writer, bool value);
+uint32_t jesy_writer_null(struct jesy_writer *writer);
+
+/* Checks that the JSON is complete and passes the rest of the buffer to the sink.
+ * return a status code of type enum jesy_status. JESY_UNEXPECTED_EOF if
+ *        objects or arrays are still open or nothing was written. The size of
+ *        the JSON is in writer->size.
+ */
+uint32_t jesy_writer_finish(struct jesy_writer *writer);
+
+/* Position of a resumable render. See jesy_render_begin. The members are
+ * maintained by the render functions. */
+struct jesy_render_cursor {
+  struct jesy_context *ctx;
+  struct jesy_element *root;
+  /* Element being rendered and the step of it */
+  struct jesy_element *iter;
+  uint32_t step;
+  uint32_t status;
+  /* Rest of the piece being copied. Pieces point into the tree or to constants. */
+  const char *piece;
+  size_t piece_length;
+  /* Size of the whole JSON and the bytes delivered so far */
+  size_t size;
+  size_t offset;
+};
+
+/* Prepares a resumable render of the tree as a compact JSON, byte-identical to
+ * jesy_render. The tree is validated and measured first, so cursor->size can
+ * be announced before any output, e.g. as a Content-Length.
+ * param [in] ctx the Jesy context containing a JSON tree.
+ * param [out] cursor the caller-owned render state
+ *
+ * return a status code of type enum jesy_status
+ */
+uint32_t jesy_render_begin(struct jesy_context *ctx, struct jesy_render_cursor *cursor);
+
+/* Continues a render started by jesy_render_begin. Fills the buffer with as
+ * many bytes as fit and stops there, even in the middle of a string. Nothing
+ * is buffered in between, the bytes are copied directly out of the tree.
+ * param [in] cursor the render state
+ * param [in] dst the destination buffer
+ * param [in] length is the size of destination buffer in bytes.
+ *
+ * return the number of bytes written. Less than length or zero once the
+ *        JSON is completed, i.e. cursor->offset == cursor->size.
+ *
+ * note: The tree must not be modified until the render is completed. The
+ *       context isn't written, so several cursors may render it concurrently.
+ */
+uint32_t jesy_render_next(struct jesy_render_cursor *cursor, char *dst, uint32_t length);
+
+#ifdef JESY_ENABLE_IOVEC
+/* Describes the compact JSON of the tree, byte-identical to jesy_render, as a
+ * list of buffers for writev. The entries point at the values in the tree and
+ * at constant punctuation, nothing is copied. Parsed keys and strings are
+ * referenced in json_data together with their quotes, and pieces that follow
+ * each other in memory share an entry.
+ * param [in] ctx the Jesy context containing a JSON tree.
+ * param [out] iov the entries to be filled
+ * param [in] max_iov is the number of entries in iov.
+ *
+ * return the number of entries used. If zero, there where probably a failure.
+ *        Check the ctx->status, JESY_OUT_OF_MEMORY means max_iov is too small.
+ *
+ * note: The entries are read-only and valid until the tree or the source
+ *       buffers are modified. writev accepts at most IOV_MAX entries per call,
+ *       jesy_render_next_iov delivers larger documents in rounds.
+ */
+uint32_t jesy_render_iov(struct jesy_context *ctx, struct iovec *iov, uint32_t max_iov);
+
+/* Continues a render started by jesy_render_begin like jesy_render_next, but
+ * fills up to max_iov entries instead of copying.
+ * return the number of entries used, zero once the JSON is completed. */
+uint32_t jesy_render_next_iov(struct jesy_render_cursor *cursor, struct iovec *iov, uint32_t max_iov);
+#endif
+
+#ifdef JESY_ENABLE_THREADS
+/* Renders a compact JSON like jesy_render using several threads. The members of
+ * the containers at the split depth are cut into chunks. The chunk sizes are
+ * measured in parallel, then the part above the split depth is rendered with
+ * a gap for each chunk and the threads fill the gaps.
+ * param [in] ctx the Jesy context containing a JSON tree.
+ * param [in] dst the destination buffer to hold the JSON string.
+ * param [in] length is the size of destination buffer in bytes.
+ * param [in] threads number of threads including the calling one, limited to JESY_MAX_THREADS.
+ * param [in] split_depth nesting level of the members to be split. 1 (or 0)
+ *            splits the members of the root, 2 the members of its children, etc.
+ *
+ * return the size of JSON string. If zero, there where probably a failure. Check the ctx->status
+ *
+ * note: The output is byte-identical to jesy_render. The tree must not be
+ *       modified during the call. If there are no members at the split depth
+ *       or more than JESY_MAX_RENDER_CHUNKS containers to split, the JSON is
+ *       rendered on the calling thread.
+ */
+uint32_t jesy_render_parallel(struct jesy_context *ctx, char *dst, uint32_t length,
+                              uint32_t threads, uint32_t split_depth);
+#endif
+
+/* Renders the tree as CBOR (RFC 8949) or MessagePack. Containers and strings
+ * get definite lengths in their shortest form and escaped strings are written
+ * as raw UTF-8. Integers from INT64_MIN to UINT64_MAX are encoded as integers,
+ * any other number as a 64-bit real.
+ * param [in] ctx the Jesy context containing a JSON tree.
+ * param [in] dst the destination buffer. NULL only calculates the size.
+ * param [in] length is the size of destination buffer in bytes.
+ *
+ * return the size of the binary document. If zero, there where probably a failure. Check the ctx->status
+ */
+uint32_t jesy_render_cbor(struct jesy_context *ctx, uint8_t *dst, uint32_t length);
+uint32_t jesy_render_msgpack(struct jesy_context *ctx, uint8_t *dst, uint32_t length);
+
+/* Validates the syntax of a JSON string without building a tree.
+ * param [in] json_data in form of string no need to be NUL terminated.
+ * param [in] json_length is the size of json to be checked.
+ *
+ * return status of the validation see: enum jesy_status
+ *
+ * note: No context or node pool is required. Nesting is limited to JESY_MAX_DEPTH.
+ */
+uint32_t jesy_check(char *json_data, uint32_t json_length);
+
+/* Counts the nodes jesy_parse would allocate for a JSON string, without
+ * parsing it. Strings, numbers, literals, objects and arrays are counted in
+ * blocks of 64 bytes, SIMD accelerated where available.
+ * param [in] json_data in form of string no need to be NUL terminated.
+ * param [in] json_length is the size of the json.
+ *
+ * return the number of nodes. Exact for valid JSONs and an upper bound if
+ *        duplicate keys are merged. Meaningless for invalid JSONs.
+ */
+uint32_t jesy_estimate_nodes(const char *json_data, uint32_t json_length);
+
+/* Returns the pool_size to be passed to jesy_init_context to hold the given
+ * number of nodes, e.g. the result of jesy_estimate_nodes. Strings added with
+ * JESY_USE_STRING_ARENA or generated by jesy_diff need additional space.
+ * return zero if a context can't hold that many nodes, i.e. more than 65534
+ *        with 16-bit node descriptors or a pool size beyond 32 bits.
+ */
+size_t jesy_required_pool_size(uint32_t nodes);
+
+/* Removes all the insignificant spaces of a JSON string in place.
+ * param [in] json_data in form of string no need to be NUL terminated.
+ * param [in] json_length is the size of json to be minified.
+ *
+ * return the size of the minified JSON. Zero means the JSON is invalid and
+ *        json_data is partially minified. Use jesy_check to get the reason.
+ *
+ * note: No context or node pool is required. Nesting is limited to JESY_MAX_DEPTH.
+ */
+uint32_t jesy_minify(char *json_data, uint32_t json_length);
+
 /* Deletes an element, containing all of its sub-elements. */
 void jesy_delete_element(struct jesy_context *ctx, struct jesy_element *element);
 
+/* Copies an element including all of its sub-elements from one context to another
+ * in a single traversal.
+ * param [in] dst_ctx the context to receive the copy
+ * param [in] dst_parent the parent of the copy. NULL to make the copy the root of an empty dst_ctx.
+ * param [in] src_ctx the context holding the element to be copied. May be the same as dst_ctx.
+ * param [in] src_element the element to be copied
+ *
+ * return the copied element or NULL in case of a failure. Check dst_ctx->status
+ *
+ * note: The values are not copied. They must outlive both contexts.
+ */
+struct jesy_element* jesy_clone(struct jesy_context *dst_ctx, struct jesy_element *dst_parent,
+                                struct jesy_context *src_ctx, struct jesy_element *src_element);
+
+/* Applies a JSON Merge Patch (RFC 7396) directly on the tree.
+ * param [in] ctx the context holding the target
+ * param [in] target the element to be patched. Usually the root object.
+ * param [in] patch_ctx the context holding the patch. May be the same as ctx.
+ * param [in] patch the patch element. Usually the root object of a parsed patch.
+ *
+ * return a status code of type enum jesy_status
+ *
+ * note: Keys and values taken from the patch are not copied. The patch data
+ *       must outlive ctx. The target might be partially patched if the pool
+ *       runs out of nodes.
+ */
+uint32_t jesy_merge_patch(struct jesy_context *ctx, struct jesy_element *target,
+                          struct jesy_context *patch_ctx, struct jesy_element *patch);
+
+/* Compares two JSON values. Object members are compared regardless of their
+ * order, numbers by their exact decimal value and strings by their unescaped
+ * characters.
+ * return true if both values are equal */
+bool jesy_equal(struct jesy_context *ctx_a, struct jesy_element *a,
+                struct jesy_context *ctx_b, struct jesy_element *b);
+
+/* Computes a 64-bit hash of a subtree from the types, key names and value texts
+ * of its nodes. Values are hashed as they are stored, e.g. 1.0 and 1 differ.
+ * param [in] ctx the Jesy context containing the element
+ * param [in] element the root of the subtree
+ * param [in] unordered ignores the order of object members if true
+ *
+ * return the hash or zero in case of a failure. Check ctx->status.
+ *
+ * note: Nesting is limited to JESY_MAX_DEPTH. With JESY_ENABLE_HASH_CACHE the
+ *       hashes of the visited nodes are stored in the tree and reused by the
+ *       next call. Switching the unordered flag drops all of them.
+ */
+uint64_t jesy_hash(struct jesy_context *ctx, struct jesy_element *element, bool unordered);
+
+/* Applies a JSON Patch (RFC 6902) to the tree in a single call.
+ * param [in] ctx the context holding the target document
+ * param [in] patch_ctx the context holding the patch. May be the same as ctx.
+ * param [in] patch an array of operation objects, e.g. the value of a key in a parsed document
+ *
+ * return a status code of type enum jesy_status. JESY_PATCH_TEST_FAILED if a
+ *        test operation didn't match.
+ *
+ * note: The whole patch is validated before the first operation is applied and
+ *       a failing operation rolls back the previous ones. The tree is either
+ *       completely patched or left unchanged.
+ * note: Keys and values taken from the patch are not copied. The patch data
+ *       must outlive ctx. Keys added by a path that needs ~0 or ~1 escaping are
+ *       rejected for the same reason.
+ * note: The root can only be tested, or replaced as a whole by add and replace.
+ * note: The undo journal takes 4 records per operation from the unused part of
+ *       the pool, between the nodes and the string area. JESY_OUT_OF_MEMORY is
+ *       reported if it doesn't fit along with the nodes the patch adds.
+ */
+uint32_t jesy_apply_patch(struct jesy_context *ctx, struct jesy_context *patch_ctx, struct jesy_element *patch);
+
+/* Computes the differences between two JSON values as a JSON Patch (RFC 6902).
+ * param [in] ctx_a the context holding the old value
+ * param [in] root_a the old value, usually the root object
+ * param [in] ctx_b the context holding the new value. May be the same as ctx_a.
+ * param [in] root_b the new value, usually the root object
+ * param [in] out_ctx an empty context to receive the patch. The result is
+ *            {"patch":[...]} where the array can be passed to jesy_apply_patch.
+ *
+ * return a status code of type enum jesy_status
+ *
+ * note: Keys are matched through hash tables placed in the unused part of the
+ *       node pools of ctx_a and ctx_b. If there is no room, keys are searched linearly.
+ * note: Subtrees of documents that are still unmodified since jesy_parse are
+ *       compared by their source text first.
+ * note: Array items are compared by position. The paths are stored in the
+ *       string area of out_ctx while the values refer to the data of ctx_b.
+ * note: A root of a different type is replaced at the path "". jesy_apply_patch
+ *       rejects adding keys whose names contain '~' or '/', see there.
+ */
+uint32_t jesy_diff(struct jesy_context *ctx_a, struct jesy_element *root_a,
+                   struct jesy_context *ctx_b, struct jesy_element *root_b,
+                   struct jesy_context *out_ctx);
+
+#ifdef JESY_ENABLE_KEY_IDS
+/* Returns the ID of a key name or JESY_INVALID_KEY_ID if no key of that name
+ * has been parsed or added yet. */
+uint16_t jesy_get_key_id(struct jesy_context *ctx, const char *name, uint16_t length);
+
+/* Returns the number of key IDs. IDs are assigned from 0 upwards in the order
+ * the names appear, so all of them can be enumerated with jesy_get_key_name. */
+uint16_t jesy_get_key_id_count(struct jesy_context *ctx);
+
+/* Returns the name of a key ID and its length or NULL for an invalid ID. */
+const char* jesy_get_key_name(struct jesy_context *ctx, uint16_t key_id, uint16_t *length);
+
+/* Returns the key element of an object having the given key ID. */
+struct jesy_element* jesy_get_key_by_id(struct jesy_context *ctx, struct jesy_element *object, uint16_t key_id);
+#endif
+
+#ifdef JESY_ENABLE_STATS
+/* Copies the counters collected since jesy_init_context or the last reset.
+ * param [in] ctx the context
+ * param [out] stats receives the counters
+ * param [in] reset clears the counters after copying them
+ *
+ * return a status code of type enum jesy_status
+ */
+uint32_t jesy_get_stats(struct jesy_context *ctx, struct jesy_stats *stats, bool reset);
+#endif
+
 /* Delivers the root element of the JSOn tree.
  * Returning a NULL is meaning that the tree is empty. */
 struct jesy_element* jesy_get_root(struct jesy_context *ctx);
@@ -213,7 +853,65 @@ struct jesy_element* jesy_get_key_value(struct jesy_context *ctx, struct jesy_el
 /* Returns value element of a given array element. NULL if element has no value yet. */
 struct jesy_element* jesy_get_array_value(struct jesy_context *ctx, struct jesy_element *array, int16_t index);
 
+/* Reentrant read access.
+ * The functions with the _r suffix keep their cursor and error state in a
+ * jesy_read_state owned by the caller and never write the context. Any number
+ * of threads, each with its own state, may call them on the same context at
+ * the same time without locks, as long as no thread parses into, modifies or
+ * re-initializes the context meanwhile. The same holds for jesy_get_root,
+ * jesy_get_handle and the handle accessors and cursors below.
+ * note: Unlike jesy_render and jesy_evaluate, the _r functions don't update
+ *       ctx->status, ctx->iter or the counters of JESY_ENABLE_STATS.
+ */
+struct jesy_read_state {
+  /* Status of the last call. JESY_ELEMENT_NOT_FOUND if a lookup or a
+     traversal step found nothing. */
+  uint32_t status;
+  /* Element delivered by the last call, the position of jesy_read_next */
+  struct jesy_element *iter;
+  /* Element whose subtree is traversed by jesy_read_next */
+  struct jesy_element *root;
+};
+
+struct jesy_element* jesy_get_parent_r(struct jesy_context *ctx, struct jesy_element *element,
+                                       struct jesy_read_state *state);
+struct jesy_element* jesy_get_sibling_r(struct jesy_context *ctx, struct jesy_element *element,
+                                        struct jesy_read_state *state);
+struct jesy_element* jesy_get_child_r(struct jesy_context *ctx, struct jesy_element *element,
+                                      struct jesy_read_state *state);
+
+/* Same as jesy_get_key, jesy_get_key_value and jesy_get_array_value. On failure,
+ * state->status tells an invalid parameter, a non-object on the path
+ * (JESY_UNEXPECTED_NODE) and a missing element apart. */
+struct jesy_element* jesy_get_key_r(struct jesy_context *ctx, struct jesy_element *object,
+                                    const char *keys, struct jesy_read_state *state);
+struct jesy_element* jesy_get_key_value_r(struct jesy_context *ctx, struct jesy_element *object,
+                                          const char *keys, struct jesy_read_state *state);
+struct jesy_element* jesy_get_array_value_r(struct jesy_context *ctx, struct jesy_element *array,
+                                            int16_t index, struct jesy_read_state *state);
+
+/* Starts a depth-first traversal of the subtree of an element.
+ * return the element itself or NULL if it doesn't belong to the context. */
+struct jesy_element* jesy_read_begin(struct jesy_context *ctx, struct jesy_element *element,
+                                     struct jesy_read_state *state);
+
+/* Delivers the next element of the traversal in document order: the first
+ * child, else the next sibling of the element or of its closest ancestor.
+ * return NULL once the subtree is completed. */
+struct jesy_element* jesy_read_next(struct jesy_context *ctx, struct jesy_read_state *state);
+
+/* Calculates the buffer size required by jesy_render_r for the given format.
+ * NULL renders a compact JSON of the same size as jesy_evaluate returns.
+ * return the required buffer size or zero in case of an invalid tree. Check state->status. */
+size_t jesy_evaluate_r(struct jesy_context *ctx, const struct jesy_format *format, struct jesy_read_state *state);
+
+/* Renders the tree like jesy_render_format. The tree is validated in the same pass.
+ * return the size of JSON string. If zero, check state->status. */
+uint32_t jesy_render_r(struct jesy_context *ctx, char *dst, uint32_t length,
+                       const struct jesy_format *format, struct jesy_read_state *state);
+
 /* Add an object to a given parent element. Possible acceptable parent elements are JESY_KEY and JESY_ARRAY.
+ * note: Keys and values are not copied unless JESY_USE_STRING_ARENA is defined.
  * return a status code of type enum jesy_status */
 struct jesy_element* jesy_add_object(struct jesy_context *ctx, struct jesy_element *parent);
 struct jesy_element* jesy_add_array(struct jesy_context *ctx, struct jesy_element *parent);
@@ -226,17 +924,210 @@ struct jesy_element* jesy_add_value_false(struct jesy_context *ctx, struct jesy_
 struct jesy_element* jesy_add_value_null(struct jesy_context *ctx, struct jesy_element *parent);
 /* Update a key element giving its parent object.
  * note: The new key name will not be copied and must be non-retentive for the life time of jesy_context.
+ *       With JESY_USE_STRING_ARENA, it's interned in the string area instead.
  * return a status code of type enum jesy_status */
 uint32_t jesy_update_key(struct jesy_context *ctx, struct jesy_element *key, char *new);
 /* Update key value giving its name or name a series of keys separated with a dot
  * note: The new value will not be copied and must be non-retentive for the life time of jesy_context.
+ *       With JESY_USE_STRING_ARENA, it's copied into the string area instead.
  * return a status code of type enum jesy_status */
 uint32_t jesy_update_key_value(struct jesy_context *ctx, struct jesy_element *object, char *keys, enum jesy_type type, char *value);
 /* Update array value giving its array element and an index.
  * note: The new value will not be copied and must be non-retentive for the life time of jesy_context.
+ *       With JESY_USE_STRING_ARENA, it's copied into the string area instead.
  * return a status code of type enum jesy_status */
 uint32_t jesy_update_array_value(struct jesy_context *ctx, struct jesy_element *array, int16_t index, enum jesy_type type, char *value);
 
+/* C type of a struct member bound to a JSON value. See struct jesy_binding */
+enum jesy_bind_type {
+  JESY_BIND_BOOL,    /* bool, from/to true or false */
+  JESY_BIND_INT32,   /* int32_t, from/to an integer number */
+  JESY_BIND_INT64,   /* int64_t, from/to an integer number */
+  JESY_BIND_UINT32,  /* uint32_t, from/to a non-negative integer number */
+  JESY_BIND_UINT64,  /* uint64_t, from/to a non-negative integer number */
+  JESY_BIND_DOUBLE,  /* double, from/to any number */
+  JESY_BIND_STRING,  /* char array of the given size, NUL-terminated. Holds the unescaped characters. */
+};
+
+/* Binds a key of a JSON object to a member of a C struct. */
+struct jesy_binding {
+  /* Key name or a series of key names separated with a dot "." */
+  const char         *path;
+  enum jesy_bind_type type;
+  /* Offset of the member inside the struct. See offsetof */
+  size_t              offset;
+  /* Size of the member in bytes */
+  size_t              size;
+};
+
+#define JESY_BINDING(path_, type_, struct_, member_) \
+  { path_, type_, offsetof(struct_, member_), sizeof(((struct_*)0)->member_) }
+
+/* Fills the members of a struct from the keys of an object in a single traversal.
+ * param [in] ctx the Jesy context containing a JSON tree.
+ * param [in] object is a JSON element of type JESY_OBJECT
+ * param [in] table describes the keys to be extracted and where to store them
+ * param [in] count number of entries in table
+ * param [out] dst the struct to be filled
+ *
+ * return a status code of type enum jesy_status
+ *
+ * note: Members of missing keys and keys with null values are left untouched.
+ *       A value that doesn't fit into its member, e.g. a number beyond the range
+ *       of double, is reported as JESY_UNEXPECTED_NODE or JESY_OUT_OF_MEMORY for
+ *       too long strings.
+ *       The entries are sorted by path in the unused part of the pool, which needs
+ *       4 bytes per entry, otherwise JESY_OUT_OF_MEMORY is returned.
+ */
+uint32_t jesy_bind(struct jesy_context *ctx, struct jesy_element *object,
+                   const struct jesy_binding *table, uint32_t count, void *dst);
+
+/* Renders the members of a struct described by a binding table as a compact JSON object.
+ * param [in] table describes the keys and where to read their values from
+ * param [in] count number of entries in table
+ * param [in] src the struct to be rendered
+ * param [in] dst the destination buffer or NULL to only calculate the required size
+ * param [in] length is the size of destination buffer in bytes.
+ *
+ * return the size of JSON string. If zero, the buffer was too small or a value is not representable.
+ *
+ * note: Entries sharing a path prefix, e.g. "a.b" and "a.c", must be adjacent in the table.
+ */
+uint32_t jesy_render_binding(const struct jesy_binding *table, uint32_t count,
+                             const void *src, char *dst, uint32_t length);
+
+/* Low level parser API. It allows a custom parser (e.g. generated by
+ * tools/jesy_gen.py) to consume the tokens directly and to fall back to the
+ * JESy tree for the parts it doesn't handle itself.
+ */
+
+/* Attaches a JSON string to the context and fetches its first token into ctx->token. */
+void jesy_tokenizer_init(struct jesy_context *ctx, char *json_data, uint32_t json_length);
+
+/* Consumes the current token and fetches the next one into ctx->token.
+ * return type of the new token */
+enum jesy_token_type jesy_next_token(struct jesy_context *ctx);
+
+/* Parses the value starting at the current token into the JSON tree.
+ * param [in] parent is an element of type JESY_KEY without value or JESY_ARRAY
+ *
+ * return a status code of type enum jesy_status. On success ctx->token holds
+ *        the token following the value.
+ */
+uint32_t jesy_parse_value(struct jesy_context *ctx, struct jesy_element *parent);
+
+/* Converts the value of the current token into a C type and consumes the token.
+ * A null value leaves dst untouched. See jesy_bind for the conversion rules.
+ * return a status code of type enum jesy_status */
+uint32_t jesy_convert_token(struct jesy_context *ctx, enum jesy_bind_type type, void *dst, size_t size);
+
+/* Appends an element of any type to the given parent. Unlike jesy_add_value, the
+ * value doesn't need to be NUL-terminated.
+ * return the new element or NULL in case of a failure. Check ctx->status */
+struct jesy_element* jesy_add_element(struct jesy_context *ctx, struct jesy_element *parent,
+                                      enum jesy_type type, uint16_t length, char *value);
+
+/* Sets aside nodes for the following allocations. The reserved nodes are taken
+ * in a row, one after another, instead of recycling deleted nodes. A new call
+ * replaces the previous reservation and zero cancels it.
+ * param [in] count is the number of nodes to be reserved
+ * return a status code of type enum jesy_status */
+uint32_t jesy_reserve(struct jesy_context *ctx, uint32_t count);
+
+/* Appends a series of values of the same type to an array in one go. The new
+ * elements are linked in a contiguous run of nodes when the pool has room for
+ * it, otherwise deleted nodes are recycled.
+ * param [in] array is an element of type JESY_ARRAY
+ * param [in] type is one of JESY_STRING, JESY_NUMBER, JESY_TRUE, JESY_FALSE or JESY_NULL
+ * param [in] values are the values to be appended. Can be NULL for literals.
+ * param [in] lengths of the values or NULL if they are NUL-terminated
+ * param [in] count is the number of values
+ * note: The values are handled like in jesy_add_value. Either all or none of
+ *       them are appended.
+ * return a status code of type enum jesy_status */
+uint32_t jesy_add_values(struct jesy_context *ctx, struct jesy_element *array, enum jesy_type type,
+                         char *values[], const uint16_t lengths[], uint32_t count);
+
+/* Handle based read access.
+ * A handle is the index of an element in the node pool. Only jesy_get_handle
+ * and jesy_cursor_begin validate their parameters. The inline accessors trust
+ * the given handle, so that tight loops over large arrays compile down to plain
+ * index loads. JESY_INVALID_INDEX stands for a missing parent, sibling or child.
+ */
+struct jesy_cursor {
+  /* Node pool of the iterated context */
+  struct jesy_element *pool;
+  /* Handle of the current element or JESY_INVALID_INDEX at the end of iteration */
+  jesy_node_descriptor node;
+};
+
+/* Returns the handle of an element or JESY_INVALID_INDEX if the element doesn't
+ * belong to the context. */
+jesy_node_descriptor jesy_get_handle(struct jesy_context *ctx, struct jesy_element *element);
+
+/* Places the cursor on the first child of the given parent handle.
+ * return false if the parent handle is invalid. */
+bool jesy_cursor_begin(struct jesy_context *ctx, struct jesy_cursor *cursor, jesy_node_descriptor parent);
+
+static inline struct jesy_element* jesy_node(struct jesy_context *ctx, jesy_node_descriptor handle)
+{
+  return &ctx->pool[handle];
+}
+
+static inline jesy_node_descriptor jesy_node_parent(struct jesy_context *ctx, jesy_node_descriptor handle)
+{
+  return ctx->pool[handle].parent;
+}
+
+static inline jesy_node_descriptor jesy_node_sibling(struct jesy_context *ctx, jesy_node_descriptor handle)
+{
+  return ctx->pool[handle].sibling;
+}
+
+static inline jesy_node_descriptor jesy_node_child(struct jesy_context *ctx, jesy_node_descriptor handle)
+{
+  return ctx->pool[handle].first_child;
+}
+
+static inline enum jesy_type jesy_node_type(struct jesy_context *ctx, jesy_node_descriptor handle)
+{
+  return (enum jesy_type)ctx->pool[handle].type;
+}
+
+static inline uint16_t jesy_node_length(struct jesy_context *ctx, jesy_node_descriptor handle)
+{
+  return ctx->pool[handle].length;
+}
+
+static inline char* jesy_node_value(struct jesy_context *ctx, jesy_node_descriptor handle)
+{
+  return ctx->pool[handle].value;
+}
+
+#ifdef JESY_ENABLE_KEY_IDS
+static inline uint16_t jesy_node_key_id(struct jesy_context *ctx, jesy_node_descriptor handle)
+{
+  return ctx->pool[handle].key_id;
+}
+#endif
+
+static inline bool jesy_cursor_valid(const struct jesy_cursor *cursor)
+{
+  return cursor->node != JESY_INVALID_INDEX;
+}
+
+static inline void jesy_cursor_next(struct jesy_cursor *cursor)
+{
+  cursor->node = cursor->pool[cursor->node].sibling;
+}
+
+static inline struct jesy_element* jesy_cursor_element(const struct jesy_cursor *cursor)
+{
+  return &cursor->pool[cursor->node];
+}
+
+#define JESY_CURSOR_FOR_EACH(ctx_, cursor_, parent_) for(jesy_cursor_begin(ctx_, &cursor_, parent_); jesy_cursor_valid(&cursor_); jesy_cursor_next(&cursor_))
+
 #define JESY_FOR_EACH(ctx_, elem_, type_) for(elem_ = (elem_->type == type_) ? jesy_get_child(ctx_, elem_) : NULL; elem_ != NULL; elem_ = jesy_get_sibling(ctx_, elem_))
 #define JESY_ARRAY_FOR_EACH(ctx_, elem_) for(elem_ = (elem_->type == JESY_ARRAY) ? jesy_get_child(ctx_, elem_) : NULL; elem_ != NULL; elem_ = jesy_get_sibling(ctx_, elem_))
 
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include "jesy.h"
+#include "jesy_util.h"
+
+const char *jesy_status_str[] = {
+  "JESY_NO_ERR",
+  "JESY_PARSING_FAILED",
+  "JESY_RENDER_FAILED",
+  "JESY_OUT_OF_MEMORY",
+  "JESY_UNEXPECTED_TOKEN",
+  "JESY_UNEXPECTED_NODE",
+  "JESY_UNEXPECTED_EOF",
+  "JESY_INVALID_PARAMETER",
+  "JESY_ELEMENT_NOT_FOUND",
+  "JESY_MAX_DEPTH_EXCEEDED",
+  "JESY_PATCH_TEST_FAILED",
+  "JESY_IN_PROGRESS",
+};
+
+const char *jesy_node_type_str[] = {
+  "NONE",
+  "OBJECT",
+  "KEY",
+  "ARRAY",
+  "STRING",
+  "NUMBER",
+  "TRUE",
+  "FALSE",
+  "NULL",
+};
+
+const char *jesy_token_type_str[] = {
+  "EOF",
+  "OPENING_BRACKET",
+  "CLOSING_BRACKET",
+  "OPENING_BRACE",
+  "CLOSING_BRACE",
+  "STRING",
+  "NUMBER",
+  "TRUE",
+  "FALSE",
+  "NULL",
+  "COLON",
+  "COMMA",
+  "ESC",
+  "INVALID",
+};
+
+void jesy_log_token(uint16_t token_type,
+                    uint32_t token_pos,
+                    uint32_t token_len,
+                    const char *token_value)
+{
+  printf("\n JESY.Token: [Pos: %5d, Len: %3d] %-16s \"%.*s\"",
+         token_pos, token_len, jesy_token_type_str[token_type],
+         (int)token_len, token_value);
+}
+
+void jesy_log_node(const char *pre_msg,
+                   int32_t node_id,
+                   uint16_t node_type,
+                   uint32_t node_length,
+                   const char *node_value,
+                   int32_t parent_id,
+                   int32_t sibling_id,
+                   int32_t first_child_id,
+                   const char *post_msg)
+{
+  printf("%sJESY.Node: [%d] \"%.*s\" <%s>,    parent:[%d], sibling:[%d], first_child:[%d]%s",
+         pre_msg, node_id, (int)node_length, node_value, jesy_node_type_str[node_type],
+         parent_id, sibling_id, first_child_id, post_msg);
+}
+
+void jesy_log_msg(const char *msg)
+{
+  printf("%s", msg);
+}
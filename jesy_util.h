@@ -0,0 +1,32 @@
+#ifndef JESY_UTIL_H
+#define JESY_UTIL_H
+
+#include <stdint.h>
+
+/* Human readable names of enum jesy_status, enum jesy_type and
+ * enum jesy_token_type. Indexed by the enum values. */
+extern const char *jesy_status_str[];
+extern const char *jesy_node_type_str[];
+extern const char *jesy_token_type_str[];
+
+/* Prints a token delivered by the tokenizer. */
+void jesy_log_token(uint16_t token_type,
+                    uint32_t token_pos,
+                    uint32_t token_len,
+                    const char *token_value);
+
+/* Prints a node and its links. pre_msg and post_msg are printed around it. */
+void jesy_log_node(const char *pre_msg,
+                   int32_t node_id,
+                   uint16_t node_type,
+                   uint32_t node_length,
+                   const char *node_value,
+                   int32_t parent_id,
+                   int32_t sibling_id,
+                   int32_t first_child_id,
+                   const char *post_msg);
+
+/* Prints a message. */
+void jesy_log_msg(const char *msg);
+
+#endif
@@ -0,0 +1,745 @@
+/* Regression tests. Build and run from the repository root:
+ *   cc -DNDEBUG -I. tests/jesy_test.c jesy.c -lm -o jesy_test && ./jesy_test
+ * The tests of optional features are built along with them, e.g. add
+ * -DJESY_ENABLE_THREADS -lpthread or -DJESY_ENABLE_IOVEC
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "jesy.h"
+
+#define POOL_SIZE 0x4000
+static uint8_t mem_pool[POOL_SIZE];
+static uint8_t patch_pool[POOL_SIZE];
+static int failures;
+
+/* A document large enough to be cut into several segments, its serially
+   parsed tree and rendered reference */
+#define DOCUMENT_SIZE 0x8000
+static char document[DOCUMENT_SIZE];
+static char reference[DOCUMENT_SIZE];
+static char output[DOCUMENT_SIZE];
+static uint8_t document_pool[0x20000];
+static uint8_t other_pool[0x20000];
+
+#define CHECK(cond_) \
+  do { \
+    if (!(cond_)) { \
+      printf("\n%s:%d: %s", __FILE__, __LINE__, #cond_); \
+      failures++; \
+    } \
+  } while (0)
+
+static struct jesy_context* parse(char *json)
+{
+  struct jesy_context *ctx = jesy_init_context(mem_pool, sizeof(mem_pool));
+  if (jesy_parse(ctx, json, (uint32_t)strlen(json)) != JESY_NO_ERR) {
+    return NULL;
+  }
+  return ctx;
+}
+
+static struct jesy_element* patch_array(struct jesy_context *patch_ctx)
+{
+  return jesy_get_key_value(patch_ctx, jesy_get_root(patch_ctx), "patch");
+}
+
+/* Fills the document with an array of 200 objects holding every kind of value
+ * and parses and renders it serially.
+ * return the context of the serial parse or NULL */
+static struct jesy_context* parse_document(uint32_t *document_length, uint32_t *reference_length)
+{
+  struct jesy_context *ctx = jesy_init_context(document_pool, sizeof(document_pool));
+  int len = snprintf(document, sizeof(document), "{\"meta\":{\"count\":200,\"note\":\"a \\\"b\\\"\"},\"items\":[");
+  uint32_t index;
+
+  for (index = 0; index < 200; index++) {
+    len += snprintf(&document[len], sizeof(document) - (size_t)len,
+                    "%s{\"id\":%u,\"name\":\"item %u\",\"tags\":[\"x\",\"y\"],\"v\":-%u.25,\"ok\":%s,\"z\":null}",
+                    index ? "," : "", index, index, index, (index % 3) ? "true" : "false");
+  }
+  len += snprintf(&document[len], sizeof(document) - (size_t)len, "],\"end\":{}}");
+  *document_length = (uint32_t)len;
+
+  if (jesy_parse(ctx, document, *document_length) != JESY_NO_ERR) {
+    return NULL;
+  }
+  *reference_length = jesy_render(ctx, reference, sizeof(reference));
+  return *reference_length ? ctx : NULL;
+}
+
+/* Objects with several members and arrays following a comma. A missing comma
+ * is reported, not asserted. */
+static void test_parse_members(void)
+{
+  char json[] = "{\"a\":1,\"b\":[1,\"x\",{\"c\":null}],\"d\":\"e\",\"f\":{}}";
+  char missing_comma[] = "{\"a\":1 \"b\":2}";
+  char out[64];
+  struct jesy_context *ctx = parse(json);
+  uint32_t size;
+
+  CHECK(ctx != NULL);
+  if (ctx) {
+    size = jesy_render(ctx, out, sizeof(out));
+    CHECK((size == (sizeof(json) - 1)) && (memcmp(out, json, size) == 0));
+  }
+  ctx = jesy_init_context(mem_pool, sizeof(mem_pool));
+  CHECK(jesy_parse(ctx, missing_comma, (uint32_t)strlen(missing_comma)) == JESY_UNEXPECTED_TOKEN);
+}
+
+/* Adding to a missing context fails without touching it. */
+static void test_add_null_context(void)
+{
+  CHECK(jesy_add_element(NULL, NULL, JESY_OBJECT, 0, NULL) == NULL);
+  CHECK(jesy_add_object(NULL, NULL) == NULL);
+}
+
+/* jesy_check and jesy_minify run the tokenizer without a context. */
+static void test_check_minify(void)
+{
+  char json[] = " { \"a\" : [ 1 , \"x y\" , { \"b\" : null } ] , \"c\" : true } ";
+  char minified[] = "{\"a\":[1,\"x y\",{\"b\":null}],\"c\":true}";
+  char unclosed[] = "{\"a\":[1,2}";
+  char truncated[] = "{\"a\":1";
+  uint32_t size;
+
+  CHECK(jesy_check(json, (uint32_t)strlen(json)) == JESY_NO_ERR);
+  CHECK(jesy_check(unclosed, (uint32_t)strlen(unclosed)) == JESY_UNEXPECTED_TOKEN);
+  CHECK(jesy_check(truncated, (uint32_t)strlen(truncated)) == JESY_UNEXPECTED_EOF);
+  size = jesy_minify(json, (uint32_t)strlen(json));
+  CHECK((size == (sizeof(minified) - 1)) && (memcmp(json, minified, size) == 0));
+}
+
+/* Numbers too long for an exact integer are converted to double, whatever
+ * their length. */
+static void test_binary_long_numbers(void)
+{
+  char json[] = "{\"a\":1234567890123456789012345678901234567890,"
+                "\"b\":3.14159265358979323846264338327950288,"
+                "\"c\":-0.000000000000000000000000000000000000000000000000000000000000012345}";
+  /* {"a":1.2345678901234568e+39,"b":3.141592653589793,"c":-1.2345e-62} as MessagePack */
+  static const uint8_t msgpack[] = {
+    0x83,
+    0xA1, 'a', 0xCB, 0x48, 0x0D, 0x06, 0x49, 0x03, 0xAE, 0x06, 0xE0,
+    0xA1, 'b', 0xCB, 0x40, 0x09, 0x21, 0xFB, 0x54, 0x44, 0x2D, 0x18,
+    0xA1, 'c', 0xCB, 0xB3, 0x14, 0x50, 0x52, 0x2A, 0x9A, 0xC1, 0xB2,
+  };
+  uint8_t out[64];
+  struct jesy_context *ctx = parse(json);
+  uint32_t size;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  size = jesy_render_msgpack(ctx, out, sizeof(out));
+  CHECK(ctx->status == JESY_NO_ERR);
+  CHECK((size == sizeof(msgpack)) && (memcmp(out, msgpack, size) == 0));
+
+  size = jesy_render_cbor(ctx, out, sizeof(out));
+  CHECK(ctx->status == JESY_NO_ERR);
+  CHECK((size == 34) && (out[3] == 0xFB) && (memcmp(&out[4], &msgpack[4], 8) == 0));
+}
+
+/* RFC 8785 serializes long numbers as the double they read back to. */
+static void test_canonical_long_numbers(void)
+{
+  char json[] = "{\"b\":3.14159265358979323846264338327950288,"
+                "\"a\":1234567890123456789012345678901234567890}";
+  static const char canonical[] = "{\"a\":1.2345678901234568e+39,\"b\":3.141592653589793}";
+  char out[64];
+  struct jesy_context *ctx = parse(json);
+  uint32_t size;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  CHECK(jesy_evaluate_canonical(ctx) == (sizeof(canonical) - 1));
+  size = jesy_render_canonical(ctx, out, sizeof(out));
+  CHECK(ctx->status == JESY_NO_ERR);
+  CHECK((size == (sizeof(canonical) - 1)) && (memcmp(out, canonical, size) == 0));
+}
+
+/* The operations of a patch aren't limited by a fixed table. */
+static void test_patch_many_operations(void)
+{
+  char json[512];
+  char patch_json[2048];
+  char out[512];
+  struct jesy_context *ctx;
+  struct jesy_context *patch_ctx;
+  uint32_t size = 0;
+  uint32_t index;
+  int length;
+
+  length = sprintf(json, "{");
+  for (index = 0; index < 40; index++) {
+    length += sprintf(&json[length], "%s\"k%u\":%u", index ? "," : "", index, index);
+  }
+  sprintf(&json[length], "}");
+  length = sprintf(patch_json, "{\"patch\":[");
+  for (index = 0; index < 40; index++) {
+    length += sprintf(&patch_json[length], "%s{\"op\":\"replace\",\"path\":\"/k%u\",\"value\":%u}",
+                      index ? "," : "", index, 100 + index);
+  }
+  sprintf(&patch_json[length], "]}");
+
+  ctx = parse(json);
+  patch_ctx = jesy_init_context(patch_pool, sizeof(patch_pool));
+  CHECK(ctx != NULL);
+  CHECK(jesy_parse(patch_ctx, patch_json, (uint32_t)strlen(patch_json)) == JESY_NO_ERR);
+  if (!ctx || patch_ctx->status) {
+    return;
+  }
+  CHECK(jesy_apply_patch(ctx, patch_ctx, patch_array(patch_ctx)) == JESY_NO_ERR);
+  size = jesy_render(ctx, out, sizeof(out));
+  CHECK((size > 20) && (memcmp(out, "{\"k0\":100,\"k1\":101,", 19) == 0) &&
+        (memcmp(&out[size - 10], "\"k39\":139}", 10) == 0));
+}
+
+/* Copies are included in the capacity check, a patch that can't fit leaves
+ * the tree unchanged. */
+static void test_patch_copy_capacity(void)
+{
+  /* Room for the document and a single copy of /a, whatever the size of the context */
+  static uint8_t small_pool[sizeof(struct jesy_context) + (33 * sizeof(struct jesy_element))];
+  char json[] = "{\"a\":[1,2,3,4,5,6,7,8,9,10],\"b\":0}";
+  char patch_json[] = "{\"patch\":[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/c\"},"
+                      "{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/d\"}]}";
+  char out[128];
+  struct jesy_context *ctx = jesy_init_context(small_pool, sizeof(small_pool));
+  struct jesy_context *patch_ctx = jesy_init_context(patch_pool, sizeof(patch_pool));
+  uint32_t size;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  CHECK(jesy_parse(ctx, json, (uint32_t)strlen(json)) == JESY_NO_ERR);
+  CHECK(jesy_parse(patch_ctx, patch_json, (uint32_t)strlen(patch_json)) == JESY_NO_ERR);
+  if (ctx->status || patch_ctx->status) {
+    return;
+  }
+  CHECK(jesy_apply_patch(ctx, patch_ctx, patch_array(patch_ctx)) == JESY_OUT_OF_MEMORY);
+  size = jesy_render(ctx, out, sizeof(out));
+  CHECK((size == (sizeof(json) - 1)) && (memcmp(out, json, size) == 0));
+}
+
+static uint32_t apply_patch(char *json, char *patch_json)
+{
+  struct jesy_context *ctx = parse(json);
+  struct jesy_context *patch_ctx = jesy_init_context(patch_pool, sizeof(patch_pool));
+
+  if (!ctx || (jesy_parse(patch_ctx, patch_json, (uint32_t)strlen(patch_json)) != JESY_NO_ERR)) {
+    return JESY_INVALID_PARAMETER;
+  }
+  return jesy_apply_patch(ctx, patch_ctx, patch_array(patch_ctx));
+}
+
+/* test compares numbers by their exact value and strings by their characters. */
+static void test_patch_test_values(void)
+{
+  char id[] = "{\"id\":9007199254740993,\"one\":1.0,\"s\":\"A\\u00e9\"}";
+  char same_id[] = "{\"patch\":[{\"op\":\"test\",\"path\":\"/id\",\"value\":9007199254740993.000}]}";
+  char other_id[] = "{\"patch\":[{\"op\":\"test\",\"path\":\"/id\",\"value\":9007199254740992}]}";
+  char long_one[] = "{\"patch\":[{\"op\":\"test\",\"path\":\"/one\","
+                    "\"value\":1.000000000000000000000000000000000}]}";
+  char other_one[] = "{\"patch\":[{\"op\":\"test\",\"path\":\"/one\","
+                     "\"value\":1.000000000000000000000000000000001}]}";
+  char string[] = "{\"patch\":[{\"op\":\"test\",\"path\":\"/s\",\"value\":\"\\u0041\\u00E9\"}]}";
+  char other_string[] = "{\"patch\":[{\"op\":\"test\",\"path\":\"/s\",\"value\":\"A\"}]}";
+
+  CHECK(apply_patch(id, same_id) == JESY_NO_ERR);
+  CHECK(apply_patch(id, other_id) == JESY_PATCH_TEST_FAILED);
+  CHECK(apply_patch(id, long_one) == JESY_NO_ERR);
+  CHECK(apply_patch(id, other_one) == JESY_PATCH_TEST_FAILED);
+  CHECK(apply_patch(id, string) == JESY_NO_ERR);
+  CHECK(apply_patch(id, other_string) == JESY_PATCH_TEST_FAILED);
+}
+
+/* The patch generated by jesy_diff can be applied to the old document. */
+static void diff_and_apply(char *old_json, char *new_json, char *new_key)
+{
+  static uint8_t new_pool[POOL_SIZE];
+  static uint8_t diff_pool[POOL_SIZE];
+  struct jesy_context *ctx = parse(old_json);
+  struct jesy_context *new_ctx = jesy_init_context(new_pool, sizeof(new_pool));
+  struct jesy_context *diff_ctx = jesy_init_context(diff_pool, sizeof(diff_pool));
+  struct jesy_element *new_root;
+
+  CHECK(ctx != NULL);
+  CHECK(jesy_parse(new_ctx, new_json, (uint32_t)strlen(new_json)) == JESY_NO_ERR);
+  if (!ctx || new_ctx->status) {
+    return;
+  }
+  new_root = new_key ? jesy_get_key_value(new_ctx, new_ctx->root, new_key) : new_ctx->root;
+  CHECK(jesy_diff(ctx, ctx->root, new_ctx, new_root, diff_ctx) == JESY_NO_ERR);
+  CHECK(jesy_apply_patch(ctx, diff_ctx, patch_array(diff_ctx)) == JESY_NO_ERR);
+  CHECK(jesy_equal(ctx, ctx->root, new_ctx, new_root));
+}
+
+/* Integers beyond the precision of double are still told apart by jesy_diff,
+ * different spellings of the same number aren't a change. */
+static void test_diff_numbers(void)
+{
+  static uint8_t new_pool[POOL_SIZE];
+  static uint8_t diff_pool[POOL_SIZE];
+  char old_json[] = "{\"id\":9007199254740993,\"one\":1.0}";
+  char new_json[] = "{\"id\":9007199254740992,\"one\":1.000000000000000000000000000000000}";
+  struct jesy_context *ctx = parse(old_json);
+  struct jesy_context *new_ctx = jesy_init_context(new_pool, sizeof(new_pool));
+  struct jesy_context *diff_ctx = jesy_init_context(diff_pool, sizeof(diff_pool));
+  struct jesy_element *patch;
+  struct jesy_element *op;
+
+  CHECK(ctx != NULL);
+  CHECK(jesy_parse(new_ctx, new_json, (uint32_t)strlen(new_json)) == JESY_NO_ERR);
+  if (!ctx || new_ctx->status) {
+    return;
+  }
+  CHECK(jesy_diff(ctx, ctx->root, new_ctx, new_ctx->root, diff_ctx) == JESY_NO_ERR);
+  patch = patch_array(diff_ctx);
+  op = jesy_get_array_value(diff_ctx, patch, 0);
+  CHECK((op != NULL) && (jesy_get_array_value(diff_ctx, patch, 1) == NULL));
+  if (op) {
+    struct jesy_element *path = jesy_get_key_value(diff_ctx, op, "path");
+    CHECK((path != NULL) && (path->length == 3) && (memcmp(path->value, "/id", 3) == 0));
+  }
+  CHECK(jesy_apply_patch(ctx, diff_ctx, patch) == JESY_NO_ERR);
+  CHECK(jesy_equal(ctx, ctx->root, new_ctx, new_ctx->root));
+}
+
+static void test_diff_apply(void)
+{
+  char old_json[512];
+  char new_json[512];
+  char old_root[] = "{\"a\":1,\"b\":[true]}";
+  char new_root[] = "{\"value\":[1,2,{\"c\":null}]}";
+  uint32_t index;
+  int old_length = sprintf(old_json, "{");
+  int new_length = sprintf(new_json, "{");
+
+  /* More operations than any fixed limit */
+  for (index = 0; index < 20; index++) {
+    old_length += sprintf(&old_json[old_length], "%s\"k%u\":%u", index ? "," : "", index, index);
+    new_length += sprintf(&new_json[new_length], "%s\"k%u\":\"v%u\"", index ? "," : "", index, index);
+  }
+  sprintf(&old_json[old_length], "}");
+  sprintf(&new_json[new_length], "}");
+  diff_and_apply(old_json, new_json, NULL);
+
+  /* A root of a different type */
+  diff_and_apply(old_root, new_root, "value");
+}
+
+/* A number beyond the range of double isn't bound as infinity. */
+static void test_bind_double_range(void)
+{
+  struct values { double a; double b; } values = { 0, 0 };
+  const struct jesy_binding table[] = {
+    JESY_BINDING("a", JESY_BIND_DOUBLE, struct values, a),
+    JESY_BINDING("b", JESY_BIND_DOUBLE, struct values, b),
+  };
+  char json[] = "{\"a\":0,\"b\":0}";
+  struct jesy_context *ctx = parse(json);
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  CHECK(jesy_update_key_value(ctx, ctx->root, "a", JESY_NUMBER, "-1e400") == JESY_NO_ERR);
+  CHECK(jesy_update_key_value(ctx, ctx->root, "b", JESY_NUMBER, "1e-320") == JESY_NO_ERR);
+  CHECK(jesy_bind(ctx, ctx->root, &table[0], 1, &values) == JESY_UNEXPECTED_NODE);
+  CHECK(values.a == 0);
+  CHECK(jesy_bind(ctx, ctx->root, &table[1], 1, &values) == JESY_NO_ERR);
+  CHECK((values.b > 0) && (values.b < 1e-300));
+  /* Texts longer than any integer are still read as doubles */
+  CHECK(jesy_update_key_value(ctx, ctx->root, "b", JESY_NUMBER, "1.00000000000000000000000000000001") == JESY_NO_ERR);
+  CHECK(jesy_bind(ctx, ctx->root, &table[1], 1, &values) == JESY_NO_ERR);
+  CHECK(values.b == 1.0);
+  CHECK(jesy_update_key_value(ctx, ctx->root, "b", JESY_NUMBER, "-12345678901234567890123456789012345678901234567890e-49") == JESY_NO_ERR);
+  CHECK(jesy_bind(ctx, ctx->root, &table[1], 1, &values) == JESY_NO_ERR);
+  CHECK(values.b == -1.2345678901234567890);
+}
+
+/* Strings are unescaped when bound and escaped again when rendered. */
+static void test_bind_strings(void)
+{
+  struct text { char s[16]; char t[4]; } text = { "", "" };
+  const struct jesy_binding table[] = {
+    JESY_BINDING("s", JESY_BIND_STRING, struct text, s),
+    JESY_BINDING("t", JESY_BIND_STRING, struct text, t),
+  };
+  char json[] = "{\"s\":\"say \\\"hi\\\"\\n\\u0041\",\"t\":\"\\u00e9\\u00e9\"}";
+  char expected[] = "{\"s\":\"quote\\\"here\\t\",\"t\":\"\"}";
+  char out[64];
+  struct jesy_context *ctx = parse(json);
+  uint32_t size;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  CHECK(jesy_bind(ctx, ctx->root, &table[0], 1, &text) == JESY_NO_ERR);
+  CHECK(strcmp(text.s, "say \"hi\"\nA") == 0);
+  /* Four raw bytes don't fit with the terminating NUL */
+  CHECK(jesy_bind(ctx, ctx->root, &table[1], 1, &text) == JESY_OUT_OF_MEMORY);
+
+  strcpy(text.s, "quote\"here\t");
+  text.t[0] = '\0';
+  size = jesy_render_binding(table, 2, &text, out, sizeof(out));
+  CHECK((size == (sizeof(expected) - 1)) && (memcmp(out, expected, size) == 0));
+  CHECK(jesy_render_binding(table, 2, &text, NULL, 0) == size);
+}
+
+/* Nested paths are found regardless of their order in the table, including
+ * keys that begin with another key. */
+static void test_bind_nested_paths(void)
+{
+  struct values { int32_t a_b_c; int32_t ab; int32_t a_dash; int32_t a_b_d; int32_t x; int32_t a_e; } values = { 0 };
+  const struct jesy_binding table[] = {
+    JESY_BINDING("a.b.c", JESY_BIND_INT32, struct values, a_b_c),
+    JESY_BINDING("ab", JESY_BIND_INT32, struct values, ab),
+    JESY_BINDING("a-b", JESY_BIND_INT32, struct values, a_dash),
+    JESY_BINDING("x", JESY_BIND_INT32, struct values, x),
+    JESY_BINDING("a.b.d", JESY_BIND_INT32, struct values, a_b_d),
+    JESY_BINDING("a.e", JESY_BIND_INT32, struct values, a_e),
+  };
+  char json[] = "{\"x\":1,\"a\":{\"bc\":9,\"b\":{\"d\":2,\"c\":3},\"e\":4},\"a-b\":5,\"ab\":6,\"a.b\":{\"c\":7}}";
+  struct jesy_context *ctx = parse(json);
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  CHECK(jesy_bind(ctx, ctx->root, table, sizeof(table) / sizeof(table[0]), &values) == JESY_NO_ERR);
+  CHECK((values.x == 1) && (values.a_b_d == 2) && (values.a_b_c == 3));
+  CHECK((values.a_e == 4) && (values.a_dash == 5) && (values.ab == 6));
+}
+
+/* A render resumed in pieces of any size delivers the output of jesy_render. */
+static void test_render_cursor(void)
+{
+  static const uint32_t pieces[] = { 1, 7, 64, DOCUMENT_SIZE };
+  uint32_t document_length;
+  uint32_t reference_length;
+  struct jesy_context *ctx = parse_document(&document_length, &reference_length);
+  uint32_t index;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  for (index = 0; index < (sizeof(pieces) / sizeof(pieces[0])); index++) {
+    struct jesy_render_cursor cursor;
+    uint32_t size = 0;
+    uint32_t written;
+
+    CHECK(jesy_render_begin(ctx, &cursor) == JESY_NO_ERR);
+    CHECK(cursor.size == reference_length);
+    do {
+      written = jesy_render_next(&cursor, &output[size], pieces[index]);
+      size += written;
+    } while ((written == pieces[index]) && (size < reference_length));
+    CHECK(jesy_render_next(&cursor, output, sizeof(output)) == 0);
+    CHECK((size == reference_length) && (memcmp(output, reference, size) == 0));
+  }
+}
+
+/* A parse spread over many steps builds the tree of jesy_parse. */
+static void test_parse_step(void)
+{
+  static const uint32_t budgets[] = { 0, 5, 1000 };
+  uint32_t document_length;
+  uint32_t reference_length;
+  struct jesy_context *ctx = parse_document(&document_length, &reference_length);
+  uint32_t index;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  for (index = 0; index < (sizeof(budgets) / sizeof(budgets[0])); index++) {
+    struct jesy_context *stepped = jesy_init_context(other_pool, sizeof(other_pool));
+    uint32_t status = jesy_parse_begin(stepped, document, document_length);
+    uint32_t steps = 0;
+    uint32_t size;
+
+    while (status == JESY_IN_PROGRESS) {
+      status = jesy_parse_step(stepped, budgets[index]);
+      steps++;
+    }
+    CHECK(status == JESY_NO_ERR);
+    CHECK(steps > 1);
+    CHECK(jesy_parse_step(stepped, budgets[index]) == JESY_NO_ERR);
+    CHECK(stepped->index == ctx->index);
+    CHECK(memcmp(stepped->pool, ctx->pool, ctx->index * sizeof(struct jesy_element)) == 0);
+    size = jesy_render(stepped, output, sizeof(output));
+    CHECK((size == reference_length) && (memcmp(output, reference, size) == 0));
+  }
+}
+
+/* A projection of all root keys gives the output of jesy_parse, narrower ones
+ * keep the selected keys with the containers leading to them. */
+static void test_parse_projection(void)
+{
+  static const char *const all[] = { "end", "items", "meta" };
+  static const char *const some[] = { "items.id", "meta.count", "missing" };
+  uint32_t document_length;
+  uint32_t reference_length;
+  struct jesy_context *ctx = parse_document(&document_length, &reference_length);
+  struct jesy_context *projected = jesy_init_context(other_pool, sizeof(other_pool));
+  uint32_t size;
+  uint32_t index;
+  int len;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  CHECK(jesy_parse_projection(projected, document, document_length, all, 3) == JESY_NO_ERR);
+  size = jesy_render(projected, output, sizeof(output));
+  CHECK((size == reference_length) && (memcmp(output, reference, size) == 0));
+
+  projected = jesy_init_context(other_pool, sizeof(other_pool));
+  CHECK(jesy_parse_projection(projected, document, document_length, some, 3) == JESY_NO_ERR);
+  CHECK(projected->index < (ctx->index / 4));
+  size = jesy_render(projected, output, sizeof(output));
+  len = snprintf(reference, sizeof(reference), "{\"meta\":{\"count\":200},\"items\":[");
+  for (index = 0; index < 200; index++) {
+    len += snprintf(&reference[len], sizeof(reference) - (size_t)len, "%s{\"id\":%u}", index ? "," : "", index);
+  }
+  len += snprintf(&reference[len], sizeof(reference) - (size_t)len, "]}");
+  CHECK((size == (uint32_t)len) && (memcmp(output, reference, size) == 0));
+}
+
+/* Collects the output of a jesy_writer sink. */
+static bool collect(void *arg, const char *data, size_t length)
+{
+  uint32_t *size = (uint32_t*)arg;
+
+  if ((*size + length) > sizeof(output)) {
+    return false;
+  }
+  memcpy(&output[*size], data, length);
+  *size += (uint32_t)length;
+  return true;
+}
+
+/* Writes the document of parse_document with a jesy_writer. */
+static uint32_t write_document(struct jesy_writer *writer)
+{
+  char name[16];
+  uint32_t index;
+
+  jesy_writer_begin_object(writer);
+  jesy_writer_key(writer, "meta");
+  jesy_writer_begin_object(writer);
+  jesy_writer_key(writer, "count");
+  jesy_writer_int(writer, 200);
+  jesy_writer_key(writer, "note");
+  jesy_writer_string(writer, "a \"b\"");
+  jesy_writer_end_object(writer);
+  jesy_writer_key(writer, "items");
+  jesy_writer_begin_array(writer);
+  for (index = 0; index < 200; index++) {
+    snprintf(name, sizeof(name), "item %u", index);
+    jesy_writer_begin_object(writer);
+    jesy_writer_key(writer, "id");
+    jesy_writer_uint(writer, index);
+    jesy_writer_key(writer, "name");
+    jesy_writer_string(writer, name);
+    jesy_writer_key(writer, "tags");
+    jesy_writer_begin_array(writer);
+    jesy_writer_string(writer, "x");
+    jesy_writer_string(writer, "y");
+    jesy_writer_end_array(writer);
+    jesy_writer_key(writer, "v");
+    jesy_writer_double(writer, -(index + 0.25));
+    jesy_writer_key(writer, "ok");
+    jesy_writer_bool(writer, (index % 3) != 0);
+    jesy_writer_key(writer, "z");
+    jesy_writer_null(writer);
+    jesy_writer_end_object(writer);
+  }
+  jesy_writer_end_array(writer);
+  jesy_writer_key(writer, "end");
+  jesy_writer_begin_object(writer);
+  jesy_writer_end_object(writer);
+  jesy_writer_end_object(writer);
+  return jesy_writer_finish(writer);
+}
+
+/* Writing the document without a tree gives the output of jesy_render, into
+ * a buffer as well as through a sink with a small buffer. */
+static void test_writer(void)
+{
+  uint32_t document_length;
+  uint32_t reference_length;
+  struct jesy_context *ctx = parse_document(&document_length, &reference_length);
+  struct jesy_writer writer;
+  char buffer[16];
+  uint32_t size = 0;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  jesy_writer_init(&writer, output, sizeof(output), NULL);
+  CHECK(write_document(&writer) == JESY_NO_ERR);
+  CHECK((writer.size == reference_length) && (memcmp(output, reference, reference_length) == 0));
+
+  jesy_writer_init(&writer, buffer, sizeof(buffer), NULL);
+  jesy_writer_set_sink(&writer, collect, &size);
+  CHECK(write_document(&writer) == JESY_NO_ERR);
+  CHECK((size == reference_length) && (memcmp(output, reference, size) == 0));
+}
+
+#ifdef JESY_ENABLE_IOVEC
+/* Appends the buffers of iov to the output and returns the new size. */
+static uint32_t gather(const struct iovec *iov, uint32_t count, uint32_t size)
+{
+  uint32_t index;
+
+  for (index = 0; index < count; index++) {
+    if ((size + iov[index].iov_len) > sizeof(output)) {
+      return 0;
+    }
+    memcpy(&output[size], iov[index].iov_base, iov[index].iov_len);
+    size += (uint32_t)iov[index].iov_len;
+  }
+  return size;
+}
+
+/* The buffers of the iovec render, at once or in rounds, hold the output of jesy_render. */
+static void test_render_iov(void)
+{
+  static struct iovec iov[0x2000];
+  uint32_t document_length;
+  uint32_t reference_length;
+  struct jesy_context *ctx = parse_document(&document_length, &reference_length);
+  struct jesy_render_cursor cursor;
+  uint32_t count;
+  uint32_t size = 0;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  count = jesy_render_iov(ctx, iov, sizeof(iov) / sizeof(iov[0]));
+  CHECK(count != 0);
+  size = gather(iov, count, 0);
+  CHECK((size == reference_length) && (memcmp(output, reference, size) == 0));
+  CHECK(jesy_render_iov(ctx, iov, 16) == 0);
+  CHECK(ctx->status == JESY_OUT_OF_MEMORY);
+
+  CHECK(jesy_render_begin(ctx, &cursor) == JESY_NO_ERR);
+  size = 0;
+  while ((count = jesy_render_next_iov(&cursor, iov, 16)) != 0) {
+    size = gather(iov, count, size);
+  }
+  CHECK((size == reference_length) && (memcmp(output, reference, size) == 0));
+}
+#endif
+
+#ifdef JESY_ENABLE_THREADS
+/* Rendering on several threads gives the output of jesy_render at any split depth. */
+static void test_render_parallel(void)
+{
+  uint32_t document_length;
+  uint32_t reference_length;
+  struct jesy_context *ctx = parse_document(&document_length, &reference_length);
+  uint32_t depth;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  for (depth = 1; depth <= 3; depth++) {
+    uint32_t size = jesy_render_parallel(ctx, output, sizeof(output), 4, depth);
+    CHECK((size == reference_length) && (memcmp(output, reference, size) == 0));
+  }
+  /* Too small a buffer fails as in jesy_render */
+  CHECK(jesy_render_parallel(ctx, output, reference_length - 1, 4, 2) == 0);
+}
+
+/* The segments parsed on several threads make up the tree of jesy_parse. */
+static void test_parse_parallel(void)
+{
+  uint32_t document_length;
+  uint32_t reference_length;
+  struct jesy_context *ctx = parse_document(&document_length, &reference_length);
+  struct jesy_context *parallel = jesy_init_context(other_pool, sizeof(other_pool));
+  uint32_t size;
+
+  CHECK(ctx != NULL);
+  if (!ctx) {
+    return;
+  }
+  CHECK(jesy_parse_parallel(parallel, document, document_length, 4) == JESY_NO_ERR);
+  CHECK(parallel->index == ctx->index);
+  CHECK(memcmp(parallel->pool, ctx->pool, ctx->index * sizeof(struct jesy_element)) == 0);
+  size = jesy_render(parallel, output, sizeof(output));
+  CHECK((size == reference_length) && (memcmp(output, reference, size) == 0));
+
+  /* A broken segment is reported like jesy_parse does */
+  *strchr(&document[document_length / 2], ':') = ',';
+  parallel = jesy_init_context(other_pool, sizeof(other_pool));
+  ctx = jesy_init_context(document_pool, sizeof(document_pool));
+  CHECK(jesy_parse(ctx, document, document_length) == JESY_UNEXPECTED_TOKEN);
+  CHECK(jesy_parse_parallel(parallel, document, document_length, 4) == JESY_UNEXPECTED_TOKEN);
+  CHECK(parallel->offset == ctx->offset);
+}
+#endif
+
+/* Pool sizes are only given for node counts a context can address. */
+static void test_required_pool_size(void)
+{
+  /* The node descriptors or the 32-bit pool size, whichever limits first */
+  uint32_t largest = (uint32_t)((UINT32_MAX - sizeof(struct jesy_context)) / sizeof(struct jesy_element));
+
+  if (largest > (JESY_INVALID_INDEX - 1)) {
+    largest = JESY_INVALID_INDEX - 1;
+  }
+  CHECK(jesy_required_pool_size(100) > (100 * sizeof(struct jesy_element)));
+  CHECK(jesy_required_pool_size(largest) != 0);
+  CHECK(jesy_required_pool_size(largest + 1) == 0);
+  CHECK(jesy_required_pool_size(JESY_INVALID_INDEX) == 0);
+  CHECK(jesy_required_pool_size(UINT32_MAX) == 0);
+}
+
+int main(void)
+{
+  test_parse_members();
+  test_add_null_context();
+  test_check_minify();
+  test_binary_long_numbers();
+  test_canonical_long_numbers();
+  test_patch_many_operations();
+  test_patch_copy_capacity();
+  test_patch_test_values();
+  test_diff_apply();
+  test_diff_numbers();
+  test_bind_double_range();
+  test_bind_strings();
+  test_bind_nested_paths();
+  test_required_pool_size();
+  test_render_cursor();
+  test_parse_step();
+  test_parse_projection();
+  test_writer();
+#ifdef JESY_ENABLE_IOVEC
+  test_render_iov();
+#endif
+#ifdef JESY_ENABLE_THREADS
+  test_render_parallel();
+  test_parse_parallel();
+#endif
+
+  printf("\n%d failure(s)\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
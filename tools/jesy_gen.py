@@ -0,0 +1,272 @@
+#!/usr/bin/env python3
+"""Generates a schema specialized JESy parser.
+
+The schema is a JSON file describing the top level keys of a message:
+
+    {
+      "name": "sensor_msg",
+      "fields": [
+        { "key": "id",   "type": "int32" },
+        { "key": "name", "type": "string", "size": 32 }
+      ]
+    }
+
+Supported types are bool, int32, int64, uint32, uint64, double and string.
+Strings need a size which includes the NUL terminator.
+
+For each schema a <name>.h and a <name>.c are written. The generated
+<name>_parse() consumes the tokens of the JESy tokenizer, recognizes the known
+keys with a switch on their length and a distinguishing symbol, converts the
+values straight into the struct and keeps unknown keys in the generic JESy tree
+of the context. It reports the same jesy_status codes as jesy_parse.
+
+usage: jesy_gen.py schema.json [-o output_dir]
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+C_TYPES = {
+    "bool":   ("bool",     "JESY_BIND_BOOL"),
+    "int32":  ("int32_t",  "JESY_BIND_INT32"),
+    "int64":  ("int64_t",  "JESY_BIND_INT64"),
+    "uint32": ("uint32_t", "JESY_BIND_UINT32"),
+    "uint64": ("uint64_t", "JESY_BIND_UINT64"),
+    "double": ("double",   "JESY_BIND_DOUBLE"),
+    "string": ("char",     "JESY_BIND_STRING"),
+}
+
+MAX_FIELDS = 64
+
+
+def fail(msg):
+    sys.exit("jesy_gen: " + msg)
+
+
+def c_identifier(text):
+    ident = re.sub(r"[^0-9A-Za-z_]", "_", text)
+    if not ident or ident[0].isdigit():
+        ident = "_" + ident
+    return ident
+
+
+def c_string(text):
+    return '"' + text.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+def load_schema(path):
+    with open(path, "r", encoding="utf-8") as fp:
+        schema = json.load(fp)
+
+    name = schema.get("name")
+    if not name or c_identifier(name) != name:
+        fail("schema needs a valid C identifier as name")
+    fields = schema.get("fields", [])
+    if not fields or len(fields) > MAX_FIELDS:
+        fail("schema needs 1 to %d fields" % MAX_FIELDS)
+
+    members = set()
+    keys = set()
+    for field in fields:
+        key = field.get("key")
+        if not key or len(key.encode("utf-8")) > 0xFFFF:
+            fail("invalid key %r" % key)
+        if key in keys:
+            fail("duplicate key %r" % key)
+        keys.add(key)
+        if field.get("type") not in C_TYPES:
+            fail("unsupported type %r of key %r" % (field.get("type"), key))
+        if field["type"] == "string" and int(field.get("size", 0)) < 1:
+            fail("string key %r needs a size" % key)
+        field.setdefault("member", c_identifier(key))
+        if field["member"] in members or field["member"] == "present":
+            fail("member name %r is not unique" % field["member"])
+        members.add(field["member"])
+    return name, fields
+
+
+def emit_lookup(out, name, fields):
+    """Switch on the key length, then on the symbol that separates most keys of that length."""
+    by_length = {}
+    for idx, field in enumerate(fields):
+        key = field["key"].encode("utf-8")
+        by_length.setdefault(len(key), []).append((key, idx))
+
+    out.append("static int %s_lookup(const char *key, uint16_t length)" % name)
+    out.append("{")
+    out.append("  switch (length) {")
+    for length in sorted(by_length):
+        group = by_length[length]
+        out.append("    case %d:" % length)
+        if len(group) == 1:
+            key, idx = group[0]
+            out.append("      if (0 == memcmp(key, %s, %d)) { return %d; }"
+                       % (c_string(key.decode("utf-8")), length, idx))
+            out.append("      break;")
+            continue
+        position = max(range(length), key=lambda pos: len({k[pos] for k, _ in group}))
+        buckets = {}
+        for key, idx in group:
+            buckets.setdefault(key[position], []).append((key, idx))
+        out.append("      switch ((unsigned char)key[%d]) {" % position)
+        for symbol in sorted(buckets):
+            if 0x20 <= symbol < 0x7F and chr(symbol) not in "'\\":
+                out.append("        case '%c':" % symbol)
+            else:
+                out.append("        case %d:" % symbol)
+            for key, idx in buckets[symbol]:
+                out.append("          if (0 == memcmp(key, %s, %d)) { return %d; }"
+                           % (c_string(key.decode("utf-8")), length, idx))
+            out.append("          break;")
+        out.append("      }")
+        out.append("      break;")
+    out.append("  }")
+    out.append("  return -1;")
+    out.append("}")
+
+
+def generate(schema_path, name, fields):
+    guard = name.upper() + "_H"
+    source = os.path.basename(schema_path)
+
+    header = [
+        "/* Generated by tools/jesy_gen.py from %s. Do not edit. */" % source,
+        "#ifndef %s" % guard,
+        "#define %s" % guard,
+        "",
+        '#include "jesy.h"',
+        "",
+    ]
+    for idx, field in enumerate(fields):
+        header.append("#define %s_%s (1ull << %d)" % (name.upper(), field["member"].upper(), idx))
+    header.append("")
+    header.append("struct %s {" % name)
+    header.append("  /* Bit mask of the keys with non-null values found in the JSON. */")
+    header.append("  uint64_t present;")
+    for field in fields:
+        ctype = C_TYPES[field["type"]][0]
+        if field["type"] == "string":
+            header.append("  %s %s[%d];" % (ctype, field["member"], int(field["size"])))
+        else:
+            header.append("  %s %s;" % (ctype, field["member"]))
+    header.append("};")
+    header.append("")
+    header.append("/* Parses a JSON object into struct %s." % name)
+    header.append(" * param [in] ctx is an initialized context. Keys which are not part of the schema")
+    header.append(" *           are added to its tree, see jesy_get_root.")
+    header.append(" * param [in] json_data in form of string no need to be NUL terminated.")
+    header.append(" * param [in] json_length is the size of json to be parsed.")
+    header.append(" * param [out] msg receives the values of the known keys.")
+    header.append(" *")
+    header.append(" * return status of the parsing process see: enum jesy_status")
+    header.append(" */")
+    header.append("uint32_t %s_parse(struct jesy_context *ctx, char *json_data, uint32_t json_length," % name)
+    header.append("%s struct %s *msg);" % (" " * len("uint32_t %s_parse(" % name), name))
+    header.append("")
+    header.append("#endif")
+
+    body = [
+        "/* Generated by tools/jesy_gen.py from %s. Do not edit. */" % source,
+        "#include <string.h>",
+        '#include "%s.h"' % name,
+        "",
+    ]
+    emit_lookup(body, name, fields)
+    body += [
+        "",
+        "uint32_t %s_parse(struct jesy_context *ctx, char *json_data, uint32_t json_length," % name,
+        "%s struct %s *msg)" % (" " * len("uint32_t %s_parse(" % name), name),
+        "{",
+        "  struct jesy_element *key;",
+        "  char *key_value;",
+        "  uint16_t key_length;",
+        "",
+        "  memset(msg, 0, sizeof(*msg));",
+        "  jesy_tokenizer_init(ctx, json_data, json_length);",
+        "  if (ctx->token.type != JESY_TOKEN_OPENING_BRACKET) {",
+        "    ctx->status = JESY_UNEXPECTED_TOKEN;",
+        "    return ctx->status;",
+        "  }",
+        "",
+        "  if (jesy_next_token(ctx) != JESY_TOKEN_CLOSING_BRACKET) {",
+        "    while (true) {",
+        "      if (ctx->token.type != JESY_TOKEN_STRING) {",
+        "        ctx->status = JESY_UNEXPECTED_TOKEN;",
+        "        break;",
+        "      }",
+        "      key_value = &ctx->json_data[ctx->token.offset];",
+        "      key_length = ctx->token.length;",
+        "      if (jesy_next_token(ctx) != JESY_TOKEN_COLON) {",
+        "        ctx->status = JESY_UNEXPECTED_TOKEN;",
+        "        break;",
+        "      }",
+        "      jesy_next_token(ctx);",
+        "",
+        "      switch (%s_lookup(key_value, key_length)) {" % name,
+    ]
+    for idx, field in enumerate(fields):
+        member = field["member"]
+        body += [
+            "        case %d:" % idx,
+            "          if (ctx->token.type != JESY_TOKEN_NULL) {",
+            "            msg->present |= %s_%s;" % (name.upper(), member.upper()),
+            "          }",
+            "          jesy_convert_token(ctx, %s, &msg->%s, sizeof(msg->%s));"
+            % (C_TYPES[field["type"]][1], member, member),
+            "          break;",
+        ]
+    body += [
+        "        default:",
+        "          /* Unknown keys are kept in the generic JESy tree. */",
+        "          if (!ctx->root && !jesy_add_object(ctx, NULL)) {",
+        "            break;",
+        "          }",
+        "          key = jesy_add_element(ctx, ctx->root, JESY_KEY, key_length, key_value);",
+        "          if (key) {",
+        "            jesy_parse_value(ctx, key);",
+        "          }",
+        "          break;",
+        "      }",
+        "      if (ctx->status) {",
+        "        break;",
+        "      }",
+        "",
+        "      if (ctx->token.type == JESY_TOKEN_COMMA) {",
+        "        jesy_next_token(ctx);",
+        "        continue;",
+        "      }",
+        "      if (ctx->token.type != JESY_TOKEN_CLOSING_BRACKET) {",
+        "        ctx->status = (ctx->token.type == JESY_TOKEN_EOF) ? JESY_UNEXPECTED_EOF : JESY_UNEXPECTED_TOKEN;",
+        "      }",
+        "      break;",
+        "    }",
+        "  }",
+        "",
+        "  if ((ctx->status == 0) && (jesy_next_token(ctx) != JESY_TOKEN_EOF)) {",
+        "    ctx->status = JESY_UNEXPECTED_TOKEN;",
+        "  }",
+        "  return ctx->status;",
+        "}",
+    ]
+    return "\n".join(header) + "\n", "\n".join(body) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Generate a schema specialized JESy parser.")
+    parser.add_argument("schema", help="JSON schema description")
+    parser.add_argument("-o", "--output", default=".", help="output directory")
+    args = parser.parse_args()
+
+    name, fields = load_schema(args.schema)
+    header, body = generate(args.schema, name, fields)
+    with open(os.path.join(args.output, name + ".h"), "w", encoding="utf-8") as fp:
+        fp.write(header)
+    with open(os.path.join(args.output, name + ".c"), "w", encoding="utf-8") as fp:
+        fp.write(body)
+
+
+if __name__ == "__main__":
+    main()